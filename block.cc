@@ -94,6 +94,91 @@ Block Block::split( long long pos, const int hardbs )
   }
 
 
+// 'sb' must follow the area and be aligned to hardbs.
+//
+void Packed_area::append( const Sblock & sb )
+  {
+  if( sb.pos() != end() || sb.pos() % hardbs_ || sb.size() % hardbs_ )
+    internal_error( "bad block appended to packed area." );
+  const int c = Sblock::status_index( sb.status() );
+  const long n = sb.size() / hardbs_;
+  if( n <= 0 ) return;
+  if( sectors_ == 0 || code( sectors_ - 1 ) != c ) ++runs_;
+  words.resize( ( sectors_ + n + codes_per_word - 1 ) / codes_per_word, 0 );
+  for( long i = 0; i < n; ++i ) set_code( sectors_ + i, c );
+  sectors_ += n;
+  status_sectors[c] += n;
+  }
+
+
+// Returns the run of sectors of equal status containing sector i.
+//
+Sblock Packed_area::run( const long i ) const
+  {
+  const int c = code( i );
+  long l = i, r = i + 1;
+  while( l > 0 && code( l - 1 ) == c ) --l;
+  while( r < sectors_ && code( r ) == c ) ++r;
+  return Sblock( pos_ + (long long)l * hardbs_, (long long)( r - l ) * hardbs_,
+                 Sblock::index_status( c ) );
+  }
+
+
+// Find the first run of status st beginning at sector i or after it.
+// The block returned begins at sector i if the run contains it.
+//
+bool Packed_area::find_run( const long i, const Sblock::Status st,
+                            Block & b ) const
+  {
+  const int c = Sblock::status_index( st );
+  if( status_sectors[c] <= 0 ) return false;
+  long l = i;
+  while( l < sectors_ && code( l ) != c ) ++l;
+  if( l >= sectors_ ) return false;
+  long r = l + 1;
+  while( r < sectors_ && code( r ) == c ) ++r;
+  b.assign( pos_ + (long long)l * hardbs_, (long long)( r - l ) * hardbs_ );
+  return true;
+  }
+
+
+// Find the last run of status st ending at sector i or before it.
+// The block returned ends at sector i if the run contains it.
+//
+bool Packed_area::rfind_run( const long i, const Sblock::Status st,
+                             Block & b ) const
+  {
+  const int c = Sblock::status_index( st );
+  if( status_sectors[c] <= 0 ) return false;
+  long r = i;
+  while( r >= 0 && code( r ) != c ) --r;
+  if( r < 0 ) return false;
+  long l = r;
+  while( l > 0 && code( l - 1 ) == c ) --l;
+  b.assign( pos_ + (long long)l * hardbs_, (long long)( r + 1 - l ) * hardbs_ );
+  return true;
+  }
+
+
+// Sectors from 'first' to 'last' (not included) must have the same status.
+//
+void Packed_area::change_status( const long first, const long last,
+                                 const Sblock::Status st )
+  {
+  const int old_c = code( first );
+  const int c = Sblock::status_index( st );
+  if( c == old_c || first >= last ) return;
+  const int lc = ( first > 0 ) ? code( first - 1 ) : -1;
+  const int rc = ( last < sectors_ ) ? code( last ) : -1;
+  // update the number of runs from the borders before and after change
+  runs_ += ( lc >= 0 && lc != c ) + ( rc >= 0 && rc != c ) -
+           ( lc >= 0 && lc != old_c ) - ( rc >= 0 && rc != old_c );
+  for( long i = first; i < last; ++i ) set_code( i, c );
+  status_sectors[old_c] -= last - first;
+  status_sectors[c] += last - first;
+  }
+
+
 Domain::Domain( const long long p, const long long s,
                 const char * const mapname, const bool loose )
   {
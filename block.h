@@ -111,6 +111,97 @@ public:
     { return ( st == non_tried || st == non_trimmed || st == non_scraped ||
                st == bad_sector || st == finished ); }
   static bool is_good_status( const Status st ) { return st != bad_sector; }
+  static int status_index( const Status st )		// 0 to 4
+    {
+    switch( st )
+      {
+      case non_tried:   return 0;
+      case non_trimmed: return 1;
+      case non_scraped: return 2;
+      case bad_sector:  return 3;
+      case finished:    return 4;
+      }
+    return 0;				// should not be reached
+    }
+  static Status index_status( const int i )	// inverse of status_index
+    { const char * const statuses = "?*/-+"; return Status( statuses[i] ); }
+  };
+
+
+// Status of each sector of a fragmented area of the map, packed in 3 bits
+// per sector. Used by Mapfile instead of one Sblock per run of sectors.
+//
+class Packed_area
+  {
+  enum { codes_per_word = 21 };		// 3-bit codes per 64-bit word
+  long long pos_;
+  long sectors_;
+  int hardbs_;
+  long runs_;				// number of runs of equal status
+  long status_sectors[5];		// indexed by Sblock::status_index
+  std::vector< unsigned long long > words;
+
+  int code( const long i ) const
+    { return ( words[i/codes_per_word] >> ( ( i % codes_per_word ) * 3 ) ) & 7; }
+  void set_code( const long i, const int c )
+    {
+    const int shift = ( i % codes_per_word ) * 3;
+    unsigned long long & w = words[i/codes_per_word];
+    w = ( w & ~( 7ULL << shift ) ) | ( (unsigned long long)c << shift );
+    }
+
+public:
+  Packed_area( const long long p, const int hardbs )
+    : pos_( p ), sectors_( 0 ), hardbs_( hardbs ), runs_( 0 )
+    { for( int i = 0; i < 5; ++i ) status_sectors[i] = 0; }
+
+  long long pos() const { return pos_; }
+  long long end() const { return pos_ + (long long)sectors_ * hardbs_; }
+  long sectors() const { return sectors_; }
+  int hardbs() const { return hardbs_; }
+  long runs() const { return runs_; }
+  long sector( const long long pos ) const { return ( pos - pos_ ) / hardbs_; }
+  Sblock::Status status( const long i ) const
+    { return Sblock::index_status( code( i ) ); }
+  bool has_status( const Sblock::Status st ) const
+    { return status_sectors[Sblock::status_index( st )] > 0; }
+  long long memory_size() const
+    { return sizeof *this + words.capacity() * sizeof words[0]; }
+
+  void append( const Sblock & sb );
+  Sblock run( const long i ) const;
+  bool find_run( const long i, const Sblock::Status st, Block & b ) const;
+  bool rfind_run( const long i, const Sblock::Status st, Block & b ) const;
+  void change_status( const long first, const long last,
+                      const Sblock::Status st );
+  };
+
+
+struct Map_summary		// sizes and areas of each status in a map
+  {
+  enum { statuses = 5 };	// indexed by Sblock::status_index
+  Block extent;
+  long areas;			// number of areas after compacting
+  long long sizes[statuses];
+  long status_areas[statuses];
+  int last_index;		// status index of last sblock added
+
+  Map_summary() : extent( 0, 0 ), areas( 0 ), last_index( -1 )
+    { for( int i = 0; i < statuses; ++i )
+        { sizes[i] = 0; status_areas[i] = 0; } }
+
+  void add( const Sblock & sb )		// sblocks must be consecutive
+    {
+    const int i = Sblock::status_index( sb.status() );
+    if( areas == 0 ) extent.assign( sb.pos(), sb.size() );
+    else extent.size( sb.end() - extent.pos() );
+    sizes[i] += sb.size();
+    if( i != last_index ) { ++areas; ++status_areas[i]; last_index = i; }
+    }
+  long long size( const Sblock::Status st ) const
+    { return sizes[Sblock::status_index( st )]; }
+  long areas_of( const Sblock::Status st ) const
+    { return status_areas[Sblock::status_index( st )]; }
   };
 
 
@@ -185,6 +276,98 @@ public:
   };
 
 
+// Vector of consecutive sblocks stored in pages of up to 'page_entries'
+// sblocks. If a page file is used, only the most recently used pages are
+// kept in memory, and the rest are written to the page file.
+// References returned are valid until the next change of the vector, or
+// until 'min_cache_pages' other pages have been accessed.
+//
+class Sblock_vector
+  {
+public:
+  enum { page_entries = 8192, min_cache_pages = 4, prefetch_pages = 4 };
+
+private:
+  struct Page
+    {
+    long first;				// index of first sblock, if valid
+    long size;
+    std::vector< Sblock > * data;	// 0 if not in memory
+    long long file_pos;			// slot in page file, or -1
+    unsigned long last_use;
+    bool dirty;				// data differs from page file
+
+    Page()
+      : first( 0 ), size( 0 ), data( 0 ), file_pos( -1 ), last_use( 0 ),
+        dirty( true ) {}
+    };
+
+  mutable std::vector< Page > pages;
+  mutable std::vector< long > resident;	// pages in memory (only if paged)
+  mutable std::vector< long long > free_slots;	// free slots in page file
+  mutable long long file_end;		// size of page file
+  long size_;				// total number of sblocks
+  mutable long valid_pages;		// pages with valid 'first'
+  mutable long cur_page, cur_first, cur_size;	// page of last access
+  mutable long last_loaded;		// to detect the direction of access
+  mutable unsigned long use_count;
+  long max_resident;			// maximum number of pages in memory
+  int fd;				// page file descriptor, or -1
+
+  Sblock_vector( const Sblock_vector & );	// declared as private
+  void operator=( const Sblock_vector & );	// declared as private
+
+  long find_page( const long i ) const;
+  void make_room() const;
+  void load_page( const long p ) const;
+  void evict_page( const long p ) const;
+  void seek( const long i ) const;
+  std::vector< Sblock > & page_data( const long p );
+  void insert_page( const long p );
+  void remove_page( const long p );
+  void split_page( const long p );
+  void merge_pages( const long p );
+  void invalidate( const long p )
+    { if( valid_pages > p ) valid_pages = p;
+      cur_page = -1; cur_first = cur_size = 0; }
+
+public:
+  Sblock_vector()
+    : file_end( 0 ), size_( 0 ), valid_pages( 0 ), cur_page( -1 ),
+      cur_first( 0 ), cur_size( 0 ), last_loaded( -1 ), use_count( 0 ),
+      max_resident( 0 ), fd( -1 ) {}
+  ~Sblock_vector();
+
+  bool use_page_file( const char * const name, const long long cache_size );
+  bool paged() const { return fd >= 0; }
+
+  long size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const Sblock & operator[]( const long i ) const
+    { if( (unsigned long)( i - cur_first ) >= (unsigned long)cur_size )
+        seek( i );
+      return (*pages[cur_page].data)[i-cur_first]; }
+  Sblock & modify( const long i )	// access sblock i for writing
+    { if( (unsigned long)( i - cur_first ) >= (unsigned long)cur_size )
+        seek( i );
+      pages[cur_page].dirty = true;
+      return (*pages[cur_page].data)[i-cur_first]; }
+  const Sblock & front() const { return (*this)[0]; }
+  const Sblock & back() const { return (*this)[size_-1]; }
+
+  void assign( const Sblock & sb ) { clear(); push_back( sb ); }
+  void clear();
+  void insert( const long i, const Sblock * const first,
+               const Sblock * const last );
+  void insert( const long i, const Sblock & sb )
+    { insert( i, &sb, &sb + 1 ); }
+  void push_back( const Sblock & sb ) { insert( size_, sb ); }
+  void erase( const long first, const long end );
+  void pop_back() { erase( size_ - 1, size_ ); }
+  long long memory_size() const;
+  };
+
+
 class Mapfile
   {
 public:
@@ -196,35 +379,63 @@ private:
   long long current_pos_;
   const char * const filename_;
   std::string current_msg;
+  std::string current_state_;		// rest of status line, for resume
   Status current_status_;
+  int current_pass_;
   mutable long index_;			// cached index of last find or change
   bool read_only_;
-  std::vector< Sblock > sblock_vector;	// note: blocks are consecutive
+  // Blocks are consecutive. A block with status 'packed_status' stands
+  // for the packed area beginning at the same position.
+  mutable Sblock_vector sblock_vector;
+  mutable std::vector< Packed_area > packed_areas;	// ordered by pos
+
+  static const Sblock::Status packed_status = Sblock::Status( 0 );
+  static bool packed( const Sblock & sb )
+    { return sb.status() == packed_status; }
 
   void insert_sblock( const long i, const Sblock & sb )
-    { sblock_vector.insert( sblock_vector.begin() + i, sb ); }
+    { sblock_vector.insert( i, sb ); }
+  long area_index( const long long pos ) const;
+  Sblock::Status status_at( const long i, const long long pos ) const;
+  long locate( const long long pos ) const;
+  long unpack_sblock( const long i ) const;
+  void unpack_all() const;
+  void extend_run( Block & run, long i, const Sblock::Status st,
+                   const Domain & domain, const long long end ) const;
+  void rextend_run( Block & run, long i, const Sblock::Status st,
+                    const Domain & domain, const long long pos ) const;
+  bool join_sblocks( const Block & b, const Domain & domain );
+  void erase_sblocks( const long i );
 
 public:
   explicit Mapfile( const char * const mapname )
     : current_pos_( 0 ), filename_( mapname ), current_status_( copying ),
-      index_( 0 ), read_only_( false ) {}
+      current_pass_( 1 ), index_( 0 ), read_only_( false ) {}
 
   void compact_sblock_vector();
   void extend_sblock_vector( const long long isize );
   bool truncate_vector( const long long end, const bool force = false );
   void set_to_status( const Sblock::Status st )
-    { sblock_vector.assign( 1, Sblock( 0, -1, st ) ); }
-  bool read_mapfile( const int default_sblock_status = 0, const bool ro = true );
+    { sblock_vector.assign( Sblock( 0, -1, st ) ); packed_areas.clear(); }
+  bool read_mapfile( const int default_sblock_status = 0, const bool ro = true,
+                     Map_summary * const summaryp = 0,
+                     bool * const corruptp = 0 );
+  bool read_summary( Map_summary & summary );
   int write_mapfile( FILE * f = 0, const bool timestamp = false,
                      const bool mf_sync = false ) const;
 
   bool blank() const;
   long long current_pos() const { return current_pos_; }
   Status current_status() const { return current_status_; }
+  int current_pass() const { return current_pass_; }
+  const std::string & current_state() const { return current_state_; }
   const char * filename() const { return filename_; }
   bool read_only() const { return read_only_; }
 
   void current_pos( const long long pos ) { current_pos_ = pos; }
+  // 'state' is what the rescue strategy needs to resume the pass exactly.
+  void current_pass( const int pass, const std::string & state )
+    { current_pass_ = pass; current_state_ = state; }
   void current_status( const Status st, const char * const msg = "" )
     { current_status_ = st;
       current_msg = ( st == finished ) ? "Finished" : msg; }
@@ -233,17 +444,28 @@ public:
     { if( sblock_vector.empty() ) return Block( 0, 0 );
       return Block( sblock_vector.front().pos(),
                     sblock_vector.back().end() - sblock_vector.front().pos() ); }
-  const Sblock & sblock( const long i ) const { return sblock_vector[i]; }
+  // Accessing a block by index unpacks it if needed.
+  const Sblock & sblock( const long i ) const
+    { if( packed( sblock_vector[i] ) ) unpack_sblock( i );
+      return sblock_vector[i]; }
   long sblocks() const { return sblock_vector.size(); }
   void change_sblock_status( const long i, const Sblock::Status st )
-    { sblock_vector[i].status( st ); }
+    { if( packed( sblock_vector[i] ) ) unpack_sblock( i );
+      sblock_vector.modify( i ).status( st ); }
+  Sblock sblock_at( const long long pos ) const;
+  long pack_sblocks( const Domain & domain, const int hardbs );
+  long long memory_size() const;
+  bool use_page_file( const char * const name, const long long cache_size )
+    { return sblock_vector.use_page_file( name, cache_size ); }
+  bool paged() const { return sblock_vector.paged(); }
 
   void split_by_domain_borders( const Domain & domain );
   void split_by_mapfile_borders( const Mapfile & mapfile );
   bool try_split_sblock_by( const long long pos, const long i )
     {
+    if( packed( sblock_vector[i] ) ) unpack_sblock( i );
     if( sblock_vector[i].strictly_includes( pos ) )
-      { insert_sblock( i, sblock_vector[i].split( pos ) ); return true; }
+      { insert_sblock( i, sblock_vector.modify( i ).split( pos ) ); return true; }
     return false;
     }
 
@@ -270,10 +492,19 @@ extern int verbosity;
 void show_error( const char * const msg,
                  const int errcode = 0, const bool help = false );
 void internal_error( const char * const msg );
+const char * parse_num( const char * const ptr, const int hardbs,
+                        const long long min, const long long max,
+                        long long & value, const bool comma = false );
+const char * parse_interval( const char * const ptr, long & value );
 int empty_domain();
 int not_readable( const char * const mapname );
 int not_writable( const char * const mapname );
 long initial_time();
+void use_virtual_clock();
+long current_time();			// real or virtual time
+double precise_time();
+void advance_clock( const double seconds );
+void wait_seconds( const long seconds );
 bool write_file_header( FILE * const f, const char * const filetype );
 bool write_timestamp( FILE * const f );
 bool write_final_timestamp( FILE * const f );
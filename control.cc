@@ -0,0 +1,156 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2004-2016 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "control.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+
+namespace {
+
+enum { max_line = 256, max_clients = 16, client_timeout = 5 };
+
+bool set_nonblocking( const int fd, const bool on )
+  {
+  const int flags = fcntl( fd, F_GETFL );
+  return ( flags >= 0 && fcntl( fd, F_SETFL, on ? ( flags | O_NONBLOCK ) :
+                                ( flags & ~O_NONBLOCK ) ) == 0 );
+  }
+
+
+bool set_address( struct sockaddr_un & addr, const char * const name )
+  {
+  if( std::strlen( name ) >= sizeof addr.sun_path )
+    { errno = ENAMETOOLONG; return false; }
+  std::memset( &addr, 0, sizeof addr );
+  addr.sun_family = AF_UNIX;
+  std::strcpy( addr.sun_path, name );
+  return true;
+  }
+
+
+// Returns true if 'name' is a socket nobody is listening on.
+bool stale_socket( const struct sockaddr_un & addr )
+  {
+  struct stat st;
+  if( stat( addr.sun_path, &st ) != 0 || !S_ISSOCK( st.st_mode ) )
+    return false;
+  const int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+  if( fd < 0 ) return false;
+  const bool stale = ( connect( fd, (const struct sockaddr *)&addr,
+                                sizeof addr ) != 0 && errno == ECONNREFUSED );
+  close( fd );
+  return stale;
+  }
+
+} // end namespace
+
+
+Control_socket::~Control_socket()
+  {
+  for( unsigned i = 0; i < clients.size(); ++i ) close( clients[i].fd );
+  if( fd_ >= 0 ) { close( fd_ ); unlink( name_.c_str() ); }
+  }
+
+
+bool Control_socket::open( const char * const name )
+  {
+  struct sockaddr_un addr;
+  if( !set_address( addr, name ) ) return false;
+  const int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+  if( fd < 0 ) return false;
+  int ret = bind( fd, (const struct sockaddr *)&addr, sizeof addr );
+  if( ret != 0 && errno == EADDRINUSE && stale_socket( addr ) &&
+      unlink( name ) == 0 )
+    ret = bind( fd, (const struct sockaddr *)&addr, sizeof addr );
+  if( ret != 0 || listen( fd, 4 ) != 0 || !set_nonblocking( fd, true ) )
+    { const int saved_errno = errno; close( fd ); errno = saved_errno;
+      return false; }
+  name_ = name; fd_ = fd;
+  return true;
+  }
+
+
+int Control_socket::accept_command( std::string & line )
+  {
+  if( fd_ < 0 ) return -1;
+  const long now = std::time( 0 );
+  while( clients.size() < max_clients )
+    {
+    const int cfd = accept( fd_, 0, 0 );
+    if( cfd < 0 ) break;
+    if( set_nonblocking( cfd, true ) )
+      clients.push_back( Client( cfd, now + client_timeout ) );
+    else close( cfd );
+    }
+  for( unsigned i = 0; i < clients.size(); ++i )
+    {
+    Client & c = clients[i];
+    bool done = false;		// line complete, or client closed
+    while( true )
+      {
+      char buf[max_line];
+      const int n = read( c.fd, buf, max_line - c.line.size() );
+      if( n < 0 && errno == EINTR ) continue;
+      if( n <= 0 )
+        { done = ( n == 0 || ( errno != EAGAIN && errno != EWOULDBLOCK ) );
+          break; }
+      c.line.append( buf, n );
+      if( std::memchr( buf, '\n', n ) || c.line.size() >= max_line )
+        { done = true; break; }
+      }
+    if( !done && now <= c.deadline ) continue;
+    const int cfd = c.fd;
+    if( done ) line.swap( c.line );
+    clients.erase( clients.begin() + i-- );
+    if( !done ) { close( cfd ); continue; }		// timed out
+    const unsigned long j = line.find_first_of( "\r\n" );
+    if( j < line.size() ) line.resize( j );
+    set_nonblocking( cfd, false );		// reply is sent at once
+    return cfd;
+    }
+  return -1;
+  }
+
+
+void Control_socket::reply( const int cfd, const std::string & msg )
+  {
+  unsigned long sz = 0;
+  while( sz < msg.size() )
+    {
+    const int n = send( cfd, msg.data() + sz, msg.size() - sz, MSG_NOSIGNAL );
+    if( n > 0 ) sz += n;
+    else if( n < 0 && errno == EINTR ) continue;
+    else break;
+    }
+  close( cfd );
+  }
@@ -0,0 +1,54 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2004-2016 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Local Unix socket through which a running rescue can be queried and
+// reconfigured. Each connection carries one command line and receives
+// one reply, after which the connection is closed.
+//
+class Control_socket
+  {
+  struct Client			// connection whose command line is incomplete
+    {
+    int fd;
+    std::string line;
+    long deadline;			// time after which it is dropped
+    Client( const int f, const long d ) : fd( f ), deadline( d ) {}
+    };
+
+  std::string name_;
+  int fd_;
+  std::vector< Client > clients;
+
+  Control_socket( const Control_socket & );	// declared as private
+  void operator=( const Control_socket & );	// declared as private
+
+public:
+  Control_socket() : fd_( -1 ) {}
+  ~Control_socket();
+
+  // Creates the socket 'name'. A stale socket left by a previous run is
+  // replaced. Returns false and sets errno if error.
+  bool open( const char * const name );
+
+  // Accepts the clients waiting and reads what they have sent, without
+  // waiting for more. If a client has sent a whole command line, puts it
+  // in 'line' and returns the descriptor to pass to reply. Else returns
+  // -1. Clients that don't complete a line in a few seconds are dropped.
+  int accept_command( std::string & line );
+  void reply( const int cfd, const std::string & msg );
+  };
+
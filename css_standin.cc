@@ -0,0 +1,263 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2004-2016 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "css_standin.h"
+#include "dvdcss/dvdcss.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+
+namespace {
+
+struct Title_key
+  {
+  long long first, last;		// sectors of the title VOBs
+  uint8_t key[css_key_size];
+  };
+
+
+// The keystream is produced by a xorshift generator seeded with the title
+// key and the 5 bytes at offset 0x54 of the sector, like the sector key
+// of CSS. The first 128 bytes of the sector are not scrambled.
+//
+void crypt_sector( uint8_t * const sector, const uint8_t * const key )
+  {
+  uint64_t s = 0x9E3779B97F4A7C15ULL;
+  for( int i = 0; i < css_key_size; ++i )
+    s = ( s ^ ( key[i] ^ sector[0x54+i] ) ) * 0x100000001B3ULL;
+  if( s == 0 ) s = 1;
+  for( int i = 128; i < css_block_size; i += 8 )
+    {
+    s ^= s << 13; s ^= s >> 7; s ^= s << 17;
+    for( int j = 0; j < 8; ++j ) sector[i+j] ^= s >> ( 8 * j );
+    }
+  }
+
+
+int hex_value( const int ch )
+  {
+  if( ch >= '0' && ch <= '9' ) return ch - '0';
+  if( ch >= 'A' && ch <= 'F' ) return ch - 'A' + 10;
+  if( ch >= 'a' && ch <= 'f' ) return ch - 'a' + 10;
+  return -1;
+  }
+
+
+// Reads the title keys of the image 'name' from the file 'name.keys'.
+// If the file does not exist, the image is not scrambled.
+// Returns false if the file is not valid.
+//
+bool read_keys( const char * const name, std::vector< Title_key > & keys )
+  {
+  const std::string keysname = std::string( name ) + css_keys_suffix;
+  FILE * const f = std::fopen( keysname.c_str(), "r" );
+  if( !f ) return ( errno == ENOENT );
+  char line[256];
+  bool ok = true;
+  while( ok && std::fgets( line, sizeof line, f ) )
+    {
+    const char * p = line;
+    while( std::isspace( (unsigned char)*p ) ) ++p;
+    if( *p == 0 || *p == '#' ) continue;
+    Title_key tk;
+    char hex[2*css_key_size+2];
+    ok = ( std::sscanf( p, "%lli %lli %11s", &tk.first, &tk.last, hex ) == 3 &&
+           tk.first >= 0 && tk.first <= tk.last &&
+           ( keys.empty() || tk.first > keys.back().last ) &&
+           std::strlen( hex ) == 2 * css_key_size );
+    for( int i = 0; ok && i < css_key_size; ++i )
+      {
+      const int hi = hex_value( hex[2*i] ), lo = hex_value( hex[2*i+1] );
+      if( hi < 0 || lo < 0 ) ok = false;
+      else tk.key[i] = ( hi << 4 ) + lo;
+      }
+    if( ok ) keys.push_back( tk );
+    }
+  std::fclose( f );
+  return ok;
+  }
+
+} // end namespace
+
+
+void css_scramble( uint8_t * const sector, const uint8_t * const key )
+  {
+  crypt_sector( sector, key );
+  sector[0x14] |= 0x10;
+  }
+
+
+void css_unscramble( uint8_t * const sector, const uint8_t * const key )
+  {
+  crypt_sector( sector, key );
+  sector[0x14] &= 0x8F;
+  }
+
+
+struct dvdcss_s
+  {
+  std::vector< Title_key > keys;	// sorted by sector
+  std::string error;
+  long long sectors;			// size of the disc
+  long long pos;			// current sector
+  int fd;
+  int current_key;			// index of key in use, or -1
+
+  dvdcss_s() : sectors( 0 ), pos( 0 ), fd( -1 ), current_key( -1 ) {}
+
+  // Selects the key of the title containing 'sector'.
+  // Returns false if 'sector' is not in a scrambled title.
+  bool select_key( const long long sector )
+    {
+    if( current_key >= 0 && keys[current_key].first <= sector &&
+        sector <= keys[current_key].last ) return true;
+    for( unsigned i = 0; i < keys.size(); ++i )
+      if( keys[i].first <= sector && sector <= keys[i].last )
+        { current_key = i; return true; }
+    return false;
+    }
+  };
+
+
+dvdcss_t dvdcss_open( const char * psz_target )
+  {
+  dvdcss_s * const d = new dvdcss_s;
+  struct stat st;
+  d->fd = open( psz_target, O_RDONLY | O_BINARY );
+  if( d->fd < 0 || fstat( d->fd, &st ) != 0 ||
+      !read_keys( psz_target, d->keys ) )
+    { if( d->fd >= 0 ) close( d->fd ); delete d; return 0; }
+  d->sectors = st.st_size / css_block_size;
+  if( d->sectors <= 0 )			// block device
+    {
+    const long long size = lseek( d->fd, 0, SEEK_END );
+    if( size > 0 ) d->sectors = size / css_block_size;
+    }
+  return d;
+  }
+
+
+dvdcss_t dvdcss_open_stream( void *, dvdcss_stream_cb * ) { return 0; }
+
+
+int dvdcss_close( dvdcss_t dvdcss )
+  {
+  if( !dvdcss ) return -1;
+  const int retval = close( dvdcss->fd );
+  delete dvdcss;
+  return retval;
+  }
+
+
+// Seeking past the last sector fails, as it does on a drive.
+// DVDCSS_SEEK_KEY selects the key of the title containing the sector.
+//
+int dvdcss_seek( dvdcss_t dvdcss, int i_blocks, int i_flags )
+  {
+  if( !dvdcss ) return -1;
+  if( i_blocks < 0 || i_blocks >= dvdcss->sectors )
+    { dvdcss->error = "seek outside of disc"; return -1; }
+  if( ( i_flags & ( DVDCSS_SEEK_KEY | DVDCSS_SEEK_MPEG ) ) &&
+      !dvdcss->select_key( i_blocks ) )
+    dvdcss->current_key = -1;
+  dvdcss->pos = i_blocks;
+  return i_blocks;
+  }
+
+
+// Unlike libdvdcss, which uses the key of the last title selected with
+// dvdcss_seek, the key used to unscramble each block is that of the title
+// containing it, because ddrescue reads the disc without selecting titles.
+//
+int dvdcss_read( dvdcss_t dvdcss, void * p_buffer, int i_blocks, int i_flags )
+  {
+  if( !dvdcss || i_blocks < 0 ) return -1;
+  uint8_t * const buf = (uint8_t *)p_buffer;
+  long long size = dvdcss->sectors - dvdcss->pos;
+  if( size > i_blocks ) size = i_blocks;
+  size *= css_block_size;
+  long long sz = 0;
+  while( sz < size )
+    {
+    const long n = pread( dvdcss->fd, buf + sz, size - sz,
+                          dvdcss->pos * css_block_size + sz );
+    if( n > 0 ) sz += n;
+    else if( n == 0 ) break;
+    else if( errno != EINTR )
+      {
+      dvdcss->error = std::strerror( errno );
+      if( sz < css_block_size ) return -1;
+      break;
+      }
+    }
+  const int blocks = sz / css_block_size;
+  if( i_flags & DVDCSS_READ_DECRYPT )
+    for( int i = 0; i < blocks; ++i )
+      {
+      uint8_t * const sector = buf + i * css_block_size;
+      if( !css_is_scrambled( sector ) ) continue;
+      if( dvdcss->select_key( dvdcss->pos + i ) )
+        css_unscramble( sector, dvdcss->keys[dvdcss->current_key].key );
+      else dvdcss->error = "no key but found encrypted block";
+      }
+  dvdcss->pos += blocks;
+  return blocks;
+  }
+
+
+int dvdcss_readv( dvdcss_t dvdcss, void * p_iovec, int i_blocks, int i_flags )
+  {
+  const struct iovec * iov = (const struct iovec *)p_iovec;
+  int blocks = 0;
+  while( blocks < i_blocks )
+    {
+    const int n = iov->iov_len / css_block_size;
+    if( n <= 0 ) { ++iov; continue; }
+    const int rd = dvdcss_read( dvdcss, iov->iov_base,
+                                std::min( n, i_blocks - blocks ), i_flags );
+    if( rd < 0 ) return blocks ? blocks : -1;
+    blocks += rd;
+    if( rd < n ) break;
+    ++iov;
+    }
+  return blocks;
+  }
+
+
+const char * dvdcss_error( const dvdcss_t dvdcss )
+  { return dvdcss ? dvdcss->error.c_str() : ""; }
+
+
+int dvdcss_is_scrambled( dvdcss_t dvdcss )
+  { return dvdcss && !dvdcss->keys.empty(); }
@@ -0,0 +1,36 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2004-2016 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Stand-in for the CSS layer of libdvdcss, used to test the '--dvd'
+// option on images created by dvdgen. The sectors are scrambled with a
+// simple stream cipher instead of CSS. The title keys, that a real drive
+// gives after authentication, are read from the text file '<image>.keys'
+// written by dvdgen. Each line of the file contains the first and last
+// sectors of the title VOBs of a title set, and its title key as 10
+// hexadecimal digits.
+//
+enum { css_block_size = 2048, css_key_size = 5 };
+
+const char * const css_keys_suffix = ".keys";
+
+// Returns true if the scrambling control bits of the PES header of the
+// MPEG pack in 'sector' are set.
+inline bool css_is_scrambled( const uint8_t * const sector )
+  { return sector[0x14] & 0x30; }
+
+void css_scramble( uint8_t * const sector, const uint8_t * const key );
+void css_unscramble( uint8_t * const sector, const uint8_t * const key );
@@ -31,8 +31,14 @@
 #include <string>
 #include <vector>
 #include <stdint.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 
 #include "arg_parser.h"
+#include "rational.h"
 #include "block.h"
 
 
@@ -43,7 +49,8 @@ const char * const program_name = "ddrescuelog";
 const char * invocation_name = 0;
 
 enum Mode { m_none, m_and, m_change, m_compare, m_complete, m_create,
-            m_delete, m_done_st, m_invert, m_list, m_or, m_status, m_xor };
+            m_delete, m_done_st, m_fleet, m_invert, m_list, m_or, m_status,
+            m_xor };
 
 
 void show_help( const int hardbs )
@@ -80,6 +87,8 @@ void show_help( const int hardbs )
                "  -x, --xor-mapfile=<file>        XOR the finished blocks in file with mapfile\n"
                "  -y, --and-mapfile=<file>        AND the finished blocks in file with mapfile\n"
                "  -z, --or-mapfile=<file>         OR the finished blocks in file with mapfile\n"
+               "      --fleet-status[=json]       show totals of many mapfiles in one table\n"
+               "      --jobs=<n>                  mapfiles to read at a time [processors]\n"
                "Numbers may be in decimal, hexadecimal or octal, and may be followed by a\n"
                "multiplier: s = sectors, k = 1000, Ki = 1024, M = 10^6, Mi = 2^20, etc...\n"
                "\nExit status: 0 for a normal exit, 1 for environmental problems (file\n"
@@ -345,29 +354,49 @@ int create_mapfile( Domain & domain, const char * const mapname,
   }
 
 
+// Returns true if domain is the default one, which includes any mapfile.
+//
+bool default_domain( const Domain & domain )
+  { return ( domain.blocks() == 1 && domain.pos() <= 0 && domain.full() ); }
+
+
 int test_if_done( Domain & domain, const char * const mapname, const bool del )
   {
   char buf[80];
   Mapfile mapfile( mapname );
-  if( !mapfile.read_mapfile( 0, !del ) ) return not_readable( mapname );
-  domain.crop( mapfile.extent() );
-  if( domain.empty() ) return empty_domain();
-  mapfile.split_by_domain_borders( domain );
+  Map_summary summary;
+  bool done = true;
+  // An edit of the mapfile not changing its size is not detected by the
+  // summary, so the whole mapfile is checked before deleting it.
+  if( !del && default_domain( domain ) && mapfile.read_summary( summary ) )
+    {
+    domain.crop( summary.extent );
+    if( domain.empty() ) return empty_domain();
+    done = ( summary.size( Sblock::finished ) == summary.extent.size() );
+    }
+  else
+    {
+    if( !mapfile.read_mapfile( 0, !del ) ) return not_readable( mapname );
+    domain.crop( mapfile.extent() );
+    if( domain.empty() ) return empty_domain();
+    mapfile.split_by_domain_borders( domain );
 
-  for( long i = 0; i < mapfile.sblocks(); ++i )
+    for( long i = 0; i < mapfile.sblocks(); ++i )
+      {
+      const Sblock & sb = mapfile.sblock( i );
+      if( !domain.includes( sb ) )
+        { if( domain < sb ) break; else continue; }
+      if( sb.status() != Sblock::finished ) { done = false; break; }
+      }
+    }
+  if( !done )
     {
-    const Sblock & sb = mapfile.sblock( i );
-    if( !domain.includes( sb ) )
-      { if( domain < sb ) break; else continue; }
-    if( sb.status() != Sblock::finished )
+    if( verbosity >= 1 )
       {
-      if( verbosity >= 1 )
-        {
-        snprintf( buf, sizeof buf, "Mapfile '%s' not done.", mapname );
-        show_error( buf );
-        }
-      return 1;
+      snprintf( buf, sizeof buf, "Mapfile '%s' not done.", mapname );
+      show_error( buf );
       }
+    return 1;
     }
   if( !del ) return 0;
   if( std::remove( mapname ) != 0 )
@@ -417,41 +446,68 @@ int to_badblocks( const long long offset, Domain & domain,
   }
 
 
-int do_show_status( Domain & domain, const char * const mapname,
-                    const bool loose )
+// Reads into 'summary' the totals of the part of 'mapfile' inside
+// 'domain', from the summary line of the mapfile if possible.
+// Return values: 0 OK, 1 mapfile not readable, -1 domain empty.
+// If 'corruptp' is not null, a corrupt mapfile sets it and returns 1
+// instead of exiting.
+//
+int read_totals( Domain & domain, Mapfile & mapfile, Map_summary & summary,
+                 const bool loose, bool * const from_summaryp = 0,
+                 bool * const corruptp = 0 )
   {
-  long long non_tried_size = 0, non_trimmed_size = 0, non_scraped_size = 0;
-  long long bad_sector_size = 0, finished_size = 0;
-  long non_tried_areas = 0, non_trimmed_areas = 0, non_scraped_areas = 0;
-  long bad_sector_areas = 0, finished_areas = 0;
-  Mapfile mapfile( mapname );
-  if( !mapfile.read_mapfile( loose ? '?' : 0 ) ) return not_readable( mapname );
-  mapfile.compact_sblock_vector();
-  const Block extent = mapfile.extent();
-  domain.crop( extent );
-  if( domain.empty() ) return empty_domain();
-  const long true_sblocks = mapfile.sblocks();
-  mapfile.split_by_domain_borders( domain );
-
-  for( long i = 0; i < mapfile.sblocks(); ++i )
+  const bool from_summary =
+    default_domain( domain ) && mapfile.read_summary( summary );
+  if( from_summaryp ) *from_summaryp = from_summary;
+  if( !from_summary )
     {
-    const Sblock & sb = mapfile.sblock( i );
-    if( !domain.includes( sb ) )
-      { if( domain < sb ) break; else continue; }
-    switch( sb.status() )
+    if( !mapfile.read_mapfile( loose ? '?' : 0, true, 0, corruptp ) )
+      return 1;
+    mapfile.compact_sblock_vector();
+    summary.extent = mapfile.extent();
+    summary.areas = mapfile.sblocks();
+    domain.crop( summary.extent );
+    if( domain.empty() ) return -1;
+    mapfile.split_by_domain_borders( domain );
+
+    for( long i = 0; i < mapfile.sblocks(); ++i )
       {
-      case Sblock::non_tried:   non_tried_size += sb.size();
-                                ++non_tried_areas; break;
-      case Sblock::non_trimmed: non_trimmed_size += sb.size();
-                                ++non_trimmed_areas; break;
-      case Sblock::non_scraped: non_scraped_size += sb.size();
-                                ++non_scraped_areas; break;
-      case Sblock::bad_sector:  bad_sector_size += sb.size();
-                                ++bad_sector_areas; break;
-      case Sblock::finished:    finished_size += sb.size();
-                                ++finished_areas; break;
+      const Sblock & sb = mapfile.sblock( i );
+      if( !domain.includes( sb ) )
+        { if( domain < sb ) break; else continue; }
+      const int j = Sblock::status_index( sb.status() );
+      summary.sizes[j] += sb.size(); ++summary.status_areas[j];
       }
     }
+  else
+    {
+    domain.crop( summary.extent );
+    if( domain.empty() ) return -1;
+    }
+  return 0;
+  }
+
+
+int do_show_status( Domain & domain, const char * const mapname,
+                    const bool loose )
+  {
+  Map_summary summary;
+  Mapfile mapfile( mapname );
+  const int retval = read_totals( domain, mapfile, summary, loose );
+  if( retval > 0 ) return not_readable( mapname );
+  if( retval < 0 ) return empty_domain();
+  const Block & extent = summary.extent;
+  const long long non_tried_size = summary.size( Sblock::non_tried );
+  const long long non_trimmed_size = summary.size( Sblock::non_trimmed );
+  const long long non_scraped_size = summary.size( Sblock::non_scraped );
+  const long long bad_sector_size = summary.size( Sblock::bad_sector );
+  const long long finished_size = summary.size( Sblock::finished );
+  const long non_tried_areas = summary.areas_of( Sblock::non_tried );
+  const long non_trimmed_areas = summary.areas_of( Sblock::non_trimmed );
+  const long non_scraped_areas = summary.areas_of( Sblock::non_scraped );
+  const long bad_sector_areas = summary.areas_of( Sblock::bad_sector );
+  const long finished_areas = summary.areas_of( Sblock::finished );
+  const long true_sblocks = summary.areas;
 
   const long long domain_size = domain.in_size();
   if( verbosity >= 1 ) std::printf( "\n%s", mapname );
@@ -485,6 +541,250 @@ int do_show_status( Domain & domain, const char * const mapname,
   return 0;
   }
 
+
+struct Fleet_entry		// totals of one mapfile, sent by a worker
+  {
+  long long current_pos;
+  long long extent_size;
+  long long domain_size;
+  long long sizes[Map_summary::statuses];
+  long status_areas[Map_summary::statuses];
+  int retval;			// exit status of worker, or -1 if unknown
+  int current_pass;
+  char current_status;
+  bool from_summary;
+  };
+
+struct Fleet_worker { pid_t pid; int fd; unsigned index; };
+
+
+// Fills 'e' with the totals of 'mapname'. Returns the exit status.
+// A corrupt mapfile is reported and gives status 2 without exiting, so
+// that it can be read in the main process if a worker can't be started.
+//
+int fleet_entry( const char * const mapname, Domain & domain,
+                 const bool loose, Fleet_entry & e )
+  {
+  std::memset( &e, 0, sizeof e );
+  Map_summary summary;
+  Mapfile mapfile( mapname );
+  bool from_summary = false, corrupt = false;
+  const int retval = read_totals( domain, mapfile, summary, loose,
+                                  &from_summary, &corrupt );
+  if( retval > 0 )
+    { e.retval = corrupt ? 2 : not_readable( mapname ); return e.retval; }
+  e.current_pos = mapfile.current_pos();
+  e.extent_size = summary.extent.size();
+  e.domain_size = ( retval < 0 ) ? 0 : domain.in_size();
+  for( int i = 0; i < Map_summary::statuses; ++i )
+    { e.sizes[i] = summary.sizes[i]; e.status_areas[i] = summary.status_areas[i]; }
+  e.current_pass = mapfile.current_pass();
+  e.current_status = mapfile.current_status();
+  e.from_summary = from_summary;
+  return e.retval;
+  }
+
+
+// Appends to 'names' the regular files in directory 'dirname', sorted by
+// name, or 'dirname' itself if it is not a directory.
+//
+void add_fleet_names( const std::string & dirname,
+                      std::vector< std::string > & names )
+  {
+  struct stat st;
+  DIR * dir;
+  if( stat( dirname.c_str(), &st ) != 0 || !S_ISDIR( st.st_mode ) ||
+      !( dir = opendir( dirname.c_str() ) ) )
+    { names.push_back( dirname ); return; }
+  std::vector< std::string > entries;
+  const struct dirent * ent;
+  while( ( ent = readdir( dir ) ) != 0 )
+    {
+    if( ent->d_name[0] == '.' ) continue;
+    const std::string name = dirname +
+      ( dirname[dirname.size()-1] == '/' ? "" : "/" ) + ent->d_name;
+    if( stat( name.c_str(), &st ) == 0 && S_ISREG( st.st_mode ) )
+      entries.push_back( name );
+    }
+  closedir( dir );
+  std::sort( entries.begin(), entries.end() );
+  names.insert( names.end(), entries.begin(), entries.end() );
+  }
+
+
+// Reads the totals of each mapfile in a separate process, running at
+// most 'jobs' processes at a time. A worker exiting because of a corrupt
+// mapfile does not affect the totals of the other mapfiles.
+//
+void read_fleet( const std::vector< std::string > & names,
+                 std::vector< Fleet_entry > & entries, const int jobs,
+                 const Domain & base_domain, const bool loose )
+  {
+  std::vector< Fleet_worker > workers;
+  unsigned next = 0;
+  std::fflush( stdout ); std::fflush( stderr );
+  while( next < names.size() || workers.size() )
+    {
+    while( next < names.size() && (int)workers.size() < jobs )
+      {
+      const unsigned i = next++;
+      Domain domain( base_domain );
+      int fds[2];
+      if( pipe( fds ) != 0 ) fds[0] = fds[1] = -1;
+      const pid_t pid = ( fds[0] >= 0 ) ? fork() : -1;
+      if( pid == 0 )				// worker
+        {
+        close( fds[0] );
+        Fleet_entry e;
+        const int retval = fleet_entry( names[i].c_str(), domain, loose, e );
+        const bool ok = ( write( fds[1], &e, sizeof e ) == (int)sizeof e );
+        _exit( ok ? retval : 1 );
+        }
+      if( pid < 0 )		// can't fork; read the mapfile here
+        {
+        if( fds[0] >= 0 ) { close( fds[0] ); close( fds[1] ); }
+        fleet_entry( names[i].c_str(), domain, loose, entries[i] );
+        continue;
+        }
+      close( fds[1] );
+      const Fleet_worker w = { pid, fds[0], i };
+      workers.push_back( w );
+      }
+    if( workers.empty() ) continue;
+    int status;
+    const pid_t pid = wait( &status );
+    if( pid < 0 ) { if( errno == EINTR ) continue; break; }
+    for( unsigned j = 0; j < workers.size(); ++j )
+      if( workers[j].pid == pid )
+        {
+        Fleet_entry & e = entries[workers[j].index];
+        if( read( workers[j].fd, &e, sizeof e ) != (int)sizeof e )
+          e.retval = ( WIFEXITED( status ) && WEXITSTATUS( status ) ) ?
+                     WEXITSTATUS( status ) : 1;
+        close( workers[j].fd );
+        workers.erase( workers.begin() + j );
+        break;
+        }
+    }
+  }
+
+
+void print_json_string( const std::string & s )
+  {
+  std::fputc( '"', stdout );
+  for( unsigned i = 0; i < s.size(); ++i )
+    {
+    const unsigned char ch = s[i];
+    if( ch == '"' || ch == '\\' ) std::printf( "\\%c", ch );
+    else if( ch < 0x20 ) std::printf( "\\u%04X", ch );
+    else std::fputc( ch, stdout );
+    }
+  std::fputc( '"', stdout );
+  }
+
+
+// Prints in one table (or JSON array) the totals of many mapfiles, read
+// in parallel. Directories are replaced by the regular files in them.
+//
+int do_fleet_status( const std::vector< std::string > & args,
+                     const int jobs, const bool json,
+                     const Domain & domain, const bool loose )
+  {
+  std::vector< std::string > names;
+  for( unsigned i = 0; i < args.size(); ++i )
+    add_fleet_names( args[i], names );
+  if( names.empty() )
+    { show_error( "No mapfiles found." ); return 1; }
+  Fleet_entry empty_entry;
+  std::memset( &empty_entry, 0, sizeof empty_entry );
+  empty_entry.retval = -1;
+  std::vector< Fleet_entry > entries( names.size(), empty_entry );
+  read_fleet( names, entries, jobs, domain, loose );
+
+  const int nt = Sblock::status_index( Sblock::non_tried );
+  const int ntr = Sblock::status_index( Sblock::non_trimmed );
+  const int nsc = Sblock::status_index( Sblock::non_scraped );
+  const int bad = Sblock::status_index( Sblock::bad_sector );
+  const int fin = Sblock::status_index( Sblock::finished );
+  Fleet_entry total = empty_entry;
+  int retval = 0, failed = 0;
+  if( json ) std::fputs( "[\n", stdout );
+  else
+    std::printf( "%11s %8s %11s %7s %11s %11s %11s %11s  %-10s %s\n",
+                 "rescued", "pct", "errsize", "errors", "non-tried",
+                 "non-trimmed", "non-scraped", "current pos", "status",
+                 "mapfile" );
+  for( unsigned i = 0; i < entries.size(); ++i )
+    {
+    const Fleet_entry & e = entries[i];
+    if( e.retval != 0 )
+      {
+      retval = std::max( retval, ( e.retval < 0 ) ? 1 : e.retval ); ++failed;
+      if( json )
+        { std::fputs( "  { \"mapfile\": ", stdout );
+          print_json_string( names[i] );
+          std::printf( ", \"ok\": false, \"exit_status\": %d }%s\n",
+                       e.retval, ( i + 1 < entries.size() ) ? "," : "" ); }
+      else
+        std::printf( "%11s %8s %11s %7s %11s %11s %11s %11s  %-10s %s\n",
+                     "-", "-", "-", "-", "-", "-", "-", "-", "error",
+                     names[i].c_str() );
+      continue;
+      }
+    total.domain_size += e.domain_size;
+    for( int j = 0; j < Map_summary::statuses; ++j )
+      { total.sizes[j] += e.sizes[j];
+        total.status_areas[j] += e.status_areas[j]; }
+    const char * const status_name =
+      Mapfile::status_name( Mapfile::Status( e.current_status ) );
+    if( json )
+      {
+      std::fputs( "  { \"mapfile\": ", stdout );
+      print_json_string( names[i] );
+      std::printf( ", \"ok\": true, \"from_summary\": %s,\n"
+                   "    \"current_pos\": %lld, \"current_status\": \"%s\", "
+                   "\"current_pass\": %d,\n"
+                   "    \"extent\": %lld, \"domain_size\": %lld, "
+                   "\"non_tried\": %lld, \"rescued\": %lld,\n"
+                   "    \"non_trimmed\": %lld, \"non_scraped\": %lld, "
+                   "\"errsize\": %lld, \"errors\": %ld,\n"
+                   "    \"rescued_percent\": %.2f }%s\n",
+                   e.from_summary ? "true" : "false", e.current_pos,
+                   status_name, e.current_pass, e.extent_size,
+                   e.domain_size, e.sizes[nt], e.sizes[fin], e.sizes[ntr],
+                   e.sizes[nsc], e.sizes[bad], e.status_areas[bad],
+                   e.domain_size ? 100.0 * e.sizes[fin] / e.domain_size : 0.0,
+                   ( i + 1 < entries.size() ) ? "," : "" );
+      }
+    else
+      {
+      std::printf( "%10sB %8s ", format_num( e.sizes[fin] ),
+                   format_percentage( e.sizes[fin], e.domain_size, 3, 2 ) );
+      std::printf( "%10sB %7ld ", format_num( e.sizes[bad], 99999 ),
+                   e.status_areas[bad] );
+      std::printf( "%10sB %10sB %10sB %10sB  %-10s %s\n",
+                   format_num( e.sizes[nt] ), format_num( e.sizes[ntr] ),
+                   format_num( e.sizes[nsc] ), format_num( e.current_pos ),
+                   status_name, names[i].c_str() );
+      }
+    }
+  if( json ) std::fputs( "]\n", stdout );
+  else if( entries.size() > 1 )
+    {
+    std::printf( "%10sB %8s ", format_num( total.sizes[fin] ),
+                 format_percentage( total.sizes[fin], total.domain_size, 3, 2 ) );
+    std::printf( "%10sB %7ld ", format_num( total.sizes[bad], 99999 ),
+                 total.status_areas[bad] );
+    std::printf( "%10sB %10sB %10sB %11s  %-10s total of %u mapfiles",
+                 format_num( total.sizes[nt] ), format_num( total.sizes[ntr] ),
+                 format_num( total.sizes[nsc] ), "", "",
+                 (unsigned)entries.size() - failed );
+    if( failed ) std::printf( " (%d not readable)", failed );
+    std::fputc( '\n', stdout );
+    }
+  return retval;
+  }
+
 } // end namespace
 
 
@@ -503,7 +803,9 @@ int main( const int argc, const char * const argv[] )
   Mode program_mode = m_none;
   bool as_domain = false;
   bool force = false;
+  bool json = false;
   bool loose = false;
+  int jobs = 0;				// 0 = number of processors
   std::string types1, types2;
   Sblock::Status type1 = Sblock::finished, type2 = Sblock::bad_sector;
   Sblock::Status complete_type = Sblock::non_tried;
@@ -512,6 +814,7 @@ int main( const int argc, const char * const argv[] )
   for( int i = 1; i < argc; ++i )
     { command_line += ' '; command_line += argv[i]; }
 
+  enum Optcode { opt_fle = 256, opt_job };
   const Arg_parser::Option options[] =
     {
     { 'a', "change-types",        Arg_parser::yes },
@@ -549,6 +852,8 @@ int main( const int argc, const char * const argv[] )
     { 'y', "and-logfile",         Arg_parser::yes },
     { 'z', "or-mapfile",          Arg_parser::yes },
     { 'z', "or-logfile",          Arg_parser::yes },
+    { opt_fle, "fleet-status",    Arg_parser::maybe },
+    { opt_job, "jobs",            Arg_parser::yes },
     {  0 , 0,                     Arg_parser::no  } };
 
   const Arg_parser parser( argc, argv, options );
@@ -597,6 +902,13 @@ int main( const int argc, const char * const argv[] )
                 second_mapname = ptr; break;
       case 'z': set_mode( program_mode, m_or );
                 second_mapname = ptr; break;
+      case opt_fle: set_mode( program_mode, m_fleet );
+                if( arg == "json" ) json = true;
+                else if( arg.size() && arg != "table" )
+                  { show_error( "Bad format in option '--fleet-status'.", 0, true );
+                    return 1; }
+                break;
+      case opt_job: jobs = getnum( ptr, 0, 1, 1024 ); break;
       default : internal_error( "uncaught option." );
       }
     } // end process options
@@ -609,7 +921,7 @@ int main( const int argc, const char * const argv[] )
 
   if( opos < 0 ) opos = ipos;
 
-  if( program_mode == m_status )
+  if( program_mode == m_status || program_mode == m_fleet )
     {
     if( argind >= parser.arguments() )
       { show_error( "At least one mapfile must be specified.", 0, true );
@@ -624,6 +936,18 @@ int main( const int argc, const char * const argv[] )
     return 1;
     }
 
+  if( program_mode == m_fleet )
+    {
+    std::vector< std::string > args;
+    for( ; argind < parser.arguments(); ++argind )
+      args.push_back( parser.argument( argind ) );
+    if( jobs <= 0 )
+      { const long n = sysconf( _SC_NPROCESSORS_ONLN );
+        jobs = ( n > 0 ) ? std::min( n, 64L ) : 1; }
+    const Domain domain( ipos, max_size, domain_mapfile_name, loose );
+    return do_fleet_status( args, jobs, json, domain, loose );
+    }
+
   int retval = 0;
   for( ; argind < parser.arguments(); ++argind )
     {
@@ -632,7 +956,8 @@ int main( const int argc, const char * const argv[] )
 
     switch( program_mode )
       {
-      case m_none: internal_error( "invalid operation." ); break;
+      case m_none:
+      case m_fleet: internal_error( "invalid operation." ); break;
       case m_and:
       case m_or:
       case m_xor:
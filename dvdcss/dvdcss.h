@@ -0,0 +1,59 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2004-2016 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Interface of libdvdcss implemented by the CSS stand-in (css_standin.cc).
+// Used instead of the header of libdvdcss when ddrescue is configured
+// with '--enable-css-standin'.
+
+#ifndef DVDCSS_DVDCSS_H
+#define DVDCSS_DVDCSS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DVDCSS_BLOCK_SIZE      2048
+#define DVDCSS_NOFLAGS         0
+#define DVDCSS_READ_DECRYPT    (1 << 0)
+#define DVDCSS_SEEK_MPEG       (1 << 0)
+#define DVDCSS_SEEK_KEY        (1 << 1)
+
+typedef struct dvdcss_s * dvdcss_t;
+
+typedef struct dvdcss_stream_cb
+  {
+  int ( *pf_seek )( void * p_stream, uint64_t i_pos );
+  int ( *pf_read )( void * p_stream, void * buffer, int i_read );
+  int ( *pf_readv )( void * p_stream, void * p_iovec, int i_blocks );
+  } dvdcss_stream_cb;
+
+dvdcss_t dvdcss_open( const char * psz_target );
+dvdcss_t dvdcss_open_stream( void * p_stream, dvdcss_stream_cb * p_stream_cb );
+int dvdcss_close( dvdcss_t dvdcss );
+int dvdcss_seek( dvdcss_t dvdcss, int i_blocks, int i_flags );
+int dvdcss_read( dvdcss_t dvdcss, void * p_buffer, int i_blocks, int i_flags );
+int dvdcss_readv( dvdcss_t dvdcss, void * p_iovec, int i_blocks, int i_flags );
+const char * dvdcss_error( const dvdcss_t dvdcss );
+int dvdcss_is_scrambled( dvdcss_t dvdcss );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
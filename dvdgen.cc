@@ -0,0 +1,1076 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2004-2016 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+    Dvdgen creates synthetic DVD-Video images to test and benchmark the
+    option '--dvd' of ddrescue without a physical disc. The image contains
+    a UDF 1.02 file system with an ISO 9660 bridge, a video manager, and
+    the title sets requested, each with its IFO, VOB and BUP files. The
+    VOBs are made of MPEG program stream packs, with a navigation pack at
+    the start of each VOBU. Optionally the VOBs are scrambled for the CSS
+    stand-in, and a test mode mapfile of unreadable sectors is written for
+    the option '--test-mode' of ddrescue.
+
+    Exit status: 0 for a normal exit, 1 for environmental problems
+    (file not found, invalid flags, I/O errors, etc).
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "arg_parser.h"
+#include "block.h"
+#include "css_standin.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+
+namespace {
+
+const char * const program_name = "dvdgen";
+const char * invocation_name = 0;
+
+enum { sector_size = 2048,
+       vds_sector = 32,			// main volume descriptor sequence
+       rvds_sector = 48,		// reserve volume descriptor sequence
+       lvid_sector = 64,		// logical volume integrity sequence
+       avdp_sector = 256,		// anchor volume descriptor pointer
+       iso_sector = 257,		// path tables and directories
+       max_titles = 99, max_chapters = 99, max_vobs = 9,
+       max_vob_sectors = ( 1 << 19 ) - 1,	// fits in one UDF extent
+       max_vobu_sectors = 256,
+       fe_size = 184 };			// file entry with one short_ad
+
+typedef std::vector< uint8_t > Bytes;
+
+
+void show_help()
+  {
+  std::printf( "Dvdgen creates synthetic DVD-Video images (UDF file system with ISO 9660\n"
+               "bridge, IFO, VOB and BUP files) for testing the option '--dvd' of ddrescue.\n"
+               "\nUsage: %s [options] <image>\n", invocation_name );
+  std::printf( "\nOptions:\n"
+               "  -h, --help                  display this help and exit\n"
+               "  -b, --bad-areas=<n>         number of unreadable areas in the VOBs [0]\n"
+               "  -c, --chapters=<n>          chapters (cells) of each title [4]\n"
+               "  -e, --error-map=<file>      write unreadable sectors as test mode mapfile\n"
+               "  -i, --bad-ifos              make the first sector of every IFO unreadable\n"
+               "  -k, --scramble              scramble the VOBs for the CSS stand-in\n"
+               "  -l, --label=<name>          volume label [DVDGEN]\n"
+               "  -r, --seed=<n>              seed for contents, keys and bad areas [1]\n"
+               "  -s, --title-size=<bytes>    size of the VOBs of each title [16Mi]\n"
+               "  -t, --titles=<n>            number of title sets [2]\n"
+               "  -v, --verbose               show the files created in the image\n"
+               "  -x, --vob-size=<bytes>      maximum size of each VOB file [1073709056]\n"
+               "\nNumbers may be followed by a multiplier: k = 1000, Ki = 1024,\n"
+               "M = 10^6, Mi = 2^20, etc...\n"
+               "With '--scramble', the title keys are written to '<image>.keys'.\n" );
+  }
+
+
+long long getnum( const char * const ptr, const long long min,
+                  const long long max )
+  {
+  char * tail;
+  errno = 0;
+  long long result = strtoll( ptr, &tail, 0 );
+  if( tail == ptr )
+    {
+    show_error( "Bad or missing numerical argument.", 0, true );
+    std::exit( 1 );
+    }
+  if( !errno && tail[0] )
+    {
+    const int factor = ( tail[1] == 'i' ) ? 1024 : 1000;
+    int exponent = 0;
+    switch( tail[0] )
+      {
+      case 'G': exponent = 3; break;
+      case 'M': exponent = 2; break;
+      case 'K': if( factor == 1024 ) exponent = 1; break;
+      case 'k': if( factor == 1000 ) exponent = 1; break;
+      }
+    if( exponent == 0 || ( factor == 1024 && tail[2] ) ||
+        ( factor == 1000 && tail[1] ) )
+      {
+      show_error( "Bad multiplier in numerical argument.", 0, true );
+      std::exit( 1 );
+      }
+    for( int i = 0; i < exponent; ++i )
+      {
+      if( LLONG_MAX / factor >= llabs( result ) ) result *= factor;
+      else { errno = ERANGE; break; }
+      }
+    }
+  if( !errno && ( result < min || result > max ) ) errno = ERANGE;
+  if( errno )
+    {
+    show_error( "Numerical argument out of limits." );
+    std::exit( 1 );
+    }
+  return result;
+  }
+
+
+// Returns a pseudorandom number derived from 'seed' and 'n' (splitmix64).
+//
+uint64_t hash( const uint64_t seed, const uint64_t n )
+  {
+  uint64_t z = seed + ( n + 1 ) * 0x9E3779B97F4A7C15ULL;
+  z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+  z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+  return z ^ ( z >> 31 );
+  }
+
+
+void put_le16( uint8_t * const p, const unsigned v )
+  { p[0] = v; p[1] = v >> 8; }
+
+void put_le32( uint8_t * const p, const unsigned long v )
+  { for( int i = 0; i < 4; ++i ) p[i] = v >> ( 8 * i ); }
+
+void put_le64( uint8_t * const p, const unsigned long long v )
+  { for( int i = 0; i < 8; ++i ) p[i] = v >> ( 8 * i ); }
+
+void put_be16( uint8_t * const p, const unsigned v )
+  { p[0] = v >> 8; p[1] = v; }
+
+void put_be32( uint8_t * const p, const unsigned long v )
+  { for( int i = 0; i < 4; ++i ) p[i] = v >> ( 24 - 8 * i ); }
+
+void put_both16( uint8_t * const p, const unsigned v )
+  { put_le16( p, v ); put_be16( p + 2, v ); }
+
+void put_both32( uint8_t * const p, const unsigned long v )
+  { put_le32( p, v ); put_be32( p + 4, v ); }
+
+void put_text( uint8_t * const p, const int size, const char * const s )
+  {
+  const int len = std::min( (int)std::strlen( s ), size );
+  std::memcpy( p, s, len );
+  std::memset( p + len, ' ', size - len );
+  }
+
+
+// Returns the CRC-ITU-T (CCITT) used by the UDF descriptor tags.
+//
+unsigned crc16( const uint8_t * const p, const int size )
+  {
+  unsigned crc = 0;
+  for( int i = 0; i < size; ++i )
+    {
+    crc ^= p[i] << 8;
+    for( int j = 0; j < 8; ++j )
+      crc = ( ( crc & 0x8000 ) ? ( crc << 1 ) ^ 0x1021 : crc << 1 ) & 0xFFFF;
+    }
+  return crc;
+  }
+
+
+// Writes the tag of the UDF descriptor of 'size' bytes at 'p'.
+// Must be called after filling the rest of the descriptor.
+//
+void put_tag( uint8_t * const p, const int id, const long location,
+              const int size )
+  {
+  put_le16( p, id );
+  put_le16( p + 2, 2 );				// descriptor version
+  put_le16( p + 6, 1 );				// serial number
+  put_le16( p + 8, crc16( p + 16, size - 16 ) );
+  put_le16( p + 10, size - 16 );
+  put_le32( p + 12, location );
+  uint8_t sum = 0;
+  for( int i = 0; i < 16; ++i ) if( i != 4 ) sum += p[i];
+  p[4] = sum;
+  }
+
+
+// dstring of 'size' bytes, compressed to 8 bits per character.
+void put_dstring( uint8_t * const p, const int size, const char * const s )
+  {
+  const int len = std::min( (int)std::strlen( s ), size - 2 );
+  std::memset( p, 0, size );
+  if( len <= 0 ) return;
+  p[0] = 8;
+  std::memcpy( p + 1, s, len );
+  p[size-1] = len + 1;
+  }
+
+void put_charspec( uint8_t * const p )
+  { p[0] = 0; std::memcpy( p + 1, "OSTA Compressed Unicode", 23 ); }
+
+void put_regid( uint8_t * const p, const char * const id,
+                const bool udf_suffix = false )
+  {
+  std::memcpy( p + 1, id, std::strlen( id ) );
+  if( udf_suffix ) put_le16( p + 24, 0x0102 );	// UDF revision
+  }
+
+void put_timestamp( uint8_t * const p )		// 2016-01-01 00:00 UTC
+  { put_le16( p, 0x1000 ); put_le16( p + 2, 2016 ); p[4] = 1; p[5] = 1; }
+
+void put_long_ad( uint8_t * const p, const long lbn )
+  { put_le32( p, sector_size ); put_le32( p + 4, lbn ); }
+
+
+// Writes a File Identifier Descriptor at 'p', in the block 'lbn' of the
+// partition. Returns its size.
+//
+int put_fid( uint8_t * const p, const long lbn, const int characteristics,
+             const char * const name, const long icb_lbn )
+  {
+  const int len_fi = name ? 1 + std::strlen( name ) : 0;
+  const int size = 4 * ( ( 38 + len_fi + 3 ) / 4 );
+  put_le16( p + 16, 1 );			// file version number
+  p[18] = characteristics;
+  p[19] = len_fi;
+  put_long_ad( p + 20, icb_lbn );
+  if( name ) { p[38] = 8; std::memcpy( p + 39, name, len_fi - 1 ); }
+  put_tag( p, 257, lbn, size );
+  return size;
+  }
+
+
+// Writes a File Entry (directory or file) with one short_ad at 'p'.
+//
+void put_file_entry( uint8_t * const p, const long lbn, const bool dir,
+                     const long long size, const long data_lbn,
+                     const long long unique_id )
+  {
+  put_le16( p + 20, 4 );			// ICB strategy type
+  put_le16( p + 24, 1 );			// maximum number of entries
+  p[27] = dir ? 4 : 5;				// file type
+  put_le32( p + 36, 0xFFFFFFFFUL );		// uid
+  put_le32( p + 40, 0xFFFFFFFFUL );		// gid
+  put_le32( p + 44, dir ? 0x14A5 : 0x1084 );	// read (and search) by all
+  put_le16( p + 48, 1 );			// file link count
+  put_le64( p + 56, size );
+  put_le64( p + 64, ( size + sector_size - 1 ) / sector_size );
+  put_timestamp( p + 72 ); put_timestamp( p + 84 ); put_timestamp( p + 96 );
+  put_le32( p + 108, 1 );			// checkpoint
+  put_regid( p + 128, "*DDRESCUE DVDGEN" );
+  put_le64( p + 160, unique_id );
+  put_le32( p + 172, 8 );			// length of allocation descriptors
+  put_le32( p + 176, size );
+  put_le32( p + 180, data_lbn );
+  put_tag( p, 261, lbn, fe_size );
+  }
+
+
+// Writes an ISO 9660 directory record at 'p'. Returns its size.
+//
+int put_dir_record( uint8_t * const p, const char * const name,
+                    const int name_len, const long lba, const long long size,
+                    const bool dir )
+  {
+  const int len = 33 + name_len + ( name_len % 2 == 0 );
+  p[0] = len;
+  put_both32( p + 2, lba );
+  put_both32( p + 10, size );
+  p[18] = 116; p[19] = 1; p[20] = 1;		// 2016-01-01 00:00 UTC
+  p[25] = dir ? 2 : 0;
+  put_both16( p + 28, 1 );			// volume sequence number
+  p[32] = name_len;
+  std::memcpy( p + 33, name, name_len );
+  return len;
+  }
+
+
+// Puts 'size' bytes of 'value' in big endian order at 'pos' of 'ifo',
+// growing it if needed.
+//
+void put_ifo( Bytes & ifo, const long pos, const int size,
+              const unsigned long value )
+  {
+  if( pos + size > (long)ifo.size() ) ifo.resize( pos + size, 0 );
+  for( int i = 0; i < size; ++i )
+    ifo[pos+i] = value >> ( 8 * ( size - 1 - i ) );
+  }
+
+// Pads 'ifo' to a whole number of sectors and returns the number of the
+// next sector, where a new table can start.
+//
+long start_table( Bytes & ifo )
+  {
+  const long sectors = ( ifo.size() + sector_size - 1 ) / sector_size;
+  ifo.resize( sectors * sector_size, 0 );
+  return sectors;
+  }
+
+
+// Playback time of 'sectors' at 4 Mb/s, as BCD hours, minutes, seconds
+// and frames at 25 frames/s.
+//
+unsigned long playback_time( const long long sectors )
+  {
+  const long long frames = sectors * sector_size * 8 * 25 / 4000000;
+  const long long seconds = frames / 25;
+  const int v[4] = { (int)std::min( seconds / 3600, 99LL ),
+                     (int)( seconds / 60 % 60 ), (int)( seconds % 60 ),
+                     (int)( frames % 25 ) };
+  unsigned long t = 0;
+  for( int i = 0; i < 4; ++i ) t = ( t << 8 ) | ( v[i] / 10 << 4 ) | v[i] % 10;
+  return t | 0x40;				// 25 frames/s
+  }
+
+
+struct File			// a file in the directory VIDEO_TS
+  {
+  std::string name;
+  long lba;				// first sector in the image
+  long sectors;
+  int title;				// title set, or 0 for the VMG
+  long vobs_offset;			// first sector in the title VOBs, or -1
+
+  File( const std::string & n, const long s, const int t, const long o )
+    : name( n ), lba( 0 ), sectors( s ), title( t ), vobs_offset( o ) {}
+  bool operator<( const File & f ) const { return name < f.name; }
+  };
+
+
+struct Title_set
+  {
+  Bytes ifo;
+  long first;				// first sector of VTS_nn_0.IFO
+  long vobs;				// first sector of the title VOBs
+  long sectors;				// size of the title VOBs
+  int chapters;
+  int vobu_sectors;			// size of each VOBU but the last
+  long vobus;
+  uint8_t key[css_key_size];
+
+  // The last VOBU takes the remaining sectors, so that no VOBU is
+  // smaller than vobu_sectors.
+  long vobu_of( const long s ) const
+    { return std::min( s / vobu_sectors, vobus - 1 ); }
+  long vobu_start( const long v ) const { return v * vobu_sectors; }
+  long vobu_end( const long v ) const
+    { return ( v + 1 < vobus ) ? ( v + 1 ) * vobu_sectors : sectors; }
+  long cell_first_vobu( const int c ) const
+    { return (long long)c * vobus / chapters; }
+  int cell_of( const long v ) const
+    {
+    int c = (long long)v * chapters / vobus;
+    while( c + 1 < chapters && cell_first_vobu( c + 1 ) <= v ) ++c;
+    while( c > 0 && cell_first_vobu( c ) > v ) --c;
+    return c;
+    }
+  };
+
+
+class Dvd
+  {
+  std::vector< Title_set > sets;
+  std::vector< File > files;		// in physical order
+  Bytes meta;				// sectors before the first file
+  Bytes vmg_ifo;
+  std::string label;
+  uint64_t seed;
+  long part_start, part_length;		// UDF partition
+  long iso_dir_sectors, udf_dir_sectors;
+  bool scramble;
+
+  void build_vts_ifo( Title_set & ts );
+  void build_vmg_ifo();
+  void build_udf();
+  void build_iso();
+  void vob_sector( const Title_set & ts, const long s, uint8_t * const p ) const;
+
+public:
+  Dvd( const int titles, const long title_sectors, const int chapters,
+       const long vob_sectors, const char * const lab, const uint64_t sd,
+       const bool scr );
+
+  long sectors() const { return part_start + part_length + 1; }
+  bool write_image( const char * const name ) const;
+  bool write_keys( const char * const name ) const;
+  bool write_error_map( const char * const name, const int bad_areas,
+                        const bool bad_ifos ) const;
+  void show_files() const;
+  };
+
+
+Dvd::Dvd( const int titles, const long title_sectors, const int chapters,
+          const long vob_sectors, const char * const lab, const uint64_t sd,
+          const bool scr )
+  : label( lab ), seed( sd ), scramble( scr )
+  {
+  sets.resize( titles );
+  files.push_back( File( "VIDEO_TS.IFO", 0, 0, -1 ) );
+  files.push_back( File( "VIDEO_TS.BUP", 0, 0, -1 ) );
+  for( int t = 0; t < titles; ++t )
+    {
+    Title_set & ts = sets[t];
+    ts.sectors = title_sectors;
+    ts.chapters = chapters;
+    ts.vobu_sectors = std::min( title_sectors / chapters, (long)max_vobu_sectors );
+    ts.vobus = title_sectors / ts.vobu_sectors;
+    for( int i = 0; i < css_key_size; ++i )
+      ts.key[i] = hash( seed, 1000 + 8 * t + i );
+    build_vts_ifo( ts );
+    char name[32];
+    const long ifo_sectors = ts.ifo.size() / sector_size;
+    snprintf( name, sizeof name, "VTS_%02d_0.IFO", t + 1 );
+    files.push_back( File( name, ifo_sectors, t + 1, -1 ) );
+    for( int i = 0; i * vob_sectors < title_sectors; ++i )
+      {
+      snprintf( name, sizeof name, "VTS_%02d_%d.VOB", t + 1, i + 1 );
+      files.push_back( File( name, std::min( vob_sectors,
+                       title_sectors - i * vob_sectors ), t + 1, i * vob_sectors ) );
+      }
+    snprintf( name, sizeof name, "VTS_%02d_0.BUP", t + 1 );
+    files.push_back( File( name, ifo_sectors, t + 1, -1 ) );
+    }
+  build_vmg_ifo();				// only to know its size
+  files[0].sectors = files[1].sectors = vmg_ifo.size() / sector_size;
+
+  // ISO 9660 directory records don't cross sector boundaries
+  long pos = 34 + 34;				// '.' and '..'
+  iso_dir_sectors = 1;
+  for( unsigned i = 0; i < files.size(); ++i )
+    {
+    const int len = 33 + files[i].name.size() + 2 + 1;	// ";1" and pad
+    if( pos + len > sector_size ) { ++iso_dir_sectors; pos = 0; }
+    pos += len;
+    }
+  udf_dir_sectors = ( 40 + files.size() * 52 + sector_size - 1 ) / sector_size;
+  part_start = iso_sector + 4 + iso_dir_sectors;
+  long lba = part_start + 7 + udf_dir_sectors + files.size();
+  for( unsigned i = 0; i < files.size(); ++i )
+    {
+    File & f = files[i];
+    f.lba = lba; lba += f.sectors;
+    if( f.title > 0 && f.name[7] == '0' && f.name[9] == 'I' )
+      sets[f.title-1].first = f.lba;
+    if( f.vobs_offset == 0 ) sets[f.title-1].vobs = f.lba;
+    }
+  part_length = lba - part_start;
+  build_vmg_ifo();
+  meta.assign( ( part_start + 7 + udf_dir_sectors + files.size() ) *
+               sector_size, 0 );
+  build_iso();
+  build_udf();
+  }
+
+
+void Dvd::build_vts_ifo( Title_set & ts )
+  {
+  Bytes & f = ts.ifo;
+  const int cells = ts.chapters;
+  f.assign( sector_size, 0 );
+  std::memcpy( &f[0], "DVDVIDEO-VTS", 12 );
+  put_ifo( f, 0x21, 1, 0x11 );			// specification version
+  put_ifo( f, 0x80, 4, 0x3FF );			// last byte of VTSI_MAT
+
+  long base = start_table( f ) * sector_size;	// VTS_PTT_SRPT
+  put_ifo( f, 0xC8, 4, base / sector_size );
+  put_ifo( f, base, 2, 1 );			// titles
+  put_ifo( f, base + 4, 4, 12 + 4 * ts.chapters - 1 );
+  put_ifo( f, base + 8, 4, 12 );
+  for( int c = 0; c < ts.chapters; ++c )
+    { put_ifo( f, base + 12 + 4 * c, 2, 1 );	// program chain
+      put_ifo( f, base + 14 + 4 * c, 2, c + 1 ); }	// program
+
+  base = start_table( f ) * sector_size;	// VTS_PGCIT
+  put_ifo( f, 0xCC, 4, base / sector_size );
+  const long pgc = base + 16;
+  const int map_offset = 0xEC;
+  const int playback_offset = ( map_offset + ts.chapters + 1 ) & ~1;
+  const int position_offset = playback_offset + 24 * cells;
+  put_ifo( f, base, 2, 1 );			// program chains
+  put_ifo( f, base + 4, 4, 16 + position_offset + 4 * cells - 1 );
+  put_ifo( f, base + 8, 1, 0x81 );		// entry PGC of title 1
+  put_ifo( f, base + 12, 4, 16 );
+  put_ifo( f, pgc + 2, 1, ts.chapters );
+  put_ifo( f, pgc + 3, 1, cells );
+  put_ifo( f, pgc + 4, 4, playback_time( ts.sectors ) );
+  put_ifo( f, pgc + 0xE6, 2, map_offset );
+  put_ifo( f, pgc + 0xE8, 2, playback_offset );
+  put_ifo( f, pgc + 0xEA, 2, position_offset );
+  for( int c = 0; c < cells; ++c )
+    {
+    const long v0 = ts.cell_first_vobu( c );
+    const long v1 = ( c + 1 < cells ) ? ts.cell_first_vobu( c + 1 ) : ts.vobus;
+    const long first = ts.vobu_start( v0 ), last = ts.vobu_end( v1 - 1 ) - 1;
+    const long cp = pgc + playback_offset + 24 * c;
+    put_ifo( f, pgc + map_offset + c, 1, c + 1 );	// entry cell
+    put_ifo( f, cp + 4, 4, playback_time( last + 1 - first ) );
+    put_ifo( f, cp + 8, 4, first );
+    put_ifo( f, cp + 16, 4, ts.vobu_start( v1 - 1 ) );
+    put_ifo( f, cp + 20, 4, last );
+    put_ifo( f, pgc + position_offset + 4 * c, 2, 1 );	// VOB id
+    put_ifo( f, pgc + position_offset + 4 * c + 3, 1, c + 1 );
+    }
+
+  base = start_table( f ) * sector_size;	// VTS_C_ADT
+  put_ifo( f, 0xE0, 4, base / sector_size );
+  put_ifo( f, base, 2, 1 );			// VOBs
+  put_ifo( f, base + 4, 4, 8 + 12 * cells - 1 );
+  for( int c = 0; c < cells; ++c )
+    {
+    const long v1 = ( c + 1 < cells ) ? ts.cell_first_vobu( c + 1 ) : ts.vobus;
+    const long entry = base + 8 + 12 * c;
+    put_ifo( f, entry, 2, 1 );
+    put_ifo( f, entry + 2, 1, c + 1 );
+    put_ifo( f, entry + 4, 4, ts.vobu_start( ts.cell_first_vobu( c ) ) );
+    put_ifo( f, entry + 8, 4, ts.vobu_end( v1 - 1 ) - 1 );
+    }
+
+  base = start_table( f ) * sector_size;	// VTS_VOBU_ADMAP
+  put_ifo( f, 0xE4, 4, base / sector_size );
+  put_ifo( f, base, 4, 4 + 4 * ts.vobus - 1 );
+  for( long v = 0; v < ts.vobus; ++v )
+    put_ifo( f, base + 4 + 4 * v, 4, ts.vobu_start( v ) );
+
+  const long sectors = start_table( f );
+  put_ifo( f, 0x0C, 4, 2 * sectors + ts.sectors - 1 );	// last sector of VTS
+  put_ifo( f, 0x1C, 4, sectors - 1 );			// last sector of IFO
+  put_ifo( f, 0xC4, 4, sectors );			// title VOBs
+  }
+
+
+void Dvd::build_vmg_ifo()
+  {
+  Bytes & f = vmg_ifo;
+  const int titles = sets.size();
+  const int atrt_size = 0x308;			// attributes of each VTS
+  f.assign( sector_size, 0 );
+  std::memcpy( &f[0], "DVDVIDEO-VMG", 12 );
+  put_ifo( f, 0x21, 1, 0x11 );			// specification version
+  put_ifo( f, 0x26, 2, 1 );			// volumes
+  put_ifo( f, 0x28, 2, 1 );			// this volume
+  put_ifo( f, 0x2A, 1, 1 );			// disc side
+  put_ifo( f, 0x3E, 2, titles );		// title sets
+  std::memcpy( &f[0x40], "GNU ddrescue dvdgen", 19 );	// provider
+  put_ifo( f, 0x80, 4, 0x3FF );			// last byte of VMGI_MAT
+
+  long base = start_table( f ) * sector_size;	// TT_SRPT
+  put_ifo( f, 0xC4, 4, base / sector_size );
+  put_ifo( f, base, 2, titles );
+  put_ifo( f, base + 4, 4, 8 + 12 * titles - 1 );
+  for( int t = 0; t < titles; ++t )
+    {
+    const long entry = base + 8 + 12 * t;
+    put_ifo( f, entry + 1, 1, 1 );		// angles
+    put_ifo( f, entry + 2, 2, sets[t].chapters );
+    put_ifo( f, entry + 6, 1, t + 1 );		// title set
+    put_ifo( f, entry + 7, 1, 1 );		// title in title set
+    put_ifo( f, entry + 8, 4, sets[t].first );
+    }
+
+  base = start_table( f ) * sector_size;	// VTS_ATRT
+  put_ifo( f, 0xD0, 4, base / sector_size );
+  put_ifo( f, base, 2, titles );
+  put_ifo( f, base + 4, 4, 8 + ( 4 + atrt_size ) * titles - 1 );
+  for( int t = 0; t < titles; ++t )
+    {
+    const long offset = 8 + 4 * titles + atrt_size * t;
+    put_ifo( f, base + 8 + 4 * t, 4, offset );
+    put_ifo( f, base + offset, 4, atrt_size - 1 );
+    }
+  put_ifo( f, base + 8 + ( 4 + atrt_size ) * titles - 1, 1, 0 );
+
+  const long sectors = start_table( f );
+  put_ifo( f, 0x0C, 4, 2 * sectors - 1 );	// last sector of VMG
+  put_ifo( f, 0x1C, 4, sectors - 1 );		// last sector of IFO
+  }
+
+
+void Dvd::build_iso()
+  {
+  uint8_t * p = &meta[16*sector_size];		// primary volume descriptor
+  p[0] = 1; std::memcpy( p + 1, "CD001", 5 ); p[6] = 1;
+  put_text( p + 8, 32, "" );
+  put_text( p + 40, 32, label.c_str() );
+  put_both32( p + 80, sectors() );
+  put_both16( p + 120, 1 );			// volume set size
+  put_both16( p + 124, 1 );			// volume sequence number
+  put_both16( p + 128, sector_size );
+  put_both32( p + 132, 42 );			// path table size
+  put_le32( p + 140, iso_sector );
+  put_be32( p + 148, iso_sector + 1 );
+  put_dir_record( p + 156, "", 1, iso_sector + 2, sector_size, true );
+  put_text( p + 190, 128 * 3, "" );
+  put_text( p + 574, 128, "GNU DDRESCUE DVDGEN" );
+  put_text( p + 702, 37 * 3, "" );
+  for( int i = 0; i < 4; ++i )			// dates
+    std::memcpy( p + 813 + 17 * i, ( i < 2 ) ? "2016010100000000" :
+                 "0000000000000000", 16 );
+  p[881] = 1;					// file structure version
+  p = &meta[17*sector_size];			// set terminator
+  p[0] = 255; std::memcpy( p + 1, "CD001", 5 ); p[6] = 1;
+
+  const char * const vrs[3] = { "BEA01", "NSR02", "TEA01" };
+  for( int i = 0; i < 3; ++i )			// UDF volume recognition
+    { p = &meta[(18+i)*sector_size];
+      std::memcpy( p + 1, vrs[i], 5 ); p[6] = 1; }
+
+  const long root = iso_sector + 2, audio = root + 1, video = root + 2;
+  for( int m = 0; m < 2; ++m )			// path tables L and M
+    {
+    p = &meta[(iso_sector+m)*sector_size];
+    const long dirs[3] = { root, audio, video };
+    const char * const names[3] = { "", "AUDIO_TS", "VIDEO_TS" };
+    for( int i = 0; i < 3; ++i )
+      {
+      const int len = i ? 8 : 1;
+      p[0] = len;
+      if( m == 0 ) { put_le32( p + 2, dirs[i] ); put_le16( p + 6, 1 ); }
+      else { put_be32( p + 2, dirs[i] ); put_be16( p + 6, 1 ); }
+      std::memcpy( p + 8, names[i], i ? len : 0 );
+      p += 8 + len + ( len % 2 );
+      }
+    }
+  p = &meta[root*sector_size];
+  p += put_dir_record( p, "", 1, root, sector_size, true );
+  p += put_dir_record( p, "\1", 1, root, sector_size, true );
+  p += put_dir_record( p, "AUDIO_TS", 8, audio, sector_size, true );
+  put_dir_record( p, "VIDEO_TS", 8, video, iso_dir_sectors * sector_size, true );
+  p = &meta[audio*sector_size];
+  p += put_dir_record( p, "", 1, audio, sector_size, true );
+  put_dir_record( p, "\1", 1, root, sector_size, true );
+
+  std::vector< File > sorted( files );
+  std::sort( sorted.begin(), sorted.end() );
+  uint8_t * const dir = &meta[video*sector_size];
+  long pos = put_dir_record( dir, "", 1, video, iso_dir_sectors * sector_size, true );
+  pos += put_dir_record( dir + pos, "\1", 1, root, sector_size, true );
+  for( unsigned i = 0; i < sorted.size(); ++i )
+    {
+    const std::string name = sorted[i].name + ";1";
+    if( pos % sector_size + 33 + (long)name.size() + 1 > sector_size )
+      pos += sector_size - pos % sector_size;
+    pos += put_dir_record( dir + pos, name.c_str(), name.size(), sorted[i].lba,
+                           (long long)sorted[i].sectors * sector_size, false );
+    }
+  }
+
+
+// Partition blocks: 0 file set descriptor, 1 terminating descriptor,
+// 2 and 3 root directory, 4 and 5 AUDIO_TS, 6 and following VIDEO_TS,
+// then the file entries of the files in VIDEO_TS.
+//
+void Dvd::build_udf()
+  {
+  for( int seq = 0; seq < 2; ++seq )		// main and reserve VDS
+    {
+    const long first = seq ? rvds_sector : vds_sector;
+    uint8_t * p = &meta[first*sector_size];	// primary volume descriptor
+    put_dstring( p + 24, 32, label.c_str() );
+    put_le16( p + 56, 1 ); put_le16( p + 58, 1 );	// volume sequence
+    put_le16( p + 60, 2 ); put_le16( p + 62, 2 );	// interchange level
+    put_le32( p + 64, 1 ); put_le32( p + 68, 1 );	// character sets
+    char volset[32];
+    snprintf( volset, sizeof volset, "%016llX%s",
+              (unsigned long long)hash( seed, 0 ), label.c_str() );
+    put_dstring( p + 72, 128, volset );
+    put_charspec( p + 200 ); put_charspec( p + 264 );
+    put_timestamp( p + 376 );
+    put_regid( p + 388, "*DDRESCUE DVDGEN" );
+    put_tag( p, 1, first, 512 );
+
+    p += sector_size;				// implementation use VD
+    put_le32( p + 16, 1 );
+    put_regid( p + 20, "*UDF LV Info", true );
+    put_charspec( p + 52 );
+    put_dstring( p + 116, 128, label.c_str() );
+    put_regid( p + 352, "*DDRESCUE DVDGEN" );
+    put_tag( p, 4, first + 1, 512 );
+
+    p += sector_size;				// partition descriptor
+    put_le32( p + 16, 2 );
+    put_le16( p + 20, 1 );			// allocated
+    put_regid( p + 24, "+NSR02" );
+    put_le32( p + 184, 1 );			// read only
+    put_le32( p + 188, part_start );
+    put_le32( p + 192, part_length );
+    put_regid( p + 196, "*DDRESCUE DVDGEN" );
+    put_tag( p, 5, first + 2, 512 );
+
+    p += sector_size;				// logical volume descriptor
+    put_le32( p + 16, 3 );
+    put_charspec( p + 20 );
+    put_dstring( p + 84, 128, label.c_str() );
+    put_le32( p + 212, sector_size );
+    put_regid( p + 216, "*OSTA UDF Compliant", true );
+    put_long_ad( p + 248, 0 );			// file set descriptor
+    put_le32( p + 264, 6 );			// map table length
+    put_le32( p + 268, 1 );			// partition maps
+    put_regid( p + 272, "*DDRESCUE DVDGEN" );
+    put_le32( p + 432, 2 * sector_size );	// integrity sequence
+    put_le32( p + 436, lvid_sector );
+    p[440] = 1; p[441] = 6; put_le16( p + 442, 1 );	// type 1 map
+    put_tag( p, 6, first + 3, 446 );
+
+    p += sector_size;				// unallocated space descriptor
+    put_le32( p + 16, 4 );
+    put_tag( p, 7, first + 4, 24 );
+
+    p += sector_size;				// terminating descriptor
+    put_tag( p, 8, first + 5, 512 );
+    }
+
+  uint8_t * p = &meta[lvid_sector*sector_size];	// logical volume integrity
+  put_timestamp( p + 16 );
+  put_le32( p + 28, 1 );			// close integrity
+  put_le64( p + 40, 16 + files.size() );	// next unique id
+  put_le32( p + 72, 1 );			// partitions
+  put_le32( p + 76, 46 );			// length of implementation use
+  put_le32( p + 84, part_length );		// size table
+  put_regid( p + 88, "*DDRESCUE DVDGEN" );
+  put_le32( p + 120, files.size() );
+  put_le32( p + 124, 3 );			// directories
+  put_le16( p + 128, 0x0102 ); put_le16( p + 130, 0x0102 );
+  put_le16( p + 132, 0x0102 );
+  put_tag( p, 9, lvid_sector, 134 );
+  p += sector_size;
+  put_tag( p, 8, lvid_sector + 1, 512 );
+
+  p = &meta[avdp_sector*sector_size];
+  put_le32( p + 16, 16 * sector_size ); put_le32( p + 20, vds_sector );
+  put_le32( p + 24, 16 * sector_size ); put_le32( p + 28, rvds_sector );
+  put_tag( p, 2, avdp_sector, 512 );
+
+  uint8_t * const part = &meta[part_start*sector_size];
+  p = part;					// file set descriptor
+  put_timestamp( p + 16 );
+  put_le16( p + 28, 3 ); put_le16( p + 30, 3 );	// interchange level
+  put_le32( p + 32, 1 ); put_le32( p + 36, 1 );	// character sets
+  put_charspec( p + 48 );
+  put_dstring( p + 112, 128, label.c_str() );
+  put_charspec( p + 240 );
+  put_dstring( p + 304, 32, label.c_str() );
+  put_long_ad( p + 400, 2 );			// root directory
+  put_regid( p + 416, "*OSTA UDF Compliant", true );
+  put_tag( p, 256, 0, 512 );
+  put_tag( part + sector_size, 8, 1, 512 );
+
+  std::vector< File > sorted( files );
+  std::sort( sorted.begin(), sorted.end() );
+  const long fe_lbn = 7 + udf_dir_sectors;	// first file entry
+  p = part + 3 * sector_size;
+  int size = put_fid( p, 3, 0x0A, 0, 2 );	// parent
+  size += put_fid( p + size, 3, 0x02, "AUDIO_TS", 4 );
+  size += put_fid( p + size, 3, 0x02, "VIDEO_TS", 6 );
+  put_file_entry( part + 2 * sector_size, 2, true, size, 3, 0 );
+  size = put_fid( part + 5 * sector_size, 5, 0x0A, 0, 2 );
+  put_file_entry( part + 4 * sector_size, 4, true, size, 5, 16 );
+  long pos = put_fid( part + 7 * sector_size, 7, 0x0A, 0, 2 );
+  for( unsigned i = 0; i < sorted.size(); ++i )
+    {
+    unsigned j = 0;
+    while( files[j].name != sorted[i].name ) ++j;
+    pos += put_fid( part + 7 * sector_size + pos, 7 + pos / sector_size, 0,
+                    sorted[i].name.c_str(), fe_lbn + j );
+    }
+  put_file_entry( part + 6 * sector_size, 6, true, pos, 7, 17 );
+  for( unsigned j = 0; j < files.size(); ++j )
+    put_file_entry( part + ( fe_lbn + j ) * sector_size, fe_lbn + j, false,
+                    (long long)files[j].sectors * sector_size,
+                    files[j].lba - part_start, 18 + j );
+  }
+
+
+// Writes the pack 's' of the title VOBs of 'ts' at 'p'. The first pack
+// of each VOBU is a navigation pack, the rest are video packs.
+//
+void Dvd::vob_sector( const Title_set & ts, const long s, uint8_t * const p ) const
+  {
+  const long v = ts.vobu_of( s );
+  const unsigned long long scr = (unsigned long long)s * sector_size * 90000 / 1260000;
+  const bool nav = ( s == ts.vobu_start( v ) );
+
+  if( nav ) std::memset( p, 0, sector_size );
+  else					// random payload
+    {
+    uint64_t x = hash( seed, ( (uint64_t)( &ts - &sets[0] ) << 40 ) + s );
+    for( int i = 16; i < sector_size; i += 8 )
+      {
+      x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+      for( int j = 0; j < 8; ++j ) p[i+j] = x >> ( 8 * j );
+      }
+    }
+  p[0] = 0; p[1] = 0; p[2] = 1; p[3] = 0xBA;	// pack header
+  p[4] = 0x44 | ( ( scr >> 27 ) & 0x38 ) | ( ( scr >> 28 ) & 3 );
+  p[5] = scr >> 20;
+  p[6] = 0x04 | ( ( scr >> 12 ) & 0xF8 ) | ( ( scr >> 13 ) & 3 );
+  p[7] = scr >> 5;
+  p[8] = 0x04 | ( ( scr << 3 ) & 0xF8 );
+  p[9] = 0x01;
+  p[10] = 0x01; p[11] = 0x89; p[12] = 0xC3;	// 10.08 Mb/s
+  p[13] = 0xF8;
+  if( !nav )
+    {
+    p[14] = 0; p[15] = 0; p[16] = 1; p[17] = 0xE0;	// video stream
+    put_be16( p + 18, sector_size - 20 );
+    p[20] = 0x81; p[21] = 0; p[22] = 0;
+    if( scramble ) css_scramble( p, ts.key );
+    return;
+    }
+  static const uint8_t system_header[24] =
+    { 0x00, 0x00, 0x01, 0xBB, 0x00, 0x12, 0x80, 0xC4, 0xE1, 0x04, 0xE1, 0xFF,
+      0xB9, 0xE0, 0xE8, 0xB8, 0xC0, 0x20, 0xBD, 0xE0, 0x3A, 0xBF, 0xE0, 0x02 };
+  std::memcpy( p + 14, system_header, sizeof system_header );
+  const long vs = ts.vobu_start( v ), ve = ts.vobu_end( v );
+  const unsigned long ptm = vs * 1024 / 10000 * 3600;	// 90 kHz
+  uint8_t * const pci = p + 38;
+  pci[2] = 1; pci[3] = 0xBF; put_be16( pci + 4, 0x3D4 ); pci[6] = 0;
+  put_be32( pci + 7, s );			// nv_pck_lbn
+  put_be32( pci + 7 + 12, ptm );		// vobu_s_ptm
+  put_be32( pci + 7 + 16, ( ve - 1 ) * 1024 / 10000 * 3600 + 3600 );
+  uint8_t * const dsi = p + 1024;
+  dsi[2] = 1; dsi[3] = 0xBF; put_be16( dsi + 4, 0x3FA ); dsi[6] = 1;
+  put_be32( dsi + 7, scr );			// nv_pck_scr
+  put_be32( dsi + 11, s );			// nv_pck_lbn
+  put_be32( dsi + 15, ve - 1 - vs );		// vobu_ea
+  put_be16( dsi + 31, 1 );			// vobu_vob_idn
+  dsi[34] = ts.cell_of( v ) + 1;		// vobu_c_idn
+  }
+
+
+bool write_all( const int fd, const uint8_t * const buf, const long size )
+  {
+  long sz = 0;
+  while( sz < size )
+    {
+    const long n = write( fd, buf + sz, size - sz );
+    if( n > 0 ) sz += n;
+    else if( n < 0 && errno != EINTR ) return false;
+    }
+  return true;
+  }
+
+
+bool Dvd::write_image( const char * const name ) const
+  {
+  const int fd = open( name, O_CREAT | O_WRONLY | O_TRUNC | O_BINARY,
+                       S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH );
+  if( fd < 0 ) { show_error( "Can't open image file", errno ); return false; }
+  bool ok = write_all( fd, &meta[0], meta.size() );
+  const int chunk_sectors = 64;
+  Bytes buf( chunk_sectors * sector_size );
+  for( unsigned i = 0; ok && i < files.size(); ++i )
+    {
+    const File & f = files[i];
+    const Bytes & ifo = f.title ? sets[f.title-1].ifo : vmg_ifo;
+    for( long s = 0; ok && s < f.sectors; )
+      {
+      const int n = std::min( (long)chunk_sectors, f.sectors - s );
+      if( f.vobs_offset < 0 )
+        std::memcpy( &buf[0], &ifo[s*sector_size], n * sector_size );
+      else for( int j = 0; j < n; ++j )
+        vob_sector( sets[f.title-1], f.vobs_offset + s + j,
+                    &buf[j*sector_size] );
+      ok = write_all( fd, &buf[0], n * sector_size );
+      s += n;
+      }
+    }
+  if( ok )					// last anchor point
+    {
+    std::memcpy( &buf[0], &meta[avdp_sector*sector_size], sector_size );
+    put_tag( &buf[0], 2, sectors() - 1, 512 );
+    ok = write_all( fd, &buf[0], sector_size );
+    }
+  if( !ok ) show_error( "Write error", errno );
+  if( close( fd ) != 0 && ok )
+    { show_error( "Error closing image file", errno ); ok = false; }
+  return ok;
+  }
+
+
+bool Dvd::write_keys( const char * const name ) const
+  {
+  const std::string keysname = std::string( name ) + css_keys_suffix;
+  if( !scramble ) { std::remove( keysname.c_str() ); return true; }
+  FILE * const f = std::fopen( keysname.c_str(), "w" );
+  if( !f ) { show_error( "Can't open keys file", errno ); return false; }
+  write_file_header( f, "Title keys for the CSS stand-in" );
+  std::fprintf( f, "# first_sector  last_sector  key\n" );
+  for( unsigned t = 0; t < sets.size(); ++t )
+    {
+    const Title_set & ts = sets[t];
+    std::fprintf( f, "0x%08lX  0x%08lX  ", ts.vobs, ts.vobs + ts.sectors - 1 );
+    for( int i = 0; i < css_key_size; ++i ) std::fprintf( f, "%02X", ts.key[i] );
+    std::fputc( '\n', f );
+    }
+  if( std::fclose( f ) != 0 )
+    { show_error( "Error writing keys file", errno ); return false; }
+  return true;
+  }
+
+
+bool Dvd::write_error_map( const char * const name, const int bad_areas,
+                           const bool bad_ifos ) const
+  {
+  Mapfile mapfile( name );
+  const Domain domain( 0, -1 );
+  mapfile.set_to_status( Sblock::finished );
+  mapfile.truncate_vector( (long long)sectors() * sector_size, true );
+  mapfile.current_status( Mapfile::finished );
+  if( bad_ifos )
+    for( unsigned i = 0; i < files.size(); ++i )
+      if( files[i].name.compare( 9, 3, "IFO" ) == 0 )
+        mapfile.change_chunk_status( Block( (long long)files[i].lba * sector_size,
+                                     sector_size ), Sblock::bad_sector, domain );
+  for( int i = 0; i < bad_areas; ++i )
+    {
+    const Title_set & ts = sets[hash( seed, 2000 + 3 * i ) % sets.size()];
+    const long s = hash( seed, 2001 + 3 * i ) % ts.sectors;
+    const long size = std::min( 1 + (long)( hash( seed, 2002 + 3 * i ) % 16 ),
+                                ts.sectors - s );
+    mapfile.change_chunk_status( Block( (long long)( ts.vobs + s ) * sector_size,
+                                 size * sector_size ), Sblock::bad_sector, domain );
+    }
+  if( !mapfile.write_mapfile() )
+    { show_error( "Can't write mapfile", errno ); return false; }
+  return true;
+  }
+
+
+void Dvd::show_files() const
+  {
+  std::printf( "%-14s %12s %10s\n", "file", "first_sector", "sectors" );
+  for( unsigned i = 0; i < files.size(); ++i )
+    std::printf( "%-14s   0x%08lX %10ld\n", files[i].name.c_str(),
+                 files[i].lba, files[i].sectors );
+  std::printf( "Image size: %ld sectors (%lld bytes)\n", sectors(),
+               (long long)sectors() * sector_size );
+  }
+
+} // end namespace
+
+
+#include "error_common.cc"
+
+
+// Required by mapfile.cc
+//
+bool write_file_header( FILE * const f, const char * const filetype )
+  { return ( std::fprintf( f, "# %s. Created by %s\n",
+                           filetype, program_name ) >= 0 ); }
+
+
+bool write_timestamp( FILE * const ) { return true; }
+
+
+int main( const int argc, const char * const argv[] )
+  {
+  const char * imagename = 0;
+  const char * mapname = 0;
+  const char * label = "DVDGEN";
+  long long title_size = 16 << 20;
+  long long vob_size = 1073709056;
+  long long seed = 1;
+  int bad_areas = 0;
+  int chapters = 4;
+  int titles = 2;
+  bool bad_ifos = false;
+  bool scramble = false;
+  bool verbose = false;
+  invocation_name = argv[0];
+
+  const Arg_parser::Option options[] =
+    {
+    { 'b', "bad-areas",  Arg_parser::yes },
+    { 'c', "chapters",   Arg_parser::yes },
+    { 'e', "error-map",  Arg_parser::yes },
+    { 'h', "help",       Arg_parser::no  },
+    { 'i', "bad-ifos",   Arg_parser::no  },
+    { 'k', "scramble",   Arg_parser::no  },
+    { 'l', "label",      Arg_parser::yes },
+    { 'r', "seed",       Arg_parser::yes },
+    { 's', "title-size", Arg_parser::yes },
+    { 't', "titles",     Arg_parser::yes },
+    { 'v', "verbose",    Arg_parser::no  },
+    { 'x', "vob-size",   Arg_parser::yes },
+    {  0 , 0,            Arg_parser::no  } };
+
+  const Arg_parser parser( argc, argv, options );
+  if( parser.error().size() )				// bad option
+    { show_error( parser.error().c_str(), 0, true ); return 1; }
+
+  int argind = 0;
+  for( ; argind < parser.arguments(); ++argind )
+    {
+    const int code = parser.code( argind );
+    if( !code ) break;					// no more options
+    const std::string & sarg = parser.argument( argind );
+    const char * const arg = sarg.c_str();
+    switch( code )
+      {
+      case 'b': bad_areas = getnum( arg, 0, INT_MAX ); break;
+      case 'c': chapters = getnum( arg, 1, max_chapters ); break;
+      case 'e': mapname = arg; break;
+      case 'h': show_help(); return 0;
+      case 'i': bad_ifos = true; break;
+      case 'k': scramble = true; break;
+      case 'l': label = arg; break;
+      case 'r': seed = getnum( arg, 0, LLONG_MAX ); break;
+      case 's': title_size = getnum( arg, 1, LLONG_MAX ); break;
+      case 't': titles = getnum( arg, 1, max_titles ); break;
+      case 'v': verbose = true; break;
+      case 'x': vob_size = getnum( arg, sector_size,
+                                   (long long)max_vob_sectors * sector_size );
+                break;
+      default : internal_error( "uncaught option." );
+      }
+    } // end process options
+
+  if( argind + 1 != parser.arguments() )
+    {
+    if( argind < parser.arguments() )
+      show_error( "Too many files.", 0, true );
+    else show_error( "An image file must be specified.", 0, true );
+    return 1;
+    }
+  imagename = parser.argument( argind ).c_str();
+  if( ( bad_areas > 0 || bad_ifos ) && !mapname )
+    { show_error( "Unreadable sectors require option '--error-map'.", 0, true );
+      return 1; }
+  if( std::strlen( label ) > 30 )
+    { show_error( "Volume label is longer than 30 characters.", 0, true );
+      return 1; }
+  const long title_sectors = ( title_size + sector_size - 1 ) / sector_size;
+  const long vob_sectors = vob_size / sector_size;
+  if( title_sectors / chapters < 2 )
+    { show_error( "Title size is too small for the number of chapters.", 0, true );
+      return 1; }
+  if( title_sectors > (long long)max_vobs * vob_sectors )
+    { show_error( "Title size is larger than 9 VOB files.", 0, true );
+      return 1; }
+
+  const Dvd dvd( titles, title_sectors, chapters, vob_sectors, label, seed,
+                 scramble );
+  if( !dvd.write_image( imagename ) || !dvd.write_keys( imagename ) ||
+      ( mapname && !dvd.write_error_map( mapname, bad_areas, bad_ifos ) ) )
+    return 1;
+  if( verbose ) dvd.show_files();
+  return 0;
+  }
@@ -0,0 +1,48 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2004-2016 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Error reporting shared by all the programs of the package.
+// The program including this file defines 'program_name' and
+// 'invocation_name'.
+
+int verbosity = 0;
+
+
+void show_error( const char * const msg, const int errcode, const bool help )
+  {
+  if( verbosity >= 0 )
+    {
+    if( msg && msg[0] )
+      {
+      std::fprintf( stderr, "%s: %s", program_name, msg );
+      if( errcode > 0 )
+        std::fprintf( stderr, ": %s", std::strerror( errcode ) );
+      std::fputc( '\n', stderr );
+      }
+    if( help )
+      std::fprintf( stderr, "Try '%s --help' for more information.\n",
+                    invocation_name );
+    }
+  }
+
+
+void internal_error( const char * const msg )
+  {
+  if( verbosity >= 0 )
+    std::fprintf( stderr, "%s: internal error: %s\n", program_name, msg );
+  std::exit( 3 );
+  }
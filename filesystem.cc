@@ -0,0 +1,1082 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2004-2016 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "block.h"
+#include "mapbook.h"
+#include "filesystem.h"
+
+
+namespace {
+
+typedef std::vector< uint8_t > Bytes;
+
+unsigned le16( const uint8_t * const p ) { return p[0] | ( p[1] << 8 ); }
+
+unsigned long le32( const uint8_t * const p )
+  { return le16( p ) | ( (unsigned long)le16( p + 2 ) << 16 ); }
+
+unsigned long long le64( const uint8_t * const p )
+  { return le32( p ) | ( (unsigned long long)le32( p + 4 ) << 32 ); }
+
+bool power_of_2( const long n ) { return n > 0 && ( n & ( n - 1 ) ) == 0; }
+
+
+void put_utf8( std::string & s, const unsigned long c )
+  {
+  if( c < 0x80 ) { s += c; return; }
+  if( c < 0x800 ) s += 0xC0 | ( c >> 6 );
+  else
+    {
+    if( c < 0x10000 ) s += 0xE0 | ( c >> 12 );
+    else { s += 0xF0 | ( c >> 18 ); s += 0x80 | ( ( c >> 12 ) & 0x3F ); }
+    s += 0x80 | ( ( c >> 6 ) & 0x3F );
+    }
+  s += 0x80 | ( c & 0x3F );
+  }
+
+
+// Converts up to 'n' UTF-16LE code units at 'p' to UTF-8, stopping at
+// the first null.
+//
+std::string utf16_to_utf8( const uint8_t * const p, const int n )
+  {
+  std::string s;
+  for( int i = 0; i < n; ++i )
+    {
+    unsigned long c = le16( p + 2 * i );
+    if( c == 0 ) break;
+    if( c >= 0xD800 && c < 0xDC00 && i + 1 < n )
+      {
+      const unsigned c2 = le16( p + 2 * i + 2 );
+      if( c2 >= 0xDC00 && c2 < 0xE000 )
+        { c = 0x10000 + ( ( c - 0xD800 ) << 10 ) + ( c2 - 0xDC00 ); ++i; }
+      }
+    put_utf8( s, c );
+    }
+  return s;
+  }
+
+
+// Compares names ignoring the case of ASCII letters, as FAT and NTFS do.
+//
+bool same_name_nocase( const std::string & a, const std::string & b )
+  {
+  if( a.size() != b.size() ) return false;
+  for( unsigned i = 0; i < a.size(); ++i )
+    {
+    unsigned char c1 = a[i], c2 = b[i];
+    if( c1 >= 'A' && c1 <= 'Z' ) c1 += 'a' - 'A';
+    if( c2 >= 'A' && c2 <= 'Z' ) c2 += 'a' - 'A';
+    if( c1 != c2 ) return false;
+    }
+  return true;
+  }
+
+
+struct Entry				// file or directory
+  {
+  enum Type { unknown, file, directory };
+  std::string name;
+  long long id;			// first cluster, inode or MFT record number
+  long long size;		// size of data in bytes, or -1 if unknown
+  Type type;
+
+  Entry( const std::string & n, const long long i, const long long s,
+         const Type t ) : name( n ), id( i ), size( s ), type( t ) {}
+  };
+
+
+// Reading of metadata and traversal of directories, common to all the
+// file systems.
+//
+class Fs_base : public Filesystem
+  {
+  const int fd_;
+  std::vector< Block > metadata_;
+  std::set< long long > visited;	// entries already added by add_tree
+
+  bool add_tree( Entry & e, std::vector< Block > & extents, const int depth );
+
+protected:
+  const long long offset_;		// position of file system in device
+  std::string error_;
+
+  Fs_base( const int fd, const long long offset )
+    : fd_( fd ), offset_( offset ) {}
+
+  bool read( const long long pos, const int size, uint8_t * const buf );
+  bool fail( const char * const msg ) { error_ = msg; return false; }
+  void add_extent( std::vector< Block > & extents, const long long pos,
+                   const long long size ) const;
+
+  virtual Entry root() const = 0;
+  // Sets type and size of 'e' if unknown.
+  virtual bool complete( Entry & ) { return true; }
+  virtual bool list_dir( const Entry & dir,
+                         std::vector< Entry > & entries ) = 0;
+  virtual bool data_extents( const Entry & e,
+                             std::vector< Block > & extents ) = 0;
+  virtual bool same_name( const std::string & a, const std::string & b ) const
+    { return a == b; }
+
+public:
+  // Reads the superblock or equivalent. Returns false if error.
+  virtual bool init() = 0;
+
+  const std::vector< Block > & metadata() const { return metadata_; }
+  const std::string & error() const { return error_; }
+  bool path_extents( const std::string & path, std::vector< Block > & extents );
+  };
+
+
+// 'pos' is relative to the file system. Records the area read.
+//
+bool Fs_base::read( const long long pos, const int size, uint8_t * const buf )
+  {
+  if( pos < 0 || size <= 0 || pos > LLONG_MAX - offset_ - size )
+    return fail( "Invalid position in metadata." );
+  if( readblock( fd_, buf, size, offset_ + pos ) != size )
+    {
+    char msg[80];
+    if( errno )
+      snprintf( msg, sizeof msg, "Read error at position %lld: %s",
+                offset_ + pos, std::strerror( errno ) );
+    else
+      snprintf( msg, sizeof msg,
+                "Metadata beyond end of input at position %lld",
+                offset_ + pos );
+    return fail( msg );
+    }
+  add_extent( metadata_, pos, size );
+  return true;
+  }
+
+
+// Appends the area at 'pos' (relative to the file system) to 'extents',
+// merging it with the last one if they are contiguous.
+//
+void Fs_base::add_extent( std::vector< Block > & extents, const long long pos,
+                          const long long size ) const
+  {
+  if( pos < 0 || size <= 0 || pos > LLONG_MAX - offset_ - size ) return;
+  const long long p = offset_ + pos;
+  if( extents.size() && extents.back().end() == p )
+    extents.back().size( extents.back().size() + size );
+  else extents.push_back( Block( p, size ) );
+  }
+
+
+bool Fs_base::add_tree( Entry & e, std::vector< Block > & extents,
+                        const int depth )
+  {
+  if( !visited.insert( e.id ).second ) return true;	// hard link or loop
+  if( !complete( e ) || !data_extents( e, extents ) ) return false;
+  if( e.type != Entry::directory || depth >= 64 ) return true;
+  std::vector< Entry > entries;
+  if( !list_dir( e, entries ) ) return false;
+  for( unsigned i = 0; i < entries.size(); ++i )
+    if( entries[i].name != "." && entries[i].name != ".." &&
+        !add_tree( entries[i], extents, depth + 1 ) ) return false;
+  return true;
+  }
+
+
+bool Fs_base::path_extents( const std::string & path,
+                            std::vector< Block > & extents )
+  {
+  Entry e = root();
+  unsigned long i = 0;
+  while( true )
+    {
+    while( i < path.size() && path[i] == '/' ) ++i;
+    if( i >= path.size() ) break;
+    unsigned long j = path.find( '/', i );
+    if( j >= path.size() ) j = path.size();
+    const std::string component( path, i, j - i );
+    i = j;
+    if( component == "." ) continue;
+    if( !complete( e ) ) return false;
+    if( e.type != Entry::directory ) return fail( "Not a directory." );
+    std::vector< Entry > entries;
+    if( !list_dir( e, entries ) ) return false;
+    unsigned k = 0;
+    while( k < entries.size() && !same_name( entries[k].name, component ) ) ++k;
+    if( k >= entries.size() ) return fail( "No such file or directory." );
+    e = entries[k];
+    }
+  visited.clear();
+  return add_tree( e, extents, 0 );
+  }
+
+
+// FAT12, FAT16 and FAT32. Entry::id is the first cluster, or 0 for the
+// root directory of FAT12 and FAT16.
+//
+class Fat_fs : public Fs_base
+  {
+  long long fat_pos, root_pos, data_pos, size_;	// in bytes
+  long clusters;			// number of data clusters
+  long root_cluster;			// FAT32 only
+  int sector_size, cluster_size, root_size;
+  int fat_bits;				// 12, 16 or 32
+  std::map< long, Bytes > fat_cache;	// sectors of the FAT already read
+
+  bool fat_byte( const long long off, uint8_t & byte );
+  long next_cluster( const long cluster );
+  bool chain_extents( const long first, const long long max_clusters,
+                      std::vector< Block > & extents );
+
+  Entry root() const
+    { return Entry( "", ( fat_bits == 32 ) ? root_cluster : 0, -1,
+                    Entry::directory ); }
+  bool list_dir( const Entry & dir, std::vector< Entry > & entries );
+  bool data_extents( const Entry & e, std::vector< Block > & extents );
+  bool same_name( const std::string & a, const std::string & b ) const
+    { return same_name_nocase( a, b ); }
+
+public:
+  Fat_fs( const int fd, const long long offset ) : Fs_base( fd, offset ) {}
+
+  static bool recognize( const uint8_t * const boot );
+  bool init();
+  const char * name() const
+    { return ( fat_bits == 12 ) ? "FAT12" : ( fat_bits == 16 ) ? "FAT16" :
+                                                                 "FAT32"; }
+  long long size() const { return size_; }
+  };
+
+
+bool Fat_fs::recognize( const uint8_t * const boot )
+  {
+  const int sector_size = le16( boot + 11 );
+  const long fat_size =
+    le16( boot + 22 ) ? le16( boot + 22 ) : le32( boot + 36 );
+  const long total = le16( boot + 19 ) ? le16( boot + 19 ) : le32( boot + 32 );
+  return ( ( boot[0] == 0xEB || boot[0] == 0xE9 ) &&
+           std::memcmp( boot + 3, "NTFS    ", 8 ) != 0 &&
+           power_of_2( sector_size ) && sector_size >= 512 &&
+           sector_size <= 4096 && power_of_2( boot[13] ) &&
+           le16( boot + 14 ) > 0 && boot[16] > 0 && boot[16] <= 4 &&
+           fat_size > 0 && total > 0 &&
+           ( le16( boot + 22 ) || le16( boot + 17 ) == 0 ) );
+  }
+
+
+bool Fat_fs::init()
+  {
+  uint8_t boot[512];
+  if( !read( 0, sizeof boot, boot ) ) return false;
+  sector_size = le16( boot + 11 );
+  cluster_size = boot[13] * sector_size;
+  const long reserved = le16( boot + 14 );
+  const long fat_size =
+    le16( boot + 22 ) ? le16( boot + 22 ) : le32( boot + 36 );
+  const long total = le16( boot + 19 ) ? le16( boot + 19 ) : le32( boot + 32 );
+  const long root_sectors =
+    ( le16( boot + 17 ) * 32 + sector_size - 1 ) / sector_size;
+  const long first_data = reserved + boot[16] * fat_size + root_sectors;
+  if( first_data >= total ) return fail( "Corrupt FAT boot sector." );
+  clusters = ( total - first_data ) / boot[13];
+  fat_bits = ( clusters < 4085 ) ? 12 : ( clusters < 65525 ) ? 16 : 32;
+  if( ( fat_bits == 32 ) != ( le16( boot + 22 ) == 0 ) )
+    return fail( "Corrupt FAT boot sector." );
+  fat_pos = (long long)reserved * sector_size;
+  root_pos = fat_pos + (long long)boot[16] * fat_size * sector_size;
+  root_size = root_sectors * sector_size;
+  data_pos = (long long)first_data * sector_size;
+  size_ = (long long)total * sector_size;
+  root_cluster = ( fat_bits == 32 ) ? le32( boot + 44 ) : 0;
+  return true;
+  }
+
+
+bool Fat_fs::fat_byte( const long long off, uint8_t & byte )
+  {
+  const long sector = off / sector_size;
+  std::map< long, Bytes >::iterator it = fat_cache.find( sector );
+  if( it == fat_cache.end() )
+    {
+    Bytes buf( sector_size );
+    if( !read( fat_pos + (long long)sector * sector_size, sector_size,
+               &buf[0] ) ) return false;
+    it = fat_cache.insert( std::make_pair( sector, buf ) ).first;
+    }
+  byte = it->second[off % sector_size];
+  return true;
+  }
+
+
+// Returns the cluster following 'cluster' in its chain, 0 at the end of
+// the chain (or if the FAT entry is invalid), or -1 if read error.
+//
+long Fat_fs::next_cluster( const long cluster )
+  {
+  const long long off = ( fat_bits == 12 ) ? cluster + cluster / 2 :
+                        (long long)cluster * ( fat_bits / 8 );
+  uint8_t b[4] = { 0, 0, 0, 0 };
+  for( int i = 0; i < fat_bits / 8 + ( fat_bits == 12 ); ++i )
+    if( !fat_byte( off + i, b[i] ) ) return -1;
+  unsigned long next = le32( b );
+  if( fat_bits == 12 )
+    { next = ( cluster & 1 ) ? ( next & 0xFFFF ) >> 4 : next & 0xFFF; }
+  else if( fat_bits == 32 ) next &= 0x0FFFFFFF;
+  if( next < 2 || next > (unsigned long)clusters + 1 ) return 0;
+  return next;
+  }
+
+
+bool Fat_fs::chain_extents( const long first, const long long max_clusters,
+                            std::vector< Block > & extents )
+  {
+  long cluster = first;
+  for( long long i = 0; i < max_clusters && i < clusters &&
+       cluster >= 2 && cluster <= clusters + 1; ++i )
+    {
+    add_extent( extents, data_pos + (long long)( cluster - 2 ) * cluster_size,
+                cluster_size );
+    cluster = next_cluster( cluster );
+    if( cluster < 0 ) return false;
+    }
+  return true;
+  }
+
+
+bool Fat_fs::data_extents( const Entry & e, std::vector< Block > & extents )
+  {
+  if( e.type == Entry::directory )
+    {
+    if( e.id == 0 ) { add_extent( extents, root_pos, root_size ); return true; }
+    return chain_extents( e.id, LLONG_MAX, extents );
+    }
+  return chain_extents( e.id, ( e.size + cluster_size - 1 ) / cluster_size,
+                        extents );
+  }
+
+
+bool Fat_fs::list_dir( const Entry & dir, std::vector< Entry > & entries )
+  {
+  std::vector< Block > blocks;
+  if( dir.id == 0 && fat_bits != 32 )
+    blocks.push_back( Block( root_pos, root_size ) );
+  else
+    {
+    if( !chain_extents( dir.id, LLONG_MAX, blocks ) ) return false;
+    for( unsigned i = 0; i < blocks.size(); ++i )
+      blocks[i].pos( blocks[i].pos() - offset_ );
+    }
+  Bytes lfn;				// long name, UTF-16
+  int lfn_checksum = -1;
+  for( unsigned i = 0; i < blocks.size(); ++i )
+    {
+    Bytes buf( blocks[i].size() );
+    if( !read( blocks[i].pos(), buf.size(), &buf[0] ) ) return false;
+    for( unsigned j = 0; j + 32 <= buf.size(); j += 32 )
+      {
+      const uint8_t * const p = &buf[j];
+      if( p[0] == 0 ) return true;			// end of directory
+      const int attr = p[11];
+      if( p[0] == 0xE5 || ( attr & 0x08 && attr != 0x0F ) )
+        { lfn.clear(); continue; }			// deleted or label
+      if( attr == 0x0F )				// long name part
+        {
+        const int seq = p[0] & 0x1F;
+        if( seq == 0 ) { lfn.clear(); continue; }
+        if( p[0] & 0x40 ) { lfn.assign( seq * 26, 0 ); lfn_checksum = p[13]; }
+        if( lfn.size() < (unsigned)seq * 26 || p[13] != lfn_checksum )
+          { lfn.clear(); continue; }
+        uint8_t * const q = &lfn[( seq - 1 ) * 26];
+        std::memcpy( q, p + 1, 10 );
+        std::memcpy( q + 10, p + 14, 12 );
+        std::memcpy( q + 22, p + 28, 4 );
+        continue;
+        }
+      int sum = 0;
+      for( int k = 0; k < 11; ++k )			// checksum of short name
+        sum = ( ( ( sum & 1 ) << 7 ) + ( sum >> 1 ) + p[k] ) & 0xFF;
+      std::string name;
+      if( lfn.size() && sum == lfn_checksum )
+        name = utf16_to_utf8( &lfn[0], lfn.size() / 2 );
+      else
+        {
+        int k = 8;
+        while( k > 0 && p[k-1] == ' ' ) --k;
+        name.assign( (const char *)p, k );
+        if( name.size() && name[0] == 0x05 ) name[0] = (char)0xE5;
+        k = 11;
+        while( k > 8 && p[k-1] == ' ' ) --k;
+        if( k > 8 ) { name += '.'; name.append( (const char *)p + 8, k - 8 ); }
+        }
+      lfn.clear();
+      long cluster = le16( p + 26 );
+      if( fat_bits == 32 ) cluster |= (long)le16( p + 20 ) << 16;
+      entries.push_back( Entry( name, cluster, le32( p + 28 ),
+                  ( attr & 0x10 ) ? Entry::directory : Entry::file ) );
+      }
+    }
+  return true;
+  }
+
+
+// ext2, ext3 and ext4. Entry::id is the inode number.
+//
+class Ext_fs : public Fs_base
+  {
+  long long size_, gdt_pos, blocks_count;
+  unsigned long inodes_count, inodes_per_group;
+  int block_size, inode_size, desc_size;
+  unsigned long feature_compat, feature_incompat;
+  std::map< long long, Bytes > block_cache;	// GDT and inode table blocks
+
+  bool read_block( const long long block, Bytes & buf, const bool cache );
+  bool read_inode( const unsigned long ino, Bytes & inode );
+  bool extent_node( const uint8_t * const node, const int size,
+                    const int depth, const long long nblocks,
+                    std::vector< Block > & extents );
+  bool indirect( const long long block, const int level, long long & lblock,
+                 const long long nblocks, std::vector< Block > & extents );
+  bool inode_extents( const Bytes & inode, std::vector< Block > & extents );
+
+  Entry root() const { return Entry( "", 2, -1, Entry::directory ); }
+  bool complete( Entry & e );
+  bool list_dir( const Entry & dir, std::vector< Entry > & entries );
+  bool data_extents( const Entry & e, std::vector< Block > & extents );
+
+public:
+  Ext_fs( const int fd, const long long offset ) : Fs_base( fd, offset ) {}
+
+  static bool recognize( const uint8_t * const sb )
+    { return le16( sb + 56 ) == 0xEF53; }
+  bool init();
+  const char * name() const
+    { return ( feature_incompat & 0x40 ) ? "ext4" :
+             ( feature_compat & 0x4 ) ? "ext3" : "ext2"; }
+  long long size() const { return size_; }
+  };
+
+
+bool Ext_fs::init()
+  {
+  uint8_t sb[1024];
+  if( !read( 1024, sizeof sb, sb ) ) return false;
+  const unsigned long log_block_size = le32( sb + 24 );
+  feature_compat = le32( sb + 92 );
+  feature_incompat = le32( sb + 96 );
+  inodes_count = le32( sb + 0 );
+  inodes_per_group = le32( sb + 40 );
+  if( log_block_size > 6 || inodes_per_group == 0 )
+    return fail( "Corrupt ext superblock." );
+  if( feature_incompat & 0x18 )		// journal device or meta_bg
+    return fail( "Unsupported ext file system features." );
+  block_size = 1024 << log_block_size;
+  inode_size = ( le32( sb + 76 ) >= 1 ) ? le16( sb + 88 ) : 128;
+  desc_size = ( feature_incompat & 0x80 && le16( sb + 254 ) >= 32 ) ?
+              le16( sb + 254 ) : 32;
+  if( inode_size < 128 || inode_size > block_size ||
+      !power_of_2( inode_size ) || desc_size > block_size ||
+      !power_of_2( desc_size ) )
+    return fail( "Corrupt ext superblock." );
+  blocks_count = le32( sb + 4 );
+  if( feature_incompat & 0x80 )
+    blocks_count |= (long long)le32( sb + 0x150 ) << 32;
+  size_ = blocks_count * block_size;
+  gdt_pos = ( (long long)le32( sb + 20 ) + 1 ) * block_size;
+  return true;
+  }
+
+
+bool Ext_fs::read_block( const long long block, Bytes & buf, const bool cache )
+  {
+  if( block <= 0 || block >= blocks_count )
+    return fail( "Corrupt ext metadata (block number out of range)." );
+  std::map< long long, Bytes >::const_iterator it = block_cache.find( block );
+  if( it != block_cache.end() ) { buf = it->second; return true; }
+  buf.resize( block_size );
+  if( !read( block * block_size, block_size, &buf[0] ) ) return false;
+  if( cache )
+    {
+    if( block_cache.size() >= 4096 ) block_cache.clear();
+    block_cache[block] = buf;
+    }
+  return true;
+  }
+
+
+bool Ext_fs::read_inode( const unsigned long ino, Bytes & inode )
+  {
+  if( ino < 1 || ino > inodes_count )
+    return fail( "Corrupt ext metadata (inode number out of range)." );
+  const unsigned long group = ( ino - 1 ) / inodes_per_group;
+  const unsigned long index = ( ino - 1 ) % inodes_per_group;
+  const long long desc_pos = gdt_pos + (long long)group * desc_size;
+  Bytes buf;
+  if( !read_block( desc_pos / block_size, buf, true ) ) return false;
+  const uint8_t * const desc = &buf[desc_pos % block_size];
+  long long table = le32( desc + 8 );
+  if( desc_size >= 64 ) table |= (long long)le32( desc + 0x28 ) << 32;
+  const long long pos = table * block_size + (long long)index * inode_size;
+  if( !read_block( pos / block_size, buf, true ) ) return false;
+  inode.assign( buf.begin() + pos % block_size,
+                buf.begin() + pos % block_size + inode_size );
+  return true;
+  }
+
+
+// Adds the extents of the data blocks below 'node' with logical block
+// number less than 'nblocks'. Uninitialized extents are skipped.
+//
+bool Ext_fs::extent_node( const uint8_t * const node, const int size,
+                          const int depth, const long long nblocks,
+                          std::vector< Block > & extents )
+  {
+  const int entries = le16( node + 2 );
+  const int node_depth = le16( node + 6 );
+  if( le16( node ) != 0xF30A || 12 + 12 * entries > size || node_depth > 5 ||
+      depth > 5 ) return fail( "Corrupt ext extent tree." );
+  for( int i = 0; i < entries; ++i )
+    {
+    const uint8_t * const p = node + 12 + 12 * i;
+    if( node_depth > 0 )
+      {
+      const long long leaf = le32( p + 4 ) | ( (long long)le16( p + 8 ) << 32 );
+      Bytes buf;
+      if( !read_block( leaf, buf, false ) ||
+          !extent_node( &buf[0], block_size, depth + 1, nblocks, extents ) )
+        return false;
+      continue;
+      }
+    const long long lblock = le32( p );
+    long long len = le16( p + 4 );
+    if( len > 32768 || lblock >= nblocks ) continue;	// uninitialized
+    if( len > nblocks - lblock ) len = nblocks - lblock;
+    const long long start = le32( p + 8 ) | ( (long long)le16( p + 6 ) << 32 );
+    add_extent( extents, start * block_size, len * block_size );
+    }
+  return true;
+  }
+
+
+bool Ext_fs::indirect( const long long block, const int level,
+                       long long & lblock, const long long nblocks,
+                       std::vector< Block > & extents )
+  {
+  Bytes buf;
+  if( !read_block( block, buf, false ) ) return false;
+  const long per_block = block_size / 4;
+  long long span = 1;
+  for( int i = 1; i < level; ++i ) span *= per_block;
+  for( long i = 0; i < per_block && lblock < nblocks; ++i )
+    {
+    const long long b = le32( &buf[4*i] );
+    if( b == 0 ) lblock += span;				// hole
+    else if( level > 1 )
+      {
+      if( !indirect( b, level - 1, lblock, nblocks, extents ) ) return false;
+      }
+    else { add_extent( extents, b * block_size, block_size ); ++lblock; }
+    }
+  return true;
+  }
+
+
+bool Ext_fs::inode_extents( const Bytes & inode,
+                            std::vector< Block > & extents )
+  {
+  const unsigned mode = le16( &inode[0] );
+  const unsigned long flags = le32( &inode[32] );
+  const long long size =
+    le32( &inode[4] ) | ( (long long)le32( &inode[108] ) << 32 );
+  const long long nblocks = ( size + block_size - 1 ) / block_size;
+  if( flags & 0x10000000 ) return true;		// inline data
+  if( flags & 0x80000 )				// extents
+    return extent_node( &inode[40], 60, 0, nblocks, extents );
+  if( ( mode & 0xF000 ) == 0xA000 && size < 60 ) return true;	// fast symlink
+  long long lblock = 0;
+  for( int i = 0; i < 12 && lblock < nblocks; ++i, ++lblock )
+    {
+    const long long b = le32( &inode[40+4*i] );
+    if( b ) add_extent( extents, b * block_size, block_size );
+    }
+  long long span = block_size / 4;
+  for( int level = 1; level <= 3 && lblock < nblocks; ++level )
+    {
+    const long long b = le32( &inode[40+4*(11+level)] );
+    if( b == 0 ) lblock += span;
+    else if( !indirect( b, level, lblock, nblocks, extents ) ) return false;
+    span *= block_size / 4;
+    }
+  return true;
+  }
+
+
+bool Ext_fs::complete( Entry & e )
+  {
+  if( e.type != Entry::unknown && e.size >= 0 ) return true;
+  Bytes inode;
+  if( !read_inode( e.id, inode ) ) return false;
+  e.type = ( ( le16( &inode[0] ) & 0xF000 ) == 0x4000 ) ? Entry::directory :
+                                                         Entry::file;
+  e.size = le32( &inode[4] ) | ( (long long)le32( &inode[108] ) << 32 );
+  return true;
+  }
+
+
+bool Ext_fs::data_extents( const Entry & e, std::vector< Block > & extents )
+  {
+  Bytes inode;
+  return read_inode( e.id, inode ) && inode_extents( inode, extents );
+  }
+
+
+bool Ext_fs::list_dir( const Entry & dir, std::vector< Entry > & entries )
+  {
+  Bytes inode;
+  if( !read_inode( dir.id, inode ) ) return false;
+  std::vector< Block > blocks;
+  Bytes data;
+  if( le32( &inode[32] ) & 0x10000000 )		// inline data
+    { data.assign( 8, 0 ); data.insert( data.end(), &inode[44], &inode[100] ); }
+  else if( !inode_extents( inode, blocks ) ) return false;
+  for( unsigned i = 0; i < blocks.size(); ++i )
+    for( long long pos = blocks[i].pos() - offset_;
+         pos < blocks[i].end() - offset_; pos += block_size )
+      {
+      Bytes buf;
+      if( !read_block( pos / block_size, buf, false ) ) return false;
+      data.insert( data.end(), buf.begin(), buf.end() );
+      }
+  const bool filetype = feature_incompat & 0x2;
+  for( unsigned long off = 0; off + 8 <= data.size(); )
+    {
+    const uint8_t * const p = &data[off];
+    const unsigned long ino = le32( p );
+    const unsigned rec_len = le16( p + 4 );
+    const int name_len = p[6];
+    const unsigned long block_end = ( inode[32+3] & 0x10 ) ? data.size() :
+      ( off / block_size + 1 ) * block_size;
+    if( rec_len < 8 || off + rec_len > block_end )	// corrupt block
+      { off = block_end; continue; }
+    if( ino && 8U + name_len <= rec_len )
+      {
+      const int t = filetype ? p[7] : 0;
+      entries.push_back( Entry( std::string( (const char *)p + 8, name_len ),
+                   ino, -1, ( t == 2 ) ? Entry::directory :
+                            ( t == 0 ) ? Entry::unknown : Entry::file ) );
+      }
+    off += rec_len;
+    }
+  return true;
+  }
+
+
+// NTFS. Entry::id is the MFT record number.
+//
+class Ntfs_fs : public Fs_base
+  {
+  struct Run { long long vcn, lcn, length; };	// lcn < 0 if sparse
+  std::vector< Run > mft_runs;
+  long long size_;
+  int cluster_size, record_size;
+
+  bool read_stream( const std::vector< Run > & runs, const long long off,
+                    const int size, uint8_t * const buf );
+  bool fixup( Bytes & buf, const char * const magic );
+  bool read_record( const long long n, Bytes & rec );
+  bool decode_runs( const uint8_t * const attr, std::vector< Run > & runs );
+  bool attr_value( const uint8_t * const attr, Bytes & value );
+  bool attr_runs( const Bytes & rec, const long long n, const unsigned type,
+                  const char * const name, std::vector< Run > & runs,
+                  long long & data_size, bool & resident );
+  void add_runs( const std::vector< Run > & runs, const long long max_vcn,
+                 std::vector< Block > & extents ) const;
+  void parse_index( const uint8_t * p, const uint8_t * const end,
+                    std::vector< Entry > & entries ) const;
+
+  Entry root() const { return Entry( "", 5, -1, Entry::directory ); }
+  bool list_dir( const Entry & dir, std::vector< Entry > & entries );
+  bool data_extents( const Entry & e, std::vector< Block > & extents );
+  bool same_name( const std::string & a, const std::string & b ) const
+    { return same_name_nocase( a, b ); }
+
+public:
+  Ntfs_fs( const int fd, const long long offset ) : Fs_base( fd, offset ) {}
+
+  static bool recognize( const uint8_t * const boot )
+    { return std::memcmp( boot + 3, "NTFS    ", 8 ) == 0; }
+  bool init();
+  const char * name() const { return "NTFS"; }
+  long long size() const { return size_; }
+  };
+
+
+// Returns the next attribute of 'rec' at 'off', or 0 at the end.
+//
+const uint8_t * next_attr( const Bytes & rec, unsigned long & off )
+  {
+  if( off + 16 > rec.size() ) return 0;
+  const uint8_t * const p = &rec[off];
+  const unsigned long len = le32( p + 4 );
+  if( le32( p ) == 0xFFFFFFFFUL || len < 16 || off + len > rec.size() ||
+      ( p[8] && len < 64 ) || le16( p + 10 ) + 2 * p[9] > len ) return 0;
+  off += len;
+  return p;
+  }
+
+
+bool attr_is( const uint8_t * const attr, const unsigned type,
+              const char * const name )
+  {
+  const int len = std::strlen( name );
+  if( le32( attr ) != type || attr[9] != len ) return false;
+  const uint8_t * const s = attr + le16( attr + 10 );
+  for( int i = 0; i < len; ++i )
+    if( le16( s + 2 * i ) != (unsigned char)name[i] ) return false;
+  return true;
+  }
+
+
+bool Ntfs_fs::init()
+  {
+  uint8_t boot[512];
+  if( !read( 0, sizeof boot, boot ) ) return false;
+  const int sector_size = le16( boot + 11 );
+  const int spc = boot[13];
+  if( !power_of_2( sector_size ) || sector_size < 256 || sector_size > 4096 )
+    return fail( "Corrupt NTFS boot sector." );
+  if( spc > 0x80 )
+    { if( 256 - spc > 21 ) return fail( "Corrupt NTFS boot sector." );
+      cluster_size = 1 << ( 256 - spc ); }
+  else cluster_size = spc * sector_size;
+  const int cpr = (signed char)boot[64];
+  if( cpr > 0 ) record_size = ( cpr <= 64 ) ? cpr * cluster_size : 0;
+  else record_size = ( cpr >= -16 ) ? 1 << -cpr : 0;
+  if( !power_of_2( cluster_size ) || record_size < 512 ||
+      record_size > 65536 || record_size % 512 )
+    return fail( "Corrupt NTFS boot sector." );
+  size_ = (long long)le64( boot + 40 ) * sector_size;
+  const Run run = { 0, (long long)le64( boot + 48 ),
+                    ( record_size + cluster_size - 1 ) / cluster_size };
+  mft_runs.push_back( run );			// enough to read record 0
+  Bytes rec;
+  std::vector< Run > runs;
+  long long data_size;
+  bool resident = false;
+  if( !read_record( 0, rec ) ||
+      !attr_runs( rec, 0, 0x80, "", runs, data_size, resident ) ) return false;
+  if( runs.empty() ) return fail( "Corrupt NTFS MFT." );
+  mft_runs = runs;
+  return true;
+  }
+
+
+// Reads 'size' bytes at offset 'off' of the stream described by 'runs'.
+//
+bool Ntfs_fs::read_stream( const std::vector< Run > & runs, const long long off,
+                           const int size, uint8_t * const buf )
+  {
+  for( int done = 0; done < size; )
+    {
+    const long long vcn = ( off + done ) / cluster_size;
+    const int within = ( off + done ) % cluster_size;
+    const int n = std::min( size - done, cluster_size - within );
+    unsigned i = 0;
+    while( i < runs.size() &&
+           ( vcn < runs[i].vcn || vcn >= runs[i].vcn + runs[i].length ) ) ++i;
+    if( i >= runs.size() || runs[i].lcn < 0 )
+      return fail( "Corrupt NTFS run list." );
+    const long long lcn = runs[i].lcn + ( vcn - runs[i].vcn );
+    if( !read( lcn * cluster_size + within, n, buf + done ) ) return false;
+    done += n;
+    }
+  return true;
+  }
+
+
+// Checks the magic number and undoes the update sequence of a record.
+//
+bool Ntfs_fs::fixup( Bytes & buf, const char * const magic )
+  {
+  const unsigned usa_ofs = le16( &buf[4] );
+  const unsigned usa_count = le16( &buf[6] );
+  if( std::memcmp( &buf[0], magic, 4 ) != 0 || usa_count < 2 ||
+      usa_ofs + 2 * usa_count > buf.size() ||
+      ( usa_count - 1 ) * 512 > buf.size() )
+    return fail( "Corrupt NTFS record." );
+  for( unsigned i = 1; i < usa_count; ++i )
+    {
+    uint8_t * const p = &buf[i*512-2];
+    if( le16( p ) != le16( &buf[usa_ofs] ) )
+      return fail( "Corrupt NTFS record (torn write)." );
+    p[0] = buf[usa_ofs+2*i]; p[1] = buf[usa_ofs+2*i+1];
+    }
+  return true;
+  }
+
+
+bool Ntfs_fs::read_record( const long long n, Bytes & rec )
+  {
+  rec.resize( record_size );
+  return read_stream( mft_runs, n * record_size, record_size, &rec[0] ) &&
+         fixup( rec, "FILE" );
+  }
+
+
+bool Ntfs_fs::decode_runs( const uint8_t * const attr,
+                           std::vector< Run > & runs )
+  {
+  const unsigned long len = le32( attr + 4 );
+  long long vcn = le64( attr + 16 ), lcn = 0;
+  for( unsigned long off = le16( attr + 32 ); off < len && attr[off]; )
+    {
+    const int nl = attr[off] & 15, no = attr[off] >> 4;
+    if( nl == 0 || nl > 8 || no > 8 || off + 1 + nl + no > len )
+      return fail( "Corrupt NTFS run list." );
+    long long length = 0, delta = 0;
+    for( int i = nl; i > 0; --i ) length = ( length << 8 ) | attr[off+i];
+    for( int i = no; i > 0; --i ) delta = ( delta << 8 ) | attr[off+nl+i];
+    if( no && no < 8 && attr[off+nl+no] & 0x80 )	// negative
+      delta -= 1LL << ( 8 * no );
+    off += 1 + nl + no;
+    if( length <= 0 ) return fail( "Corrupt NTFS run list." );
+    lcn += delta;
+    const Run run = { vcn, no ? lcn : -1, length };
+    runs.push_back( run );
+    vcn += length;
+    }
+  return true;
+  }
+
+
+// Reads the value of a resident or non-resident attribute.
+//
+bool Ntfs_fs::attr_value( const uint8_t * const attr, Bytes & value )
+  {
+  const unsigned long len = le32( attr + 4 );
+  if( !attr[8] )
+    {
+    const unsigned long vlen = le32( attr + 16 ), voff = le16( attr + 20 );
+    if( voff + vlen > len ) return fail( "Corrupt NTFS attribute." );
+    value.assign( attr + voff, attr + voff + vlen );
+    return true;
+    }
+  const long long size = le64( attr + 48 );
+  std::vector< Run > runs;
+  if( size < 0 || size > 1 << 26 ) return fail( "Corrupt NTFS attribute." );
+  value.resize( size );
+  return decode_runs( attr, runs ) &&
+         ( size == 0 || read_stream( runs, 0, size, &value[0] ) );
+  }
+
+
+// Collects the runs of the attribute 'type' named 'name' of record 'n',
+// including the parts stored in other records if the record has an
+// attribute list. Sets 'resident' if the attribute is resident.
+//
+bool Ntfs_fs::attr_runs( const Bytes & rec, const long long n,
+                         const unsigned type, const char * const name,
+                         std::vector< Run > & runs, long long & data_size,
+                         bool & resident )
+  {
+  data_size = -1;
+  std::vector< long long > refs;	// records holding parts of attribute
+  unsigned long off = le16( &rec[20] );
+  for( const uint8_t * a; ( a = next_attr( rec, off ) ) != 0; )
+    if( le32( a ) == 0x20 )				// attribute list
+      {
+      Bytes list;
+      if( !attr_value( a, list ) ) return false;
+      for( unsigned long i = 0; i + 26 <= list.size(); )
+        {
+        const uint8_t * const e = &list[i];
+        const unsigned elen = le16( e + 4 );
+        if( elen < 26 || i + elen > list.size() || e[7] + 2U * e[6] > elen )
+          break;
+        Bytes hdr( 16, 0 );		// fake header to reuse attr_is
+        hdr[0] = e[0]; hdr[1] = e[1]; hdr[2] = e[2]; hdr[3] = e[3];
+        hdr[9] = e[6]; hdr[10] = 16;
+        hdr.insert( hdr.end(), e + e[7], e + e[7] + 2 * e[6] );
+        const long long ref = le64( e + 16 ) & 0xFFFFFFFFFFFFLL;
+        if( attr_is( &hdr[0], type, name ) &&
+            std::find( refs.begin(), refs.end(), ref ) == refs.end() )
+          refs.push_back( ref );
+        i += elen;
+        }
+      break;
+      }
+  if( refs.empty() ) refs.push_back( n );
+  for( unsigned i = 0; i < refs.size(); ++i )
+    {
+    Bytes ext;
+    if( refs[i] != n && !read_record( refs[i], ext ) ) return false;
+    const Bytes & r = ( refs[i] != n ) ? ext : rec;
+    off = le16( &r[20] );
+    for( const uint8_t * a; ( a = next_attr( r, off ) ) != 0; )
+      {
+      if( !attr_is( a, type, name ) ) continue;
+      if( !a[8] ) { resident = true; data_size = le32( a + 16 ); continue; }
+      if( le64( a + 16 ) == 0 ) data_size = le64( a + 48 );
+      if( !decode_runs( a, runs ) ) return false;
+      }
+    }
+  return true;
+  }
+
+
+// Adds the non-sparse clusters of 'runs' below 'max_vcn'.
+//
+void Ntfs_fs::add_runs( const std::vector< Run > & runs,
+                        const long long max_vcn,
+                        std::vector< Block > & extents ) const
+  {
+  for( unsigned i = 0; i < runs.size(); ++i )
+    if( runs[i].lcn >= 0 && runs[i].vcn < max_vcn )
+      add_extent( extents, runs[i].lcn * cluster_size,
+                  std::min( runs[i].length, max_vcn - runs[i].vcn ) *
+                  cluster_size );
+  }
+
+
+bool Ntfs_fs::data_extents( const Entry & e, std::vector< Block > & extents )
+  {
+  Bytes rec;
+  std::vector< Run > runs;
+  long long data_size;
+  bool resident = false;
+  if( !read_record( e.id, rec ) ||
+      !attr_runs( rec, e.id, 0x80, "", runs, data_size, resident ) )
+    return false;
+  if( resident )			// data in the record, already read
+    for( int off = 0; off < record_size; off += 512 )
+      {
+      const long long pos = e.id * record_size + off;
+      const long long vcn = pos / cluster_size;
+      for( unsigned i = 0; i < mft_runs.size(); ++i )
+        if( vcn >= mft_runs[i].vcn &&
+            vcn < mft_runs[i].vcn + mft_runs[i].length )
+          add_extent( extents, ( mft_runs[i].lcn + vcn - mft_runs[i].vcn ) *
+                      cluster_size + pos % cluster_size, 512 );
+      }
+  add_runs( runs, ( data_size >= 0 ) ?
+            ( data_size + cluster_size - 1 ) / cluster_size : LLONG_MAX,
+            extents );
+  if( e.type == Entry::directory )
+    {
+    runs.clear();
+    if( !attr_runs( rec, e.id, 0xA0, "$I30", runs, data_size, resident ) )
+      return false;
+    add_runs( runs, LLONG_MAX, extents );
+    }
+  return true;
+  }
+
+
+void Ntfs_fs::parse_index( const uint8_t * p, const uint8_t * const end,
+                           std::vector< Entry > & entries ) const
+  {
+  while( p + 16 <= end )
+    {
+    const unsigned len = le16( p + 8 ), key_len = le16( p + 10 );
+    if( le32( p + 12 ) & 2 || len < 16 || p + len > end ) break;	// last
+    const uint8_t * const key = p + 16;
+    if( key_len >= 66 && 16U + key_len <= len &&
+        66U + 2 * key[64] <= key_len )
+      entries.push_back( Entry( utf16_to_utf8( key + 66, key[64] ),
+                                le64( p ) & 0xFFFFFFFFFFFFLL, le64( key + 48 ),
+                                ( le32( key + 56 ) & 0x10000000 ) ?
+                                  Entry::directory : Entry::file ) );
+    p += len;
+    }
+  }
+
+
+bool Ntfs_fs::list_dir( const Entry & dir, std::vector< Entry > & entries )
+  {
+  Bytes rec;
+  if( !read_record( dir.id, rec ) ) return false;
+  Bytes root, bitmap;
+  unsigned long off = le16( &rec[20] );
+  for( const uint8_t * a; ( a = next_attr( rec, off ) ) != 0; )
+    {
+    if( attr_is( a, 0x90, "$I30" ) && !attr_value( a, root ) ) return false;
+    if( attr_is( a, 0xB0, "$I30" ) && !attr_value( a, bitmap ) ) return false;
+    }
+  if( root.size() < 32 ) return fail( "Corrupt NTFS directory." );
+  const long block_size = le32( &root[8] );
+  const unsigned long first = 16 + le32( &root[16] );
+  const unsigned long last = 16 + le32( &root[20] );
+  if( first <= last && last <= root.size() )
+    parse_index( &root[first], &root[last], entries );
+  std::vector< Run > runs;
+  long long data_size;
+  bool resident = false;
+  if( !attr_runs( rec, dir.id, 0xA0, "$I30", runs, data_size, resident ) )
+    return false;
+  if( runs.empty() ) return true;
+  if( block_size < 512 || block_size > 65536 || block_size % 512 )
+    return fail( "Corrupt NTFS directory." );
+  if( data_size < 0 ) data_size = ( runs.back().vcn + runs.back().length ) *
+                                  cluster_size;
+  Bytes buf( block_size );
+  for( long long i = 0; i < data_size / block_size; ++i )
+    {
+    if( bitmap.size() && ( i / 8 >= (long long)bitmap.size() ||
+                           !( bitmap[i/8] & ( 1 << ( i % 8 ) ) ) ) ) continue;
+    if( !read_stream( runs, i * block_size, block_size, &buf[0] ) ||
+        !fixup( buf, "INDX" ) ) return false;
+    const unsigned long first = 24 + le32( &buf[24] );
+    const unsigned long last = 24 + le32( &buf[28] );
+    if( first <= last && last <= buf.size() )
+      parse_index( &buf[first], &buf[last], entries );
+    }
+  return true;
+  }
+
+} // end namespace
+
+
+Filesystem * open_filesystem( const int fd, const long long offset,
+                              std::string & error )
+  {
+  uint8_t buf[2048];
+  const int size = readblock( fd, buf, sizeof buf, offset );
+  if( size < (int)sizeof buf )
+    {
+    error = errno ? "Read error in the first sectors of the file system" :
+                    "Input file is too small to contain a file system.";
+    if( errno ) { error += ": "; error += std::strerror( errno ); }
+    return 0;
+    }
+  Fs_base * fs = 0;
+  if( Ntfs_fs::recognize( buf ) ) fs = new Ntfs_fs( fd, offset );
+  else if( Fat_fs::recognize( buf ) ) fs = new Fat_fs( fd, offset );
+  else if( Ext_fs::recognize( buf + 1024 ) ) fs = new Ext_fs( fd, offset );
+  else { error = "No FAT, ext2/3/4 or NTFS file system found."; return 0; }
+  if( !fs->init() ) { error = fs->error(); delete fs; return 0; }
+  return fs;
+  }
@@ -0,0 +1,49 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2004-2016 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Finds the areas of a device used by some files of the FAT, ext2/3/4 or
+// NTFS file system it contains, reading only the metadata needed to find
+// them. All the positions are relative to the beginning of the device.
+//
+class Filesystem
+  {
+public:
+  virtual ~Filesystem() {}
+
+  virtual const char * name() const = 0;	// type of file system
+  virtual long long size() const = 0;		// size of file system
+
+  // Areas of metadata read so far (boot sector, FAT, inodes, MFT records,
+  // directories, etc).
+  virtual const std::vector< Block > & metadata() const = 0;
+
+  // Explains why the last call to path_extents failed.
+  virtual const std::string & error() const = 0;
+
+  // Appends to 'extents' the areas holding the data of 'path', and of all
+  // the files below it if 'path' is a directory. 'path' is relative to
+  // the root directory of the file system. Returns false if 'path' can't
+  // be found or if a read error happens.
+  virtual bool path_extents( const std::string & path,
+                             std::vector< Block > & extents ) = 0;
+  };
+
+
+// Returns a new Filesystem for the file system found at 'offset' of
+// 'fd', or 0 with the reason in 'error' if none is recognized.
+Filesystem * open_filesystem( const int fd, const long long offset,
+                              std::string & error );
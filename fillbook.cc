@@ -32,6 +32,23 @@
 #include "mapbook.h"
 
 
+void write_location_data( uint8_t * const buf, const Sblock & sb,
+                          const int hardbs )
+  {
+  for( long long pos = sb.pos(); pos < sb.end(); pos += hardbs )
+    {
+    char * const p = (char *)buf + ( pos - sb.pos() );
+    const int bufsize = std::min( 80LL, sb.end() - pos );
+    const int len = snprintf( p, bufsize,
+                              "\n# position      sector  status\n"
+                              "0x%08llX  0x%08llX  %c\n",
+                              pos, pos / hardbs, sb.status() );
+    if( len > 0 && len < bufsize )
+      std::memset( p + len, ' ', bufsize - len );
+    }
+  }
+
+
 // Return values: 1 write error, 0 OK.
 //
 int Fillbook::fill_block( const Sblock & sb )
@@ -41,17 +58,7 @@ int Fillbook::fill_block( const Sblock & sb )
   const int size = sb.size();
 
   if( write_location_data )	// write location data into each sector
-    for( long long pos = sb.pos(); pos < sb.end(); pos += hardbs() )
-      {
-      char * const buf = (char *)iobuf() + ( pos - sb.pos() );
-      const int bufsize = std::min( 80LL, sb.end() - pos );
-      const int len = snprintf( buf, bufsize,
-                                "\n# position      sector  status\n"
-                                "0x%08llX  0x%08llX  %c\n",
-                                pos, pos / hardbs(), sb.status() );
-      if( len > 0 && len < bufsize )
-        std::memset( buf + len, ' ', bufsize - len );
-      }
+    ::write_location_data( iobuf(), sb, hardbs() );
   if( writeblock( odes_, iobuf(), size, sb.pos() + offset() ) != size ||
       ( synchronous_ && fsync( odes_ ) < 0 && errno != EINVAL ) )
     {
@@ -116,7 +123,7 @@ void Fillbook::show_status( const long long ipos, const char * const msg,
     }
 
   if( ipos >= 0 ) last_ipos = ipos;
-  const long t2 = std::time( 0 );
+  const long t2 = current_time();
   if( t2 < t1 )					// clock jumped back
     {
     t0 -= std::min( t0, t1 - t2 );
@@ -25,6 +25,7 @@
 #include <ctime>
 #include <string>
 #include <vector>
+#include <fcntl.h>
 #include <stdint.h>
 #include <unistd.h>
 
@@ -79,6 +80,62 @@ void Genbook::check_block( const Block & b, int & copied_size, int & error_size
   }
 
 
+// Reads the same block from infile and outfile and sets the status of
+// each sector of 'b' as follows:
+//   finished     same data in both files, not all zeros
+//   bad_sector   different data, not all zeros in either file
+//   non_trimmed  data only in infile (zeros in outfile)
+//   non_scraped  data only in outfile (zeros in infile)
+//   non_tried    zeros in both files
+// Data beyond the end of a file are taken as zeros. If a read error
+// happens, the sectors from the error on are left unchanged.
+//
+void Genbook::compare_block( const Block & b, int & copied_size,
+                             int & error_size )
+  {
+  if( b.size() <= 0 ) internal_error( "bad size comparing a Block." );
+  uint8_t * const buf1 = iobuf2();
+  uint8_t * const buf2 = iobuf();
+  int size1 = readblock( ides_, buf1, b.size(), b.pos() );
+  if( !errno ) { std::memset( buf1 + size1, 0, b.size() - size1 );
+                 size1 = b.size(); }
+  int size2 = readblock( odes_, buf2, b.size(), b.pos() + offset() );
+  if( !errno ) { std::memset( buf2 + size2, 0, b.size() - size2 );
+                 size2 = b.size(); }
+  copied_size = std::min( size1, size2 );
+  error_size = b.size() - copied_size;
+
+  Block run( b.pos(), 0 );		// sectors of the same status
+  Sblock::Status run_st = Sblock::non_tried;
+  for( int pos = 0; pos <= copied_size; )
+    {
+    const int size = std::min( hardbs(), copied_size - pos );
+    Sblock::Status st = Sblock::non_tried;
+    if( size > 0 )
+      {
+      const uint8_t * const p1 = buf1 + pos;
+      const uint8_t * const p2 = buf2 + pos;
+      if( std::memcmp( p1, p2, size ) == 0 )
+        { if( !block_is_zero( p1, size ) ) st = Sblock::finished; }
+      else if( block_is_zero( p2, size ) ) st = Sblock::non_trimmed;
+      else if( block_is_zero( p1, size ) ) st = Sblock::non_scraped;
+      else st = Sblock::bad_sector;
+      }
+    if( st != run_st || size <= 0 )
+      {
+      if( run_st != Sblock::non_tried )
+        change_chunk_status( run, run_st, domain() );
+      if( run_st == Sblock::finished ) finished_size += run.size();
+      if( size <= 0 ) break;
+      run.assign( b.pos() + pos, 0 ); run_st = st;
+      }
+    run.size( run.size() + size );
+    gensize += size;
+    pos += size;
+    }
+  }
+
+
 // Return values: 1 unexpected EOF, 0 OK, -1 interrupted, -2 mapfile error.
 //
 int Genbook::check_all()
@@ -102,7 +159,8 @@ int Genbook::check_all()
       { show_status( b.pos(), msg, first_post ); first_post = false; }
     if( interrupted() ) return -1;
     int copied_size = 0, error_size = 0;
-    check_block( b, copied_size, error_size );
+    if( ides_ >= 0 ) compare_block( b, copied_size, error_size );
+    else check_block( b, copied_size, error_size );
     if( copied_size + error_size < b.size() &&			// EOF
         !truncate_vector( b.pos() + copied_size + error_size ) )
       { final_msg( "EOF found below the size calculated from mapfile" );
@@ -126,7 +184,7 @@ void Genbook::show_status( const long long ipos, const char * const msg,
     }
 
   if( ipos >= 0 ) last_ipos = ipos;
-  const long t2 = std::time( 0 );
+  const long t2 = current_time();
   if( t2 < t1 )					// clock jumped back
     {
     t0 -= std::min( t0, t1 - t2 );
@@ -142,7 +200,8 @@ void Genbook::show_status( const long long ipos, const char * const msg,
       last_size = gensize;
       }
     std::printf( "\r%s%s", up, up );
-    std::printf( "rescued: %9sB,  generated: %9sB,  current rate: %8sB/s\n",
+    std::printf( "%s: %9sB,  generated: %9sB,  current rate: %8sB/s\n",
+                 ( ides_ >= 0 ) ? "  equal" : "rescued",
                  format_num( finished_size ), format_num( gensize ),
                  format_num( c_rate, 99999 ) );
     std::printf( "   opos: %9sB,  run time: %11s,  average rate: %8sB/s\n",
@@ -159,12 +218,19 @@ void Genbook::show_status( const long long ipos, const char * const msg,
   }
 
 
+// If 'ides' >= 0, generate the mapfile by comparing infile with outfile.
 // Return values: 1 write error, 0 OK.
 //
-int Genbook::do_generate( const int odes )
+int Genbook::do_generate( const int odes, const int ides )
   {
   finished_size = 0; gensize = 0;
-  odes_ = odes;
+  ides_ = ides; odes_ = odes;
+#ifdef POSIX_FADV_SEQUENTIAL
+  // Both files are read forwards in parallel; ask for a larger read-ahead
+  // so that the kernel reads from one file while we read from the other.
+  posix_fadvise( odes_, 0, 0, POSIX_FADV_SEQUENTIAL );
+  if( ides_ >= 0 ) posix_fadvise( ides_, 0, 0, POSIX_FADV_SEQUENTIAL );
+#endif
 
   for( long i = 0; i < sblocks(); ++i )
     {
@@ -181,7 +247,8 @@ int Genbook::do_generate( const int odes )
     if( mapfile_exists() )
       {
       std::fputs( "Initial status (read from mapfile)\n", stdout );
-      std::printf( "rescued: %9sB,  generated: %9sB\n",
+      std::printf( "%s: %9sB,  generated: %9sB\n",
+                   ( ides_ >= 0 ) ? "  equal" : "rescued",
                    format_num( finished_size ), format_num( gensize ) );
       std::fputs( "Current status\n", stdout );
       }
@@ -17,14 +17,18 @@
 
 #define _FILE_OFFSET_BITS 64
 
+#include <algorithm>
 #include <cerrno>
 #include <climits>
 #include <csignal>
+#include <cstring>
 #include <string>
 #include <vector>
+#include <setjmp.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <sys/mman.h>
 
 #include "block.h"
 #include "mapbook.h"
@@ -53,9 +57,135 @@ int set_signal( const int signum, void (*handler)( int ) )
   return sigaction( signum, &new_action, 0 );
   }
 
+
+sigjmp_buf sigbus_env;
+volatile sig_atomic_t sigbus_armed = 0;
+const uint8_t * volatile sigbus_addr = 0;	// address that faulted
+
+// A read error in a mapped page raises SIGBUS when the page is accessed.
+// Only accesses made by touch_pages and Mapped_input::guard are recovered.
+extern "C" void sigbus_handler( int signum, siginfo_t * info, void * )
+  {
+  if( sigbus_armed )
+    { sigbus_addr = (const uint8_t *)info->si_addr;
+      siglongjmp( sigbus_env, 1 ); }
+  set_signal( signum, SIG_DFL );
+  std::raise( signum );
+  }
+
+
+// Touches the pages of 'buf' in order, so that the kernel reads them.
+// Returns the number of bytes before the first page that can't be read.
+//
+int touch_pages( const uint8_t * const buf, const int size )
+  {
+  static const long page_size = sysconf( _SC_PAGESIZE );
+  volatile int done = 0;
+  if( sigsetjmp( sigbus_env, 1 ) == 0 )
+    {
+    sigbus_armed = 1;
+    while( done < size )
+      {
+      (void)*(const volatile uint8_t *)( buf + done );
+      const int next = done + page_size -
+                       ( reinterpret_cast<unsigned long> (buf + done) % page_size );
+      done = std::min( next, size );
+      }
+    }
+  sigbus_armed = 0;
+  return done;
+  }
+
 } // end namespace
 
 
+Mapped_input::Mapped_input( const int fd )
+  : fd_( fd ), isize_( lseek( fd, 0, SEEK_END ) ), window( 0 ), wpos( 0 ),
+    wsize( 0 ), last_pos( -1 ), forward( true )
+  {
+  struct sigaction new_action;
+
+  new_action.sa_sigaction = sigbus_handler;
+  sigemptyset( &new_action.sa_mask );
+  new_action.sa_flags = SA_SIGINFO;
+  sigaction( SIGBUS, &new_action, 0 );
+  }
+
+
+Mapped_input::~Mapped_input() { if( window ) munmap( window, wsize ); }
+
+
+bool Mapped_input::can_map( const int fd )
+  {
+  const long page_size = sysconf( _SC_PAGESIZE );
+  void * const p = mmap( 0, page_size, PROT_READ, MAP_SHARED, fd, 0 );
+  if( p == MAP_FAILED ) return false;
+  munmap( p, page_size );
+  return true;
+  }
+
+
+// Maps a window containing [pos, pos + size) that extends in the
+// direction of the pass, and tells the kernel how it will be read.
+//
+bool Mapped_input::map_window( const long long pos, const int size )
+  {
+  static const long page_size = sysconf( _SC_PAGESIZE );
+  if( window ) { munmap( window, wsize ); window = 0; wsize = 0; }
+  long long start = forward ? pos : std::max( 0LL, pos + size - window_size );
+  start -= start % page_size;
+  const long long end =
+    std::min( isize_, std::max( start + window_size, pos + size ) );
+  void * const p = mmap( 0, end - start, PROT_READ, MAP_SHARED, fd_, start );
+  if( p == MAP_FAILED ) return false;
+  window = (uint8_t *)p; wpos = start; wsize = end - start;
+  if( forward ) madvise( window, wsize, MADV_SEQUENTIAL );
+  else
+    { madvise( window, wsize, MADV_RANDOM );	// no forward readahead
+      madvise( window, wsize, MADV_WILLNEED ); }
+  return true;
+  }
+
+
+// Returns a pointer to the data at 'pos' in the mapped window, and in
+// 'copied_size' the number of bytes really read, like readblock.
+// The pointer is valid until the next call.
+//
+const uint8_t * Mapped_input::read( const long long pos, const int size,
+                                    int & copied_size )
+  {
+  copied_size = 0;
+  errno = 0;
+  if( pos >= isize_ ) return 0;				// EOF
+  const int sz = std::min( (long long)size, isize_ - pos );
+  if( last_pos >= 0 && ( pos < last_pos ) == forward )
+    forward = !forward;			// direction of the pass has changed
+  last_pos = pos;
+  if( ( !window || pos < wpos || pos + sz > wpos + wsize ) &&
+      !map_window( pos, sz ) ) return 0;
+  const uint8_t * const p = window + ( pos - wpos );
+  copied_size = touch_pages( p, sz );
+  if( copied_size < sz ) errno = EIO;
+  return p;
+  }
+
+
+// Calls 'fn( arg )' recovering from the faults of mapped pages, which
+// may happen even after touch_pages if a page is evicted and can't be
+// read again, or if the input file is truncated. 'fn' must not leave
+// objects with destructors in the stack. Returns the address that
+// faulted, or 0 if 'fn' returned normally.
+//
+const uint8_t * Mapped_input::guard( void (*fn)( void * ), void * const arg )
+  {
+  sigbus_addr = 0;
+  if( sigsetjmp( sigbus_env, 1 ) == 0 )
+    { sigbus_armed = 1; fn( arg ); }
+  sigbus_armed = 0;
+  return sigbus_addr;
+  }
+
+
 // Returns the number of bytes really read.
 // If (returned value < size) and (errno == 0), means EOF was reached.
 //
@@ -108,6 +238,8 @@ int readblock_dvdread( dvd_reader_t *dvd, uint32_t dvd_blocks, uint8_t * const b
   lb = pos / 2048;
   n = size / 2048;
   n_read = DVDReadRawBlocks(dvd, buf, lb, n, 1);
+  /* DVDReadRawBlocks returns (uint32_t)-1 on error */
+  if (n_read > n) n_read = 0;
   if (n_read < n) {
     if (lb + n_read < dvd_blocks) {
       /* Set errno so caller knows this isn't EOF */
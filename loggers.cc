@@ -48,6 +48,7 @@ const char * format_time_dhms( const long t )
 
 Rate_logger rate_logger;
 Read_logger read_logger;
+Trace_logger trace_logger;
 
 
 bool Logger::set_filename( const char * const name )
@@ -144,3 +145,31 @@ bool Read_logger::print_time( const long time )
     error = true;
   return !error;
   }
+
+
+bool Trace_logger::open_file()
+  {
+  if( !filename_ ) return true;
+  if( !f )
+    {
+    f = std::fopen( filename_, "w" );
+    error = !f || !write_file_header( f, "Read trace" ) ||
+            std::fputs( "#  Ipos       Size  Copied_size  Errno  Latency\n", f ) == EOF;
+    }
+  return !error;
+  }
+
+
+// Records the outcome of a read of the input device. 'errcode' is the errno
+// of a failed read, or 0. 'latency' is in seconds.
+//
+bool Trace_logger::print_line( const long long ipos, const int size,
+                               const int copied_size, const int errcode,
+                               const double latency )
+  {
+  if( f && !error &&
+      std::fprintf( f, "0x%08llX	%d	%d	%d	%.6f\n",
+                    ipos, size, copied_size, errcode, latency ) < 0 )
+    error = true;
+  return !error;
+  }
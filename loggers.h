@@ -57,3 +57,15 @@ public:
   };
 
 extern Read_logger read_logger;
+
+
+class Trace_logger : public Logger
+  {
+public:
+  bool open_file();
+  bool print_line( const long long ipos, const int size,
+                   const int copied_size, const int errcode,
+                   const double latency );
+  };
+
+extern Trace_logger trace_logger;
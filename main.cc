@@ -31,12 +31,15 @@
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <map>
 #include <string>
 #include <vector>
 #include <fcntl.h>
+#include <glob.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 
 #ifdef DDRESCUE_USE_DVDREAD
 extern "C" {
@@ -50,6 +53,10 @@ extern "C" {
 #include "loggers.h"
 #include "mapbook.h"
 #include "non_posix.h"
+#include "simulator.h"
+#include "control.h"
+#include "filesystem.h"
+#include "strategy.h"
 #include "rescuebook.h"
 
 #ifndef O_BINARY
@@ -67,7 +74,7 @@ const char * const Program_name = "GNU ddrescue";
 const char * const program_name = "ddrescue";
 const char * invocation_name = 0;
 
-enum Mode { m_none, m_fill, m_generate };
+enum Mode { m_none, m_fill, m_generate, m_diff, m_file_domain };
 const mode_t outmode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
 
 
@@ -129,13 +136,26 @@ void show_help( const int cluster, const int hardbs, const int skipbs )
                "  -y, --synchronous              use synchronous writes for output file\n"
                "  -Z, --max-read-rate=<bytes>    maximum read rate in bytes/s\n"
                "      --ask                      ask for confirmation before starting the copy\n"
-               "      --cpass=<n>[,<n>]          select what copying pass(es) to run\n" );
+               "      --auto-direct              choose direct or buffered input for each read\n"
+               "      --control=<file>           accept commands on Unix socket <file>\n"
+               "      --cpass=<n>[,<n>]          select what copying pass(es) to run\n"
+               "      --diff-mode                generate mapfile comparing infile with outfile\n" );
 #ifdef DDRESCUE_USE_DVDREAD
   std::printf( "      --dvd                      use libdvdread/libdvdcss to read and decrypt device\n" );
 #endif
-  std::printf( "      --log-rates=<file>         log rates and error sizes in file\n"
+  std::printf( "      --file-domain=<file>       write domain mapfile of paths listed in file\n"
+               "      --log-rates=<file>         log rates and error sizes in file\n"
                "      --log-reads=<file>         log all read operations in file\n"
+               "      --log-trace=<file>         log outcome and latency of reads for --replay\n"
+               "      --mark-bad[=<file>]        write location data [or <file>] into bad areas\n"
+               "      --mmap                     read input file through memory mapping\n"
+               "      --page-cache=<bytes>       memory for the map with --page-file [64Mi]\n"
+               "      --page-file=<file>         keep most of the map in <file>, not in memory\n"
                "      --pause=<interval>         time to wait between passes [0]\n"
+               "      --reattach=<pattern>       wait for lost input to reappear in <pattern>\n"
+               "      --replay=<file>            replay the reads logged in <file>\n"
+               "      --simulate=<file>          simulate the input device described in <file>\n"
+               "      --strategy=<name>          rescue strategy to use [default]\n"
                "Numbers may be in decimal, hexadecimal or octal, and may be followed by a\n"
                "multiplier: s = sectors, k = 1000, Ki = 1024, M = 10^6, Mi = 2^20, etc...\n"
                "Time intervals have the format 1[.5][smhd] or 1/2[smhd].\n"
@@ -149,32 +169,15 @@ void show_help( const int cluster, const int hardbs, const int skipbs )
   }
 
 
-// Recognized formats: <rational_number>[unit]
-// Where the optional "unit" is one of 's', 'm', 'h' or 'd'.
-// Returns the number of seconds, or exits with 1 status if error.
+// Returns the number of seconds in 'ptr', or exits with 1 status if
+// error.
 //
 long parse_time_interval( const char * const ptr )
   {
-  Rational r;
-  int c = r.parse( ptr );
-
-  if( c > 0 )
-    {
-    switch( ptr[c] )
-      {
-      case 'd': r *= 86400; break;			// 24 * 60 * 60
-      case 'h': r *= 3600; break;			// 60 * 60
-      case 'm': r *= 60; break;
-      case 's':
-      case  0 : break;
-      default : show_error( "Bad unit in time interval.", 0, true );
-                std::exit( 1 );
-      }
-    const long interval = r.round();
-    if( !r.error() && interval >= 0 ) return interval;
-    }
-  show_error( "Bad value for time interval.", 0, true );
-  std::exit( 1 );
+  long interval = 0;
+  const char * const msg = parse_interval( ptr, interval );
+  if( msg ) { show_error( msg, 0, true ); std::exit( 1 ); }
+  return interval;
   }
 
 
@@ -305,25 +308,38 @@ int do_fill( const long long offset, Domain & domain,
   }
 
 
+// In diff mode, compare infile with outfile instead of checking outfile
+// for zeros.
+//
 int do_generate( const long long offset, Domain & domain,
                  const char * const iname, const char * const oname,
                  const char * const mapname,
-                 const int cluster, const int hardbs )
+                 const int cluster, const int hardbs, const bool diff )
   {
+  const char * const mode_name = diff ? "diff" : "generate";
   if( !mapname )
     {
-    show_error( "Mapfile must be specified in generate mode.", 0, true );
+    show_error( ( std::string( "Mapfile must be specified in " ) +
+                  mode_name + " mode." ).c_str(), 0, true );
     return 1;
     }
 
   const int ides = open( iname, O_RDONLY | O_BINARY );
   if( ides < 0 )
     { show_error( "Can't open input file", errno ); return 1; }
-  const long long isize = lseek( ides, 0, SEEK_END );
+  long long isize = lseek( ides, 0, SEEK_END );
   if( isize < 0 )
     { show_error( "Input file is not seekable." ); return 1; }
 
-  Genbook genbook( offset, isize, domain, mapname, cluster, hardbs );
+  const int odes = open( oname, O_RDONLY | O_BINARY );
+  if( odes < 0 )
+    { show_error( "Can't open output file", errno ); return 1; }
+  const long long osize = lseek( odes, 0, SEEK_END );
+  if( osize < 0 )
+    { show_error( "Output file is not seekable." ); return 1; }
+  if( diff ) isize = std::max( isize, osize - offset );
+
+  Genbook genbook( offset, isize, domain, mapname, cluster, hardbs, diff );
   if( genbook.domain().empty() ) return empty_domain();
   if( !genbook.blank() && genbook.current_status() != Mapfile::generating )
     {
@@ -332,25 +348,141 @@ int do_generate( const long long offset, Domain & domain,
     }
   if( genbook.read_only() ) return not_writable( mapname );
 
-  const int odes = open( oname, O_RDONLY | O_BINARY );
-  if( odes < 0 )
-    { show_error( "Can't open output file", errno ); return 1; }
-  if( lseek( odes, 0, SEEK_SET ) )
-    { show_error( "Output file is not seekable." ); return 1; }
-
   if( verbosity >= 0 )
     std::printf( "%s %s\n", Program_name, PROGVERSION );
   if( verbosity >= 1 )
     {
-    std::printf( "About to generate an approximate mapfile for %s and %s\n",
-                 iname, oname );
+    if( diff )
+      std::printf( "About to generate a mapfile comparing %s with %s\n",
+                   iname, oname );
+    else
+      std::printf( "About to generate an approximate mapfile for %s and %s\n",
+                   iname, oname );
     std::printf( "    Starting positions: infile = %sB,  outfile = %sB\n",
                  format_num( genbook.domain().pos() ),
                  format_num( genbook.domain().pos() + genbook.offset() ) );
     std::printf( "    Copy block size: %3d sectors\n", cluster );
     std::printf( "Sector size: %sBytes\n\n", format_num( hardbs, 99999 ) );
     }
-  return genbook.do_generate( odes );
+  return genbook.do_generate( odes, diff ? ides : -1 );
+  }
+
+
+bool lower_pos( const Block & b1, const Block & b2 )
+  { return b1.pos() < b2.pos(); }
+
+
+// Reads the list of paths, one per line. Empty lines and lines beginning
+// with '#' are ignored.
+//
+bool read_path_list( const char * const name,
+                     std::vector< std::string > & paths )
+  {
+  const bool from_stdin = ( std::strcmp( name, "-" ) == 0 );
+  FILE * const f = from_stdin ? stdin : std::fopen( name, "r" );
+  if( !f ) return false;
+  std::string line;
+  while( true )
+    {
+    const int ch = std::fgetc( f );
+    if( ch == EOF && line.empty() ) break;
+    if( ch != '\n' && ch != EOF ) { line += ch; continue; }
+    if( line.size() && line[line.size()-1] == '\r' )
+      line.resize( line.size() - 1 );
+    if( line.size() && line[0] != '#' ) paths.push_back( line );
+    line.clear();
+    if( ch == EOF ) break;
+    }
+  const bool error = std::ferror( f );
+  if( !from_stdin ) std::fclose( f );
+  return !error;
+  }
+
+
+int do_file_domain( const long long offset, const char * const iname,
+                    const char * const oname, const char * const listname,
+                    const bool force )
+  {
+  std::vector< std::string > paths;
+  if( !read_path_list( listname, paths ) )
+    { show_error( "Can't read list of paths", errno ); return 1; }
+  if( paths.empty() )
+    { show_error( "List of paths is empty." ); return 1; }
+  struct stat st;
+  if( !force && stat( oname, &st ) == 0 )
+    {
+    show_error( "Domain mapfile already exists.", 0, true );
+    return 1;
+    }
+
+  const int ides = open( iname, O_RDONLY | O_BINARY );
+  if( ides < 0 )
+    { show_error( "Can't open input file", errno ); return 1; }
+  std::string error;
+  Filesystem * const fs = open_filesystem( ides, offset, error );
+  if( !fs ) { show_error( error.c_str() ); return 1; }
+
+  if( verbosity >= 0 )
+    std::printf( "%s %s\n", Program_name, PROGVERSION );
+  if( verbosity >= 1 )
+    std::printf( "Found %s file system of size %sB at position %sB of %s\n",
+                 fs->name(), format_num( fs->size() ), format_num( offset ),
+                 iname );
+
+  int retval = 0;
+  std::vector< Block > extents;
+  for( unsigned i = 0; i < paths.size(); ++i )
+    {
+    const unsigned long first = extents.size();
+    if( !fs->path_extents( paths[i], extents ) )
+      {
+      extents.erase( extents.begin() + first, extents.end() );
+      show_error( ( paths[i] + ": " + fs->error() ).c_str() );
+      retval = 1; continue;
+      }
+    if( verbosity >= 1 )
+      {
+      long long size = 0;
+      for( unsigned long j = first; j < extents.size(); ++j )
+        size += extents[j].size();
+      std::printf( "  %s: %lu areas, %sB\n", paths[i].c_str(),
+                   extents.size() - first, format_num( size ) );
+      }
+    }
+
+  // Areas may overlap (hard links, metadata of several paths), and
+  // change_chunk_status needs each area inside a single block of the map,
+  // so sort and join them. Areas beyond the end of the file system are
+  // ignored.
+  extents.insert( extents.end(), fs->metadata().begin(), fs->metadata().end() );
+  std::sort( extents.begin(), extents.end(), lower_pos );
+  const Block fs_extent( offset, fs->size() );
+  delete fs;
+  std::vector< Block > areas;
+  for( unsigned long i = 0; i < extents.size(); ++i )
+    {
+    Block b( extents[i] );
+    b.crop( fs_extent );
+    if( b.size() <= 0 ) continue;
+    if( areas.empty() || b.pos() > areas.back().end() ) areas.push_back( b );
+    else if( b.end() > areas.back().end() )
+      areas.back().size( b.end() - areas.back().pos() );
+    }
+  const Domain domain( 0, -1 );
+  Mapfile mapfile( oname );
+  mapfile.set_to_status( Sblock::non_tried );
+  mapfile.truncate_vector( fs_extent.end(), true );
+  mapfile.current_status( Mapfile::finished );
+  long long size = 0;
+  for( unsigned long i = 0; i < areas.size(); ++i )
+    { mapfile.change_chunk_status( areas[i], Sblock::finished, domain );
+      size += areas[i].size(); }
+  if( !mapfile.write_mapfile() )
+    { show_error( "Can't write domain mapfile", errno ); return 1; }
+  if( verbosity >= 0 )
+    std::printf( "%sB of data and metadata written to domain mapfile %s\n",
+                 format_num( size ), oname );
+  return retval;
   }
 
 
@@ -408,7 +540,8 @@ bool user_agrees_ids( const Rescuebook & rescuebook, const char * const iname,
 
 
 int do_rescue( const long long offset, Domain & domain,
-               const Domain * const test_domain, const Rb_options & rb_opts,
+               const Domain * const test_domain, Input_model * const model,
+               const Rb_options & rb_opts,
                const char * const iname, const char * const oname,
                const char * const mapname, const int cluster,
                const int hardbs, const int o_direct_out, const int o_trunc,
@@ -456,12 +589,21 @@ int do_rescue( const long long offset, Domain & domain,
     { show_error( "Input file is not seekable." ); return 1; }
 #endif // DDRESCUE_USE_DVDREAD
 
+  if( rb_opts.mmap_in && !Mapped_input::can_map( ides ) )
+    { show_error( "Can't map input file in memory", errno ); return 1; }
+  const int idirect = rb_opts.auto_direct ?
+                      open( iname, O_RDONLY | O_DIRECT | O_BINARY ) : -1;
+  if( rb_opts.auto_direct && idirect < 0 )
+    { show_error( "Can't open input file for direct access", errno );
+      return 1; }
+
   if( test_domain )
     { const long long size = test_domain->end();
       if( isize <= 0 || isize > size ) isize = size; }
 
-  Rescuebook rescuebook( offset, isize, domain, test_domain, rb_opts, iname,
-                         mapname, cluster, hardbs, synchronous );
+  Rescuebook rescuebook( offset, isize, domain, test_domain, model,
+                         rb_opts, iname, mapname, cluster, hardbs,
+                         synchronous );
 
   if( verify_input_size )
     {
@@ -573,6 +715,14 @@ int do_rescue( const long long offset, Domain & domain,
     return 1;
   }
 
+  if( !trace_logger.open_file() ) {
+    show_error( "Can't open file for logging the read trace", errno );
+#ifdef DDRESCUE_USE_DVDREAD
+    if (idvd) DVDClose(idvd);
+#endif
+    return 1;
+  }
+
   if( !ask ) about_to_copy( rescuebook, iname, oname, ides, false );
   if( verbosity >= 1 )
     {
@@ -618,7 +768,8 @@ int do_rescue( const long long offset, Domain & domain,
                                   format_time( rescuebook.timeout ) ); }
       if( nl ) { nl = false; std::fputc( '\n', stdout ); }
 
-      std::printf( "Direct in: %s    ", rescuebook.o_direct_in ? "yes" : "no " );
+      std::printf( "Direct in: %s    ", rescuebook.auto_direct ? "auto" :
+                   rescuebook.o_direct_in ? "yes" : "no " );
       std::printf( "Direct out: %s    ", o_direct_out ? "yes" : "no " );
       std::printf( "Sparse: %s    ", rescuebook.sparse ? "yes" : "no " );
       std::printf( "Truncate: %s    ", o_trunc ? "yes" : "no " );
@@ -631,16 +782,27 @@ int do_rescue( const long long offset, Domain & domain,
       if( rescuebook.complete_only )
         { nl = true; std::fputs( "Complete only    ", stdout ); }
       if( rescuebook.reverse )
-        { nl = true; std::fputs( "Reverse mode", stdout ); }
+        { nl = true; std::fputs( "Reverse mode    ", stdout ); }
+      if( rescuebook.mmap_in )
+        { nl = true; std::fputs( "Mapped input    ", stdout ); }
+      if( rescuebook.mark_bad )
+        { nl = true; std::printf( "Mark bad: %s    ", rescuebook.mark_file ?
+                                  rescuebook.mark_file : "location" ); }
+      if( rescuebook.control_name )
+        { nl = true; std::printf( "Control: %s    ", rescuebook.control_name ); }
+      if( rescuebook.reattach_pattern )
+        { nl = true; std::printf( "Reattach: %s    ", rescuebook.reattach_pattern ); }
+      if( rescuebook.strategy_name )
+        { nl = true; std::printf( "Strategy: %s", rescuebook.strategy_name ); }
       if( nl ) { nl = false; std::fputc( '\n', stdout ); }
       }
     std::fputc( '\n', stdout );
     }
 #ifdef DDRESCUE_USE_DVDREAD
   if (dvd) return rescuebook.do_dvd_rescue( idvd, odes );
-  else return rescuebook.do_rescue( ides, odes );
+  else return rescuebook.do_rescue( ides, odes, idirect );
 #else
-  return rescuebook.do_rescue( ides, odes );
+  return rescuebook.do_rescue( ides, odes, idirect );
 #endif
   }
 
@@ -711,22 +873,101 @@ bool Rescuebook::reopen_infile()
   ides_ = open( iname_, O_RDONLY | o_direct_in | O_BINARY );
   if( ides_ < 0 )
     { final_msg( "Can't reopen input file", errno ); return false; }
+  if( auto_direct )
+    {
+    if( ides_direct >= 0 ) close( ides_direct );
+    ides_direct = open( iname_, O_RDONLY | O_DIRECT | O_BINARY );
+    if( ides_direct < 0 )
+      { final_msg( "Can't reopen input file for direct access", errno );
+        return false; }
+    }
   const long long isize = lseek( ides_, 0, SEEK_END );
   if( isize < 0 )
     { final_msg( "Input file has become not seekable", errno ); return false; }
+  if( mapped_input )
+    { delete mapped_input; mapped_input = new Mapped_input( ides_ ); }
   return true;
   }
 
 
+// Returns true if 'fd' has the size and device identity recorded at the
+// start of the rescue, and returns the last good sector read (if any).
+// A file of the same size is refused if neither the device identity nor
+// a good sector are known, as nothing tells it apart from another file.
+//
+bool Rescuebook::same_input( const int fd )
+  {
+  if( lseek( fd, 0, SEEK_END ) != input_size ) return false;
+  if( input_id.size() )
+    { const char * const id = device_id( fd );
+      if( !id || input_id != id ) return false; }
+  if( voe_ipos < 0 ) return ( input_id.size() > 0 );
+  return ( readblock( fd, iobuf_aux(), hardbs(), voe_ipos ) == hardbs() &&
+           std::memcmp( voe_buf, iobuf_aux(), hardbs() ) == 0 );
+  }
+
+
+// Return values: 0 OK, -1 interrupted, -2 mapfile error.
+// Saves the mapfile and waits until the input device reappears, either
+// as iname or as a file matching reattach_pattern, then reopens it.
+//
+int Rescuebook::wait_reattach()
+  {
+  if( !update_mapfile( odes_, true ) ) return -2;
+  if( ides_ >= 0 ) { close( ides_ ); ides_ = -1; }
+  if( ides_direct >= 0 ) { close( ides_direct ); ides_direct = -1; }
+  if( mapped_input ) { delete mapped_input; mapped_input = 0; }
+  read_logger.print_msg( t1 - t0, "Input device lost. Waiting for it" );
+  show_status( -1, "Input device lost. Waiting for it", true );
+  const long t2 = current_time();
+  while( true )
+    {
+    if( interrupted() ) return -1;
+    std::vector< std::string > names( 1, iname_ );
+    glob_t g;
+    if( glob( reattach_pattern, 0, 0, &g ) == 0 )
+      for( unsigned i = 0; i < g.gl_pathc; ++i )
+        names.push_back( g.gl_pathv[i] );
+    globfree( &g );
+    for( unsigned i = 0; i < names.size(); ++i )
+      {
+      const int fd = open( names[i].c_str(), O_RDONLY | o_direct_in | O_BINARY );
+      if( fd < 0 ) continue;
+      if( !same_input( fd ) ) { close( fd ); continue; }
+      if( auto_direct &&
+          ( ides_direct = open( names[i].c_str(),
+                                O_RDONLY | O_DIRECT | O_BINARY ) ) < 0 )
+        { close( fd ); continue; }
+      ides_ = fd;
+      reattached_name = names[i]; iname_ = reattached_name.c_str();
+      if( mmap_in ) mapped_input = new Mapped_input( ides_ );
+      const long t3 = current_time();
+      if( t1 < t3 ) t1 = t3;
+      ts = std::min( ts + ( t3 - t2 ), t3 );	// avoid spurious timeout
+      read_logger.print_msg( t1 - t0, ( "Input device reattached as " +
+                                        reattached_name ).c_str() );
+      return 0;
+      }
+    wait_seconds( 1 );
+    }
+  }
+
+
 int main( const int argc, const char * const argv[] )
   {
-  enum Optcode { opt_ask = 256, opt_dvd, opt_cpa, opt_pau, opt_rat, opt_rea };
+  enum Optcode { opt_adi = 256, opt_ask, opt_att, opt_ctl, opt_dvd, opt_cpa,
+                 opt_dif, opt_fdo, opt_mma, opt_mrk, opt_pau, opt_pgc, opt_pgf,
+                 opt_rat, opt_rea, opt_rep, opt_sim, opt_str, opt_tra };
   long long ipos = 0;
   long long opos = -1;
   long long max_size = -1;
   const char * domain_mapfile_name = 0;
+  const char * path_list_name = 0;
   const char * test_mode_mapfile_name = 0;
+  const char * sim_model_name = 0;
+  const char * replay_trace_name = 0;
   const int cluster_bytes = 65536;
+  const int diff_cluster_bytes = 1 << 20;	// both files are read at once
   const int default_hardbs = 512;
   const int max_hardbs = Rb_options::max_max_skipbs;
   int cluster = 0;
@@ -796,12 +1037,25 @@ int main( const int argc, const char * const argv[] )
     { 'X', "exit-on-error",       Arg_parser::no  },
     { 'y', "synchronous",         Arg_parser::no  },
     { 'Z', "max-read-rate",       Arg_parser::yes },
+    { opt_adi, "auto-direct",     Arg_parser::no  },
     { opt_ask, "ask",             Arg_parser::no  },
+    { opt_ctl, "control",         Arg_parser::yes },
     { opt_dvd, "dvd",             Arg_parser::no  },
     { opt_cpa, "cpass",           Arg_parser::yes },
+    { opt_dif, "diff-mode",       Arg_parser::no  },
+    { opt_fdo, "file-domain",     Arg_parser::yes },
+    { opt_mma, "mmap",            Arg_parser::no  },
+    { opt_mrk, "mark-bad",        Arg_parser::maybe },
     { opt_pau, "pause",           Arg_parser::yes },
+    { opt_pgc, "page-cache",      Arg_parser::yes },
+    { opt_pgf, "page-file",       Arg_parser::yes },
     { opt_rat, "log-rates",       Arg_parser::yes },
     { opt_rea, "log-reads",       Arg_parser::yes },
+    { opt_att, "reattach",        Arg_parser::yes },
+    { opt_rep, "replay",          Arg_parser::yes },
+    { opt_sim, "simulate",        Arg_parser::yes },
+    { opt_str, "strategy",        Arg_parser::yes },
+    { opt_tra, "log-trace",       Arg_parser::yes },
     {  0 , 0,                     Arg_parser::no  } };
 
   const Arg_parser parser( argc, argv, options );
@@ -865,18 +1119,40 @@ int main( const int argc, const char * const argv[] )
       case 'X': rb_opts.exit_on_error = true; break;
       case 'y': synchronous = true; break;
       case 'Z': rb_opts.max_read_rate = getnum( ptr, hardbs, 1 ); break;
+      case opt_adi: rb_opts.auto_direct = true; check_o_direct(); break;
       case opt_ask: ask = true; break;
 #ifdef DDRESCUE_USE_DVDREAD
       case opt_dvd: dvd = true; if (hardbs_at_default) hardbs = 2048; break;
 #endif
+      case opt_ctl: rb_opts.control_name = ptr; break;
       case opt_cpa: parse_cpass( arg, rb_opts ); break;
+      case opt_dif: set_mode( program_mode, m_diff ); break;
+      case opt_fdo: set_mode( program_mode, m_file_domain );
+                    path_list_name = ptr; break;
+      case opt_mma: rb_opts.mmap_in = true; break;
+      case opt_mrk: rb_opts.mark_bad = true;
+                    if( arg.size() ) rb_opts.mark_file = ptr;
+                    break;
       case opt_pau: rb_opts.pause = parse_time_interval( ptr ); break;
+      case opt_pgc: rb_opts.page_cache_size = getnum( ptr, hardbs, 1 ); break;
+      case opt_pgf: rb_opts.page_file = ptr; break;
       case opt_rat: if( rate_logger.set_filename( ptr ) ) break;
         { show_error( "Rates logfile exists and is not a regular file." );
           return 1; }
       case opt_rea: if( read_logger.set_filename( ptr ) ) break;
         { show_error( "Reads logfile exists and is not a regular file." );
           return 1; }
+      case opt_rep: if( !replay_trace_name ) { replay_trace_name = ptr; break; }
+        { show_error( "Option '--replay' can be specified only once.", 0, true );
+          return 1; }
+      case opt_sim: if( !sim_model_name ) { sim_model_name = ptr; break; }
+        { show_error( "Option '--simulate' can be specified only once.", 0, true );
+          return 1; }
+      case opt_att: rb_opts.reattach_pattern = ptr; break;
+      case opt_str: rb_opts.strategy_name = ptr; break;
+      case opt_tra: if( trace_logger.set_filename( ptr ) ) break;
+        { show_error( "Trace file exists and is not a regular file." );
+          return 1; }
       default : internal_error( "uncaught option." );
       }
     } // end process options
@@ -884,7 +1160,8 @@ int main( const int argc, const char * const argv[] )
   if( opos < 0 ) opos = ipos;
   if( hardbs < 1 ) hardbs = default_hardbs;
   if( cluster >= INT_MAX / hardbs ) cluster = ( INT_MAX / hardbs ) - 1;
-  if( cluster < 1 ) cluster = cluster_bytes / hardbs;
+  if( cluster < 1 ) cluster = ( ( program_mode == m_diff ) ?
+                                diff_cluster_bytes : cluster_bytes ) / hardbs;
   if( cluster < 1 ) cluster = 1;
 
   const char *iname = 0, *oname = 0, *mapname = 0;
@@ -897,7 +1174,8 @@ int main( const int argc, const char * const argv[] )
   // end scan arguments
 
   if( !check_files( iname, oname, mapname, rb_opts.min_outfile_size, force,
-                    program_mode == m_generate, preallocate, rb_opts.sparse ) )
+                    program_mode == m_generate || program_mode == m_diff,
+                    preallocate, rb_opts.sparse ) )
     return 1;
 
   Domain domain( ipos, max_size, domain_mapfile_name, loose );
@@ -912,33 +1190,69 @@ int main( const int argc, const char * const argv[] )
         { show_error( "Option '--dvd' is incompatible with fill mode.", 0, true );
           return 1; }
       if( rb_opts != Rb_options() || test_mode_mapfile_name ||
-          verify_input_size || preallocate || o_trunc )
+          sim_model_name || replay_trace_name || verify_input_size || preallocate || o_trunc )
         show_error( "warning: Options -aACdeEHIJKlMnOpPrRStTuxX are ignored in fill mode." );
       return do_fill( opos - ipos, domain, iname, oname, mapname, cluster,
                       hardbs, o_direct_out, fb_opts, synchronous );
     case m_generate:
+    case m_diff:
+      {
+      const std::string mode =
+        ( program_mode == m_diff ) ? " diff mode." : " generate mode.";
       if( ask )
-        { show_error( "Option '--ask' is incompatible with generate mode.", 0, true );
-          return 1; }
+        { show_error( ( "Option '--ask' is incompatible with" + mode ).c_str(),
+                      0, true ); return 1; }
       if( dvd )
-        { show_error( "Option '--dvd' is incompatible with generate mode.", 0, true );
-          return 1; }
+        { show_error( ( "Option '--dvd' is incompatible with" + mode ).c_str(),
+                      0, true ); return 1; }
       if( fb_opts != Fb_options() || rb_opts != Rb_options() || synchronous ||
-          test_mode_mapfile_name || verify_input_size || preallocate ||
+          test_mode_mapfile_name || sim_model_name || replay_trace_name ||
+          verify_input_size || preallocate ||
           o_direct_out || o_trunc )
-        show_error( "warning: Options -aACdDeEHIJKlMnOpPrRStTuwxXy are ignored in generate mode." );
+        show_error( ( "warning: Options -aACdDeEHIJKlMnOpPrRStTuwxXy are "
+                      "ignored in" + mode ).c_str() );
       return do_generate( opos - ipos, domain, iname, oname, mapname, cluster,
-                          hardbs );
+                          hardbs, program_mode == m_diff );
+      }
+    case m_file_domain:
+      if( mapname )
+        { show_error( "Too many files in file-domain mode.", 0, true );
+          return 1; }
+      if( ask || dvd || domain_mapfile_name || max_size >= 0 ||
+          fb_opts != Fb_options() || rb_opts != Rb_options() || synchronous ||
+          test_mode_mapfile_name || sim_model_name || replay_trace_name ||
+          verify_input_size || preallocate || o_direct_out || o_trunc )
+        show_error( "warning: Options other than -f, -i, -q and -v are ignored in file-domain mode." );
+      return do_file_domain( ipos, iname, oname, path_list_name, force );
     case m_none:
       {
       if( fb_opts != Fb_options() )
         { show_error( "Option '-w' is incompatible with rescue mode.", 0, true );
           return 1; }
+      if( rb_opts.mmap_in && ( rb_opts.o_direct_in || dvd ) )
+        { show_error( "Option '--mmap' is incompatible with '--idirect' and '--dvd'.",
+                      0, true ); return 1; }
+      if( rb_opts.auto_direct && ( rb_opts.o_direct_in || rb_opts.mmap_in || dvd ) )
+        { show_error( "Option '--auto-direct' is incompatible with '--idirect', '--mmap' and '--dvd'.",
+                      0, true ); return 1; }
+      if( rb_opts.reattach_pattern && dvd )
+        { show_error( "Option '--reattach' is incompatible with '--dvd'.",
+                      0, true ); return 1; }
       const Domain test_domain( 0, -1, test_mode_mapfile_name, loose );
-      return do_rescue( opos - ipos, domain,
-                        test_mode_mapfile_name ? &test_domain : 0, rb_opts,
-                        iname, oname, mapname, cluster, hardbs, o_direct_out,
-                        o_trunc, ask, dvd, preallocate, synchronous, verify_input_size );
+      if( sim_model_name && replay_trace_name )
+        { show_error( "Options '--simulate' and '--replay' are incompatible.",
+                      0, true ); return 1; }
+      Input_model * model = 0;
+      if( sim_model_name ) model = new Simulator( sim_model_name, hardbs );
+      else if( replay_trace_name ) model = new Replayer( replay_trace_name );
+      if( model ) use_virtual_clock();
+      const int retval = do_rescue( opos - ipos, domain,
+                        test_mode_mapfile_name ? &test_domain : 0, model,
+                        rb_opts, iname, oname, mapname, cluster, hardbs,
+                        o_direct_out, o_trunc, ask, dvd, preallocate,
+                        synchronous, verify_input_size );
+      delete model;
+      return retval;
       }
     }
   }
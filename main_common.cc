@@ -18,6 +18,7 @@
 namespace {
 
 const char * const program_year = "2016";
+const char * const out_of_limits = "Numerical argument out of limits.";
 std::string command_line;
 
 
@@ -35,54 +36,11 @@ long long getnum( const char * const ptr, const int hardbs,
                   const long long min = LLONG_MIN + 1,
                   const long long max = LLONG_MAX, const bool comma = false )
   {
-  char * tail;
-  errno = 0;
-  long long result = strtoll( ptr, &tail, 0 );
-  if( tail == ptr )
+  long long result = 0;
+  const char * const msg = parse_num( ptr, hardbs, min, max, result, comma );
+  if( msg )
     {
-    show_error( "Bad or missing numerical argument.", 0, true );
-    std::exit( 1 );
-    }
-
-  if( !errno && tail[0] )
-    {
-    int factor = ( tail[1] == 'i' ) ? 1024 : 1000;
-    int exponent = 0;
-    bool bad_multiplier = false;
-    switch( tail[0] )
-      {
-      case ',': if( !comma ) { bad_multiplier = true; } break;
-      case 'Y': exponent = 8; break;
-      case 'Z': exponent = 7; break;
-      case 'E': exponent = 6; break;
-      case 'P': exponent = 5; break;
-      case 'T': exponent = 4; break;
-      case 'G': exponent = 3; break;
-      case 'M': exponent = 2; break;
-      case 'K': if( factor == 1024 ) exponent = 1; else bad_multiplier = true;
-                break;
-      case 'k': if( factor == 1000 ) exponent = 1; else bad_multiplier = true;
-                break;
-      case 's': if( hardbs > 0 ) { factor = hardbs; exponent = 1; }
-                else bad_multiplier = true;
-                break;
-      default : bad_multiplier = true;
-      }
-    if( bad_multiplier )
-      {
-      show_error( "Bad multiplier in numerical argument.", 0, true );
-      std::exit( 1 );
-      }
-    for( int i = 0; i < exponent; ++i )
-      {
-      if( LLONG_MAX / factor >= llabs( result ) ) result *= factor;
-      else { errno = ERANGE; break; }
-      }
-    }
-  if( !errno && ( result < min || result > max ) ) errno = ERANGE;
-  if( errno )
-    {
-    show_error( "Numerical argument out of limits." );
+    show_error( msg, 0, msg != out_of_limits );
     std::exit( 1 );
     }
   return result;
@@ -150,32 +108,80 @@ const char * get_timestamp( const long t = 0 )
 } // end namespace
 
 
-int verbosity = 0;
+#include "error_common.cc"
 
 
-void show_error( const char * const msg, const int errcode, const bool help )
+// Parses a number followed by an optional multiplier, or by a comma if
+// 'comma' is true. 's' multiplies by 'hardbs' if it is > 0. Returns 0
+// and stores the number in 'value' if it is valid and in [min, max].
+// Else returns an error message.
+//
+const char * parse_num( const char * const ptr, const int hardbs,
+                        const long long min, const long long max,
+                        long long & value, const bool comma )
   {
-  if( verbosity >= 0 )
+  char * tail;
+  errno = 0;
+  long long result = strtoll( ptr, &tail, 0 );
+  if( tail == ptr ) return "Bad or missing numerical argument.";
+
+  if( !errno && tail[0] )
     {
-    if( msg && msg[0] )
+    const bool binary = ( tail[1] == 'i' );
+    int factor = binary ? 1024 : 1000;
+    int exponent = -1;				// -1 = bad multiplier
+    switch( tail[0] )
       {
-      std::fprintf( stderr, "%s: %s", program_name, msg );
-      if( errcode > 0 )
-        std::fprintf( stderr, ": %s", std::strerror( errcode ) );
-      std::fputc( '\n', stderr );
+      case ',': if( comma ) exponent = 0; break;
+      case 'Y': exponent = 8; break;
+      case 'Z': exponent = 7; break;
+      case 'E': exponent = 6; break;
+      case 'P': exponent = 5; break;
+      case 'T': exponent = 4; break;
+      case 'G': exponent = 3; break;
+      case 'M': exponent = 2; break;
+      case 'K': if( binary ) exponent = 1; break;
+      case 'k': if( !binary ) exponent = 1; break;
+      case 's': if( hardbs > 0 && !binary ) { factor = hardbs; exponent = 1; }
+                break;
+      }
+    if( exponent < 0 ) return "Bad multiplier in numerical argument.";
+    for( int i = 0; i < exponent; ++i )
+      {
+      if( LLONG_MAX / factor >= llabs( result ) ) result *= factor;
+      else { errno = ERANGE; break; }
       }
-    if( help )
-      std::fprintf( stderr, "Try '%s --help' for more information.\n",
-                    invocation_name );
     }
+  if( !errno && ( result < min || result > max ) ) errno = ERANGE;
+  if( errno ) return out_of_limits;
+  value = result;
+  return 0;
   }
 
 
-void internal_error( const char * const msg )
+// Recognized formats: <rational_number>[unit]
+// Where the optional "unit" is one of 's', 'm', 'h' or 'd'.
+// Returns 0 and stores the number of seconds in 'value' if 'ptr' is
+// valid. Else returns an error message.
+//
+const char * parse_interval( const char * const ptr, long & value )
   {
-  if( verbosity >= 0 )
-    std::fprintf( stderr, "%s: internal error: %s\n", program_name, msg );
-  std::exit( 3 );
+  Rational r;
+  const int c = r.parse( ptr );
+  if( c <= 0 ) return "Bad value for time interval.";
+  switch( ptr[c] )
+    {
+    case 'd': r *= 86400; break;			// 24 * 60 * 60
+    case 'h': r *= 3600; break;			// 60 * 60
+    case 'm': r *= 60; break;
+    case 's':
+    case  0 : break;
+    default : return "Bad unit in time interval.";
+    }
+  const long interval = r.round();
+  if( r.error() || interval < 0 ) return "Bad value for time interval.";
+  value = interval;
+  return 0;
   }
 
 
@@ -211,6 +217,47 @@ long initial_time()
   }
 
 
+namespace {
+
+double virtual_seconds = -1;	// seconds since initial_time, or -1 if real
+
+} // end namespace
+
+
+// Makes current_time count only the time passed to advance_clock, so that
+// a simulated rescue does not need to wait for a real device.
+//
+void use_virtual_clock()
+  { initial_time(); if( virtual_seconds < 0 ) virtual_seconds = 0; }
+
+
+long current_time()
+  {
+  if( virtual_seconds < 0 ) return std::time( 0 );
+  return initial_time() + (long)virtual_seconds;
+  }
+
+
+// Returns the current time with subsecond precision, for measuring the
+// latency of reads.
+//
+double precise_time()
+  {
+  if( virtual_seconds >= 0 ) return initial_time() + virtual_seconds;
+  struct timeval tv;
+  gettimeofday( &tv, 0 );
+  return tv.tv_sec + tv.tv_usec / 1e6;
+  }
+
+
+void advance_clock( const double seconds )
+  { if( virtual_seconds >= 0 && seconds > 0 ) virtual_seconds += seconds; }
+
+
+void wait_seconds( const long seconds )
+  { if( virtual_seconds >= 0 ) advance_clock( seconds ); else sleep( seconds ); }
+
+
 bool write_file_header( FILE * const f, const char * const filetype )
   {
   static std::string timestamp;
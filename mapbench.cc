@@ -0,0 +1,609 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2004-2016 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+    Mapbench measures the speed and memory use of the map operations
+    performed by ddrescue. It times each operation on synthetic maps of
+    growing size, and then the sequences of operations performed by the
+    copying, trimming, scraping and retrying passes, with and without
+    packing the fragmented areas of the map. With '--random-ops', it
+    compares the results of random operations on a packed and an
+    unpacked map.
+
+    Exit status: 0 for a normal exit, 1 for environmental problems
+    (invalid flags, etc), 3 if the packed and unpacked maps differ.
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "arg_parser.h"
+#include "block.h"
+
+
+namespace {
+
+const char * const program_name = "mapbench";
+const char * invocation_name = 0;
+
+
+void show_help()
+  {
+  std::printf( "Mapbench measures the speed and memory use of the map operations performed\n"
+               "by ddrescue, on synthetic maps of growing size and during the copying,\n"
+               "trimming, scraping and retrying passes, with and without packing the\n"
+               "fragmented areas of the map.\n"
+               "\nUsage: %s [options]\n", invocation_name );
+  std::printf( "\nOptions:\n"
+               "  -h, --help                 display this help and exit\n"
+               "  -b, --sector-size=<bytes>  sector size of input device [default 512]\n"
+               "  -c, --page-cache=<bytes>   memory for the unpacked map with -p [1Mi]\n"
+               "  -f, --map-file=<file>      temporary mapfile [mapbench.map]\n"
+               "  -m, --max-entries=<n>      largest synthetic map (0 = none) [1M]\n"
+               "  -n, --sectors=<n>          sectors in the map of the passes (0 = none) [128Ki]\n"
+               "  -p, --page-file=<file>     keep the unpacked maps in <file>\n"
+               "  -r, --random-ops=<n>       compare packed and unpacked maps on random ops\n"
+               "\nNumbers may be followed by a multiplier: k = 1000, Ki = 1024,\n"
+               "M = 10^6, Mi = 2^20, etc...\n" );
+  }
+
+
+long long getnum( const char * const ptr, const long long min,
+                  const long long max )
+  {
+  char * tail;
+  errno = 0;
+  long long result = strtoll( ptr, &tail, 0 );
+  if( tail == ptr )
+    {
+    show_error( "Bad or missing numerical argument.", 0, true );
+    std::exit( 1 );
+    }
+  if( !errno && tail[0] )
+    {
+    const int factor = ( tail[1] == 'i' ) ? 1024 : 1000;
+    int exponent = 0;
+    switch( tail[0] )
+      {
+      case 'G': exponent = 3; break;
+      case 'M': exponent = 2; break;
+      case 'K': if( factor == 1024 ) exponent = 1; break;
+      case 'k': if( factor == 1000 ) exponent = 1; break;
+      }
+    if( exponent == 0 || ( factor == 1024 && tail[2] ) ||
+        ( factor == 1000 && tail[1] ) )
+      {
+      show_error( "Bad multiplier in numerical argument.", 0, true );
+      std::exit( 1 );
+      }
+    for( int i = 0; i < exponent; ++i )
+      {
+      if( LLONG_MAX / factor >= llabs( result ) ) result *= factor;
+      else { errno = ERANGE; break; }
+      }
+    }
+  if( !errno && ( result < min || result > max ) ) errno = ERANGE;
+  if( errno )
+    {
+    show_error( "Numerical argument out of limits." );
+    std::exit( 1 );
+    }
+  return result;
+  }
+
+
+double now()
+  {
+  struct timeval tv;
+  gettimeofday( &tv, 0 );
+  return tv.tv_sec + tv.tv_usec / 1e6;
+  }
+
+
+// Map being benchmarked. Packs itself every 'pack_interval' changes, as
+// Mapbook::update_mapfile does when writing the mapfile.
+//
+struct Bench_map
+  {
+  enum { pack_interval = 1 << 16 };
+  Mapfile mapfile;
+  const Domain & domain;
+  const int hardbs;
+  const bool packing;
+  long changes;
+  long errors;
+  double seconds;
+
+  Bench_map( const Domain & d, const long long size, const int hbs,
+             const bool p, const char * const pagename,
+             const long long page_cache_size )
+    : mapfile( 0 ), domain( d ), hardbs( hbs ), packing( p ),
+      changes( 0 ), errors( 0 ), seconds( 0 )
+    {
+    if( pagename && !mapfile.use_page_file( pagename, page_cache_size ) )
+      { show_error( "Can't create page file", errno ); std::exit( 1 ); }
+    mapfile.set_to_status( Sblock::non_tried );
+    mapfile.truncate_vector( size, true );
+    }
+
+  void change( const Block & b, const Sblock::Status st )
+    {
+    errors += mapfile.change_chunk_status( b, st, domain );
+    if( packing && ++changes % pack_interval == 0 )
+      mapfile.pack_sblocks( domain, hardbs );
+    }
+  };
+
+
+// The damaged half of the map: odd sectors in every other area of 4096
+// sectors are bad.
+//
+bool bad_sector( const Bench_map & map, const long long pos )
+  {
+  const long long sector = pos / map.hardbs;
+  return ( sector % 2 == 1 && ( sector / 4096 ) % 2 == 1 );
+  }
+
+
+// Copying pass: reads clusters of 128 sectors. Clusters containing bad
+// sectors become non-trimmed.
+//
+void copy_pass( Bench_map & map )
+  {
+  const double t0 = now();
+  long long pos = 0;
+  while( true )
+    {
+    Block b( pos, 128 * map.hardbs );
+    map.mapfile.find_chunk( b, Sblock::non_tried, map.domain, map.hardbs );
+    if( b.size() <= 0 ) break;
+    pos = b.end();
+    bool error = false;
+    for( long long p = b.pos(); p < b.end() && !error; p += map.hardbs )
+      error = bad_sector( map, p );
+    map.change( b, error ? Sblock::non_trimmed : Sblock::finished );
+    }
+  if( map.packing ) map.mapfile.pack_sblocks( map.domain, map.hardbs );
+  map.seconds = now() - t0;
+  }
+
+
+// Trimming pass: reads each non-trimmed block one sector at a time from
+// both edges up to the first bad sector, leaving the rest non-scraped.
+//
+void trim_pass( Bench_map & map )
+  {
+  const double t0 = now();
+  long long pos = 0;
+  while( true )
+    {
+    Block b( pos, LLONG_MAX );
+    map.mapfile.find_chunk( b, Sblock::non_trimmed, map.domain, map.hardbs );
+    if( b.size() <= 0 ) break;
+    pos = b.end();
+    long long begin = b.pos(), end = b.end();
+    for( ; begin < end; begin += map.hardbs )
+      {
+      const bool error = bad_sector( map, begin );
+      map.change( Block( begin, map.hardbs ),
+                  error ? Sblock::bad_sector : Sblock::finished );
+      if( error ) { begin += map.hardbs; break; }
+      }
+    for( ; begin < end; end -= map.hardbs )
+      {
+      const bool error = bad_sector( map, end - map.hardbs );
+      map.change( Block( end - map.hardbs, map.hardbs ),
+                  error ? Sblock::bad_sector : Sblock::finished );
+      if( error ) { end -= map.hardbs; break; }
+      }
+    if( begin < end )
+      map.change( Block( begin, end - begin ), Sblock::non_scraped );
+    }
+  if( map.packing ) map.mapfile.pack_sblocks( map.domain, map.hardbs );
+  map.seconds = now() - t0;
+  }
+
+
+// Scraping pass: reads each non-scraped block one sector at a time.
+//
+void scrape_pass( Bench_map & map )
+  {
+  const double t0 = now();
+  long long pos = 0;
+  while( true )
+    {
+    Block b( pos, LLONG_MAX );
+    map.mapfile.find_chunk( b, Sblock::non_scraped, map.domain, map.hardbs );
+    if( b.size() <= 0 ) break;
+    pos = b.end();
+    for( long long p = b.pos(); p < b.end(); p += map.hardbs )
+      map.change( Block( p, map.hardbs ), bad_sector( map, p ) ?
+                  Sblock::bad_sector : Sblock::finished );
+    }
+  if( map.packing ) map.mapfile.pack_sblocks( map.domain, map.hardbs );
+  map.seconds = now() - t0;
+  }
+
+
+// Retry pass: one half of the bad sectors are read successfully.
+//
+void retry_pass( Bench_map & map )
+  {
+  const double t0 = now();
+  long long pos = 0;
+  while( true )
+    {
+    Block b( pos, map.hardbs );
+    map.mapfile.find_chunk( b, Sblock::bad_sector, map.domain, map.hardbs );
+    if( b.size() <= 0 ) break;
+    pos = b.end();
+    if( ( b.pos() / map.hardbs ) % 4 == 1 ) map.change( b, Sblock::finished );
+    }
+  if( map.packing ) map.mapfile.pack_sblocks( map.domain, map.hardbs );
+  map.seconds = now() - t0;
+  }
+
+
+bool same_map( const Mapfile & m1, const Mapfile & m2 )
+  {
+  const long long end = m1.extent().end();
+  if( m1.extent() != m2.extent() ) return false;
+  for( long long pos = m1.extent().pos(); pos < end; )
+    {
+    const Sblock sb1 = m1.sblock_at( pos ), sb2 = m2.sblock_at( pos );
+    // runs may be split differently at the borders of packed areas
+    if( sb1.status() != sb2.status() || sb1.size() <= 0 || sb2.size() <= 0 )
+      return false;
+    pos = std::min( sb1.end(), sb2.end() );
+    }
+  return true;
+  }
+
+
+void show_results( const char * const pass, const Bench_map & map1,
+                   const Bench_map & map2 )
+  {
+  std::printf( "%-12s %10.3f s %11lld %10.3f s %11lld\n", pass,
+               map1.seconds, map1.mapfile.memory_size(),
+               map2.seconds, map2.mapfile.memory_size() );
+  }
+
+
+// Returns true if a measurement started at 't0' has run for long enough.
+// Checked every 16 operations to keep the cost of now() low.
+//
+bool time_out( const int i, const double t0 )
+  { return ( i > 0 && i % 16 == 0 && now() - t0 > 0.25 ); }
+
+
+uint64_t random_state = 1;
+
+uint64_t random_num( const uint64_t limit )	// uniform in [0,limit)
+  {
+  random_state = random_state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return ( random_state >> 1 ) % limit;
+  }
+
+
+const Sblock::Status statuses[] =
+  { Sblock::non_tried, Sblock::non_trimmed, Sblock::non_scraped,
+    Sblock::bad_sector, Sblock::finished };
+
+enum Map_kind { clean, striped, random_map };
+const char * const kind_name[] = { "clean", "striped", "random" };
+
+
+// Builds a map of 'entries' blocks. Clean maps have long finished areas
+// separated by single bad sectors, striped maps alternate finished and
+// bad sectors, and random maps have blocks of random size and status.
+//
+void build_map( Mapfile & mapfile, const Map_kind kind, const long entries,
+                const int hardbs )
+  {
+  const Domain domain( 0, -1 );
+  long long pos = 0;
+  Sblock::Status st = Sblock::non_tried;
+  mapfile.set_to_status( st );
+  for( long i = 0; i < entries; ++i )
+    {
+    long long sectors = 1;
+    if( kind == random_map )
+      {
+      sectors += random_num( 64 );
+      const Sblock::Status prev = st;
+      do st = statuses[random_num( 5 )]; while( st == prev );
+      }
+    else
+      {
+      st = ( i % 2 ) ? Sblock::bad_sector : Sblock::finished;
+      if( kind == clean && st == Sblock::finished ) sectors = 2047;
+      }
+    mapfile.change_chunk_status( Block( pos, sectors * hardbs ), st, domain );
+    pos += sectors * hardbs;
+    }
+  mapfile.truncate_vector( pos, true );
+  }
+
+
+// Times each map operation on maps of each kind and of 1000, 10000, ...
+// up to 'max_entries' entries. Operations on the whole map (split,
+// compact, write, read) are timed per entry. Repeated operations stop
+// after a quarter of second, so that the slow ones don't take forever.
+//
+bool run_suite( const long max_entries, const int hardbs,
+                const char * const mapname, const char * const pagename,
+                const long long page_cache_size )
+  {
+  enum { ops = 1 << 16 };
+  const Domain domain( 0, -1 );
+  std::printf( "Map operations: ns per call "
+               "(split, compact, write, read: ns per entry)\n\n" );
+  std::printf( "%-8s %10s %11s %7s %7s %7s %7s %7s %7s %7s %7s\n", "map",
+               "entries", "bytes", "index", "find", "rfind", "change",
+               "split", "compact", "write", "read" );
+  for( long entries = 1000; entries <= max_entries; )
+    {
+    for( int kind = clean; kind <= random_map; ++kind )
+      {
+      double ns[8];
+      int k = 0;
+      random_state = 1;
+      Mapfile mapfile( mapname );
+      if( pagename && !mapfile.use_page_file( pagename, page_cache_size ) )
+        { show_error( "Can't create page file", errno ); std::exit( 1 ); }
+      build_map( mapfile, Map_kind( kind ), entries, hardbs );
+      const long long bytes = mapfile.memory_size();
+      const long long end = mapfile.extent().end();
+
+      int i;
+      double t0 = now();
+      for( i = 0; i < ops && !time_out( i, t0 ); ++i )
+        mapfile.find_index( random_num( end ) );
+      ns[k++] = ( now() - t0 ) * 1e9 / i;
+
+      t0 = now();
+      long long pos = 0;
+      for( i = 0; i < ops && !time_out( i, t0 ); ++i )
+        {
+        Block b( pos, 16 * hardbs );
+        mapfile.find_chunk( b, Sblock::bad_sector, domain, hardbs );
+        pos = ( b.size() > 0 ) ? b.end() : 0;
+        }
+      ns[k++] = ( now() - t0 ) * 1e9 / i;
+
+      t0 = now();
+      pos = end;
+      for( i = 0; i < ops && !time_out( i, t0 ); ++i )
+        {
+        Block b( pos - 16 * hardbs, 16 * hardbs );
+        mapfile.rfind_chunk( b, Sblock::bad_sector, domain, hardbs );
+        pos = ( b.size() > 0 ) ? b.pos() : end;
+        }
+      ns[k++] = ( now() - t0 ) * 1e9 / i;
+
+      t0 = now();
+      for( i = 0; i < ops && !time_out( i, t0 ); ++i )
+        mapfile.change_chunk_status(
+          Block( random_num( end / hardbs ) * hardbs, hardbs ),
+          statuses[random_num( 5 )], domain );
+      ns[k++] = ( now() - t0 ) * 1e9 / i;
+
+      const long n = mapfile.sblocks();
+      t0 = now();
+      mapfile.split_by_domain_borders( Domain( end / 4, end / 2 ) );
+      ns[k++] = ( now() - t0 ) * 1e9 / n;
+
+      t0 = now();
+      mapfile.compact_sblock_vector();
+      ns[k++] = ( now() - t0 ) * 1e9 / n;
+
+      t0 = now();
+      if( !mapfile.write_mapfile() )
+        { show_error( "Can't write mapfile", errno ); return false; }
+      ns[k++] = ( now() - t0 ) * 1e9 / n;
+
+      Mapfile mapfile2( mapname );
+      if( pagename && !mapfile2.use_page_file( pagename, page_cache_size ) )
+        { show_error( "Can't create page file", errno ); std::exit( 1 ); }
+      t0 = now();
+      if( !mapfile2.read_mapfile() )
+        { show_error( "Can't read mapfile", errno ); return false; }
+      ns[k++] = ( now() - t0 ) * 1e9 / n;
+
+      std::printf( "%-8s %10ld %11lld", kind_name[kind], entries, bytes );
+      for( i = 0; i < k; ++i ) std::printf( " %7.1f", ns[i] );
+      std::fputc( '\n', stdout );
+      std::fflush( stdout );
+      }
+    if( entries > max_entries / 10 ) break;
+    entries *= 10;
+    }
+  std::remove( mapname );
+  std::fputc( '\n', stdout );
+  return true;
+  }
+
+
+// Performs 'ops' random finds and changes on two copies of a random map,
+// packing one of them now and then, and compares the chunks found, the
+// error counts and the resulting maps. Changes are made on chunks found
+// by find_chunk or rfind_chunk, as ddrescue does, so that they may span
+// the borders of packed areas.
+//
+bool compare_random_ops( const long ops, const int hardbs )
+  {
+  const Domain domain( 0, -1 );
+  random_state = 1;
+  Mapfile map1( 0 ), map2( 0 );
+  map1.set_to_status( Sblock::non_tried );
+  map2.set_to_status( Sblock::non_tried );
+  long long end = 0;
+  for( long i = 0; i < 20000; ++i )	// mostly short runs, to be packed
+    {
+    const Block b( end,
+                   ( 1 + random_num( random_num( 32 ) ? 4 : 256 ) ) * hardbs );
+    const Sblock::Status st = statuses[random_num( 5 )];
+    map1.change_chunk_status( b, st, domain );
+    map2.change_chunk_status( b, st, domain );
+    end = b.end();
+    }
+  map1.truncate_vector( end, true );
+  map2.truncate_vector( end, true );
+  map2.pack_sblocks( domain, hardbs );
+  long errors1 = 0, errors2 = 0;
+  for( long i = 0; i < ops; ++i )
+    {
+    const Sblock::Status st = statuses[random_num( 5 )];
+    const long long pos = random_num( end / hardbs ) * hardbs;
+    const long long size =
+      ( 1 + random_num( random_num( 8 ) ? 16 : 256 ) ) * hardbs;
+    Block b1( pos, size ), b2( pos, size );
+    if( random_num( 2 ) )
+      { map1.find_chunk( b1, st, domain, hardbs );
+        map2.find_chunk( b2, st, domain, hardbs ); }
+    else
+      { map1.rfind_chunk( b1, st, domain, hardbs );
+        map2.rfind_chunk( b2, st, domain, hardbs ); }
+    if( b1 != b2 )
+      {
+      std::fprintf( stderr,
+                    "%s: chunks differ at op %ld: %lld %lld, %lld %lld\n",
+                    program_name, i, b1.pos(), b1.size(), b2.pos(), b2.size() );
+      return false;
+      }
+    if( b1.size() <= 0 ) continue;
+    if( random_num( 2 ) )		// change a part of the chunk
+      {
+      const long long sectors = b1.size() / hardbs;
+      if( sectors > 1 )
+        {
+        const long long first = random_num( sectors );
+        b1.assign( b1.pos() + first * hardbs,
+                   ( 1 + random_num( sectors - first ) ) * hardbs );
+        }
+      }
+    const Sblock::Status new_st = statuses[random_num( 5 )];
+    errors1 += map1.change_chunk_status( b1, new_st, domain );
+    errors2 += map2.change_chunk_status( b1, new_st, domain );
+    if( i % 100 == 99 ) map2.pack_sblocks( domain, hardbs );
+    }
+  if( errors1 != errors2 || !same_map( map1, map2 ) )
+    { show_error( "Packed and unpacked maps differ." ); return false; }
+  return true;
+  }
+
+} // end namespace
+
+
+#include "error_common.cc"
+
+
+// Required by mapfile.cc
+//
+bool write_file_header( FILE * const f, const char * const filetype )
+  { return ( std::fprintf( f, "# %s. Created by %s\n",
+                           filetype, program_name ) >= 0 ); }
+
+
+bool write_timestamp( FILE * const ) { return true; }
+
+
+int main( const int argc, const char * const argv[] )
+  {
+  const char * mapname = "mapbench.map";
+  const char * pagename = 0;
+  long long page_cache_size = 1 << 20;
+  long max_entries = 1000000;
+  int hardbs = 512;
+  long long sectors = 1 << 17;
+  long random_ops = 0;
+  invocation_name = argv[0];
+
+  const Arg_parser::Option options[] =
+    {
+    { 'b', "sector-size", Arg_parser::yes },
+    { 'c', "page-cache",  Arg_parser::yes },
+    { 'f', "map-file",    Arg_parser::yes },
+    { 'h', "help",        Arg_parser::no  },
+    { 'm', "max-entries", Arg_parser::yes },
+    { 'n', "sectors",     Arg_parser::yes },
+    { 'p', "page-file",   Arg_parser::yes },
+    { 'r', "random-ops",  Arg_parser::yes },
+    {  0 , 0,             Arg_parser::no  } };
+
+  const Arg_parser parser( argc, argv, options );
+  if( parser.error().size() )				// bad option
+    { show_error( parser.error().c_str(), 0, true ); return 1; }
+
+  for( int argind = 0; argind < parser.arguments(); ++argind )
+    {
+    const int code = parser.code( argind );
+    if( !code ) { show_error( "Too many arguments.", 0, true ); return 1; }
+    const std::string & sarg = parser.argument( argind );
+    const char * const arg = sarg.c_str();
+    switch( code )
+      {
+      case 'b': hardbs = getnum( arg, 1, INT_MAX ); break;
+      case 'c': page_cache_size = getnum( arg, 1, LLONG_MAX ); break;
+      case 'f': mapname = arg; break;
+      case 'h': show_help(); return 0;
+      case 'm': max_entries = getnum( arg, 0, LONG_MAX / 10 ); break;
+      case 'n': sectors = getnum( arg, 0, LLONG_MAX / 65536 ); break;
+      case 'p': pagename = arg; break;
+      case 'r': random_ops = getnum( arg, 0, LONG_MAX ); break;
+      default : internal_error( "uncaught option." );
+      }
+    } // end process options
+
+  if( random_ops > 0 && !compare_random_ops( random_ops, hardbs ) ) return 3;
+  if( max_entries > 0 &&
+      !run_suite( max_entries, hardbs, mapname, pagename, page_cache_size ) )
+    return 1;
+  if( sectors <= 0 ) return 0;
+
+  const Domain domain( 0, -1 );
+  Bench_map map1( domain, sectors * hardbs, hardbs, false, pagename,
+                  page_cache_size );
+  Bench_map map2( domain, sectors * hardbs, hardbs, true, 0, 0 );
+
+  std::printf( "Map of %lld sectors of %d bytes, "
+               "one half striped with bad sectors\n\n", sectors, hardbs );
+  std::printf( "%-12s %12s %11s %12s %11s\n", "pass",
+               pagename ? "paged" : "run-length",
+               "bytes", "packed", "bytes" );
+  copy_pass( map1 ); copy_pass( map2 );
+  show_results( "copy", map1, map2 );
+  trim_pass( map1 ); trim_pass( map2 );
+  show_results( "trim", map1, map2 );
+  scrape_pass( map1 ); scrape_pass( map2 );
+  show_results( "scrape", map1, map2 );
+  retry_pass( map1 ); retry_pass( map2 );
+  show_results( "retry", map1, map2 );
+
+  if( map1.errors != map2.errors || !same_map( map1.mapfile, map2.mapfile ) )
+    { show_error( "Packed and unpacked maps differ." ); return 3; }
+  return 0;
+  }
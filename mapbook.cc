@@ -22,12 +22,14 @@
 #include <climits>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <string>
 #include <vector>
 #include <stdint.h>
 #include <termios.h>
 #include <unistd.h>
+#include <sys/mman.h>
 
 #include "block.h"
 #include "mapbook.h"
@@ -35,6 +37,17 @@
 
 namespace {
 
+// Returns the alignment of the I/O buffers for direct disc access,
+// usually the page size.
+long io_alignment( const int hardbs )
+  {
+  long alignment = sysconf( _SC_PAGESIZE );
+  if( alignment < hardbs || alignment % hardbs ) alignment = hardbs;
+  if( alignment < 2 || alignment > 1 << 20 ) alignment = 1;
+  return alignment;
+  }
+
+
 void input_pos_error( const long long pos, const long long isize )
   {
   char buf[128];
@@ -84,35 +97,93 @@ bool Mapbook::emergency_save()
   }
 
 
+Io_arena::Io_arena( const long size, const int buffers, const long alignment )
+  : alignment_( alignment ), capacity( size + buffers * alignment ),
+    map_base( 0 ), map_size( 0 ), base( 0 ), used( 0 ), huge_pages_( false )
+  {
+  const long huge_page_size = 2 << 20;
+  if( capacity >= huge_page_size )	// worth a huge page
+    {
+    map_size = ( ( capacity + huge_page_size - 1 ) / huge_page_size ) *
+               huge_page_size;
+    void * p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    p = mmap( 0, map_size, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+    if( p != MAP_FAILED ) { huge_pages_ = true; base = (uint8_t *)p; }
+#endif
+    if( p == MAP_FAILED )	// reserve room to align to a huge page
+      {
+      map_size += huge_page_size;
+      p = mmap( 0, map_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+      if( p != MAP_FAILED )
+        {
+        base = (uint8_t *)p;
+        const long disp = reinterpret_cast<unsigned long> (base) % huge_page_size;
+        if( disp ) base += huge_page_size - disp;
+#ifdef MADV_HUGEPAGE
+        if( madvise( base, capacity, MADV_HUGEPAGE ) == 0 ) huge_pages_ = true;
+#endif
+        }
+      }
+    if( p != MAP_FAILED ) map_base = (uint8_t *)p; else map_size = 0;
+    }
+  if( !base ) base = new uint8_t[capacity];
+  }
+
+
+Io_arena::~Io_arena()
+  { if( map_base ) munmap( map_base, map_size ); else delete[] base; }
+
+
+// Returns a buffer of 'size' bytes aligned to 'alignment'.
+// The arena must have been created big enough for all the buffers.
+//
+uint8_t * Io_arena::get( const long size )
+  {
+  uint8_t * p = base + used;
+  const long disp = reinterpret_cast<unsigned long> (p) % alignment_;
+  if( disp ) p += alignment_ - disp;
+  if( p + size > base + capacity ) internal_error( "I/O arena exhausted." );
+  used = ( p + size ) - base;
+  return p;
+  }
+
+
 Mapbook::Mapbook( const long long offset, const long long isize,
                   Domain & dom, const char * const mapname,
                   const int cluster, const int hardbs,
-                  const bool complete_only )
+                  const bool complete_only, const char * const pagename,
+                  const long long page_cache_size, const bool second_buffer )
   : Mapfile( mapname ), offset_( offset ), mapfile_isize_( 0 ),
     domain_( dom ), hardbs_( hardbs ), softbs_( cluster * hardbs_ ),
     iobuf_size_( softbs_ + hardbs_ ),	// +hardbs for direct unaligned reads
-    final_errno_( 0 ), um_t1( 0 ), um_t1s( 0 ), mapfile_exists_( false )
+    arena( iobuf_size_ + 2 * hardbs_ + ( second_buffer ? softbs_ : 0 ), 4,
+           io_alignment( hardbs_ ) ),
+    iobuf_( arena.get( iobuf_size_ ) ),
+    iobuf_aux_( arena.get( hardbs_ ) ),
+    iobuf_voe_( arena.get( hardbs_ ) ),
+    iobuf2_( second_buffer ? arena.get( softbs_ ) : 0 ),
+    final_errno_( 0 ), um_t1( 0 ), um_t1s( 0 ), um_count( 0 ),
+    um_total( 0 ), um_max( 0 ), mapfile_exists_( false ), packing_( false )
   {
-  long alignment = sysconf( _SC_PAGESIZE );
-  if( alignment < hardbs_ || alignment % hardbs_ ) alignment = hardbs_;
-  if( alignment < 2 || alignment > 1 << 20 ) alignment = 0;
-  iobuf_ = iobuf_base = new uint8_t[ alignment + iobuf_size_ + hardbs_ ];
-  if( alignment > 1 )		// align iobuf for direct disc access
-    {
-    const int disp =
-      alignment - ( reinterpret_cast<unsigned long long> (iobuf_) % alignment );
-    if( disp > 0 && disp < alignment ) iobuf_ += disp;
-    }
-
   if( isize > 0 )
     {
     if( domain_.pos() >= isize )
       { input_pos_error( domain_.pos(), isize ); std::exit( 1 ); }
     domain_.crop_by_file_size( isize );
     }
+  if( pagename && !use_page_file( pagename, page_cache_size ) )
+    {
+    char buf[80];
+    snprintf( buf, sizeof buf, "Can't create page file '%s'", pagename );
+    show_error( buf, errno );
+    std::exit( 1 );
+    }
   if( filename() )
     {
-    mapfile_exists_ = read_mapfile( 0, false );
+    mapfile_exists_ = read_mapfile( 0, false, &mapfile_summary_ );
     if( mapfile_exists_ ) mapfile_isize_ = extent().end();
     }
   if( !complete_only ) extend_sblock_vector( isize );
@@ -130,18 +201,25 @@ bool Mapbook::update_mapfile( const int odes, const bool force )
   {
   if( !filename() ) return true;
   const int interval = 30 + std::min( 270L, sblocks() / 38 );	// 30s to 5m
-  const long t2 = std::time( 0 );
+  const long t2 = current_time();
   if( um_t1 == 0 || um_t1 > t2 ) um_t1 = um_t1s = t2;	// initialize
   if( !force && t2 - um_t1 < interval ) return true;
   um_t1 = t2;
   const bool mf_sync = ( force || t2 - um_t1s >= 300 );	// fsync mf every 5m
   if( mf_sync ) um_t1s = t2;
+  const double t0 = precise_time();		// time the rescue is stalled
   if( odes >= 0 ) fsync( odes );
+  if( packing_ ) pack_sblocks( domain_, hardbs_ );
 
   while( true )
     {
     errno = 0;
-    if( write_mapfile( 0, true, mf_sync ) ) return true;
+    if( write_mapfile( 0, true, mf_sync ) )
+      {
+      const double t = precise_time() - t0;
+      ++um_count; um_total += t; if( um_max < t ) um_max = t;
+      return true;
+      }
     if( verbosity < 0 ) return false;
     const int saved_errno = errno;
     std::fputc( '\n', stderr );
@@ -22,18 +22,51 @@ extern "C" {
 #endif
 
 
+// Memory for the I/O buffers, allocated once and handed out in pieces
+// aligned to 'alignment'. Large arenas are backed by huge pages if the
+// system provides them (MAP_HUGETLB, or transparent huge pages).
+class Io_arena
+  {
+  const long alignment_;
+  const long capacity;
+  uint8_t * map_base;			// mmapped memory, or 0 if new[]
+  long map_size;
+  uint8_t * base;
+  long used;
+  bool huge_pages_;
+
+  Io_arena( const Io_arena & );		// declared as private
+  void operator=( const Io_arena & );	// declared as private
+
+public:
+  Io_arena( const long size, const int buffers, const long alignment );
+  ~Io_arena();
+
+  uint8_t * get( const long size );
+  bool huge_pages() const { return huge_pages_; }
+  };
+
+
 class Mapbook : public Mapfile
   {
   const long long offset_;		// outfile offset (opos - ipos);
   long long mapfile_isize_;
   Domain & domain_;			// rescue domain
-  uint8_t *iobuf_base, *iobuf_;		// iobuf is aligned to page and hardbs
   const int hardbs_, softbs_;
   const int iobuf_size_;
+  Io_arena arena;			// aligned to page and hardbs
+  uint8_t * const iobuf_;
+  uint8_t * const iobuf_aux_;
+  uint8_t * const iobuf_voe_;
+  uint8_t * const iobuf2_;
   std::string final_msg_;
   int final_errno_;
   long um_t1, um_t1s;			// variables for update_mapfile
+  long um_count;			// mapfile updates done
+  double um_total, um_max;		// total and longest update times
+  Map_summary mapfile_summary_;		// totals of the mapfile read
   bool mapfile_exists_;
+  bool packing_;			// pack fragmented areas of the map
 
   bool save_mapfile( const char * const name );
   bool emergency_save();
@@ -44,15 +77,22 @@ class Mapbook : public Mapfile
 public:
   Mapbook( const long long offset, const long long isize,
            Domain & dom, const char * const mapname,
-           const int cluster, const int hardbs, const bool complete_only );
-  ~Mapbook() { delete[] iobuf_base; }
+           const int cluster, const int hardbs, const bool complete_only,
+           const char * const pagename = 0,
+           const long long page_cache_size = 0,
+           const bool second_buffer = false );
 
   bool update_mapfile( const int odes = -1, const bool force = false );
 
   const Domain & domain() const { return domain_; }
   uint8_t * iobuf() const { return iobuf_; }
   uint8_t * iobuf_aux() const	// hardbs-sized buffer for verify_on_error
-    { return iobuf_ + iobuf_size_; }
+    { return iobuf_aux_; }
+  uint8_t * iobuf_voe() const	// hardbs-sized, last good sector read
+    { return iobuf_voe_; }
+  uint8_t * iobuf2() const	// softbs-sized, if second_buffer
+    { return iobuf2_; }
+  bool huge_pages() const { return arena.huge_pages(); }
   int iobuf_size() const { return iobuf_size_; }
   int hardbs() const { return hardbs_; }
   int softbs() const { return softbs_; }
@@ -60,10 +100,17 @@ public:
   const std::string & final_msg() const { return final_msg_; }
   int final_errno() const { return final_errno_; }
   bool mapfile_exists() const { return mapfile_exists_; }
+  const Map_summary & mapfile_summary() const { return mapfile_summary_; }
   long long mapfile_isize() const { return mapfile_isize_; }
+  long mapfile_updates() const { return um_count; }
+  double update_time() const { return um_total; }
+  double max_update_time() const { return um_max; }
 
   void final_msg( const std::string & msg, const int e = 0 )
     { final_msg_ = msg; final_errno_ = e; }
+  // Packing is only safe if sblocks are not accessed by index while
+  // rescuing, because it changes the indices of the sblocks.
+  void packing( const bool p ) { packing_ = p; }
 
   void truncate_domain( const long long end )
     { domain_.crop_by_file_size( end ); }
@@ -122,9 +169,16 @@ public:
   };
 
 
+// Writes the position, sector number and status of each sector of 'sb'
+// at the beginning of the corresponding sector in 'buf'.
+void write_location_data( uint8_t * const buf, const Sblock & sb,
+                          const int hardbs );
+
+
 class Genbook : public Mapbook
   {
   long long finished_size, gensize;	// total recovered and generated sizes
+  int ides_;				// input file descriptor, if comparing
   int odes_;				// output file descriptor
 					// variables for show_status
   long long a_rate, c_rate, first_size, last_size;
@@ -133,26 +187,30 @@ class Genbook : public Mapbook
   int oldlen;
 
   void check_block( const Block & b, int & copied_size, int & error_size );
+  void compare_block( const Block & b, int & copied_size, int & error_size );
   int check_all();
   void show_status( const long long ipos, const char * const msg = 0,
                     bool force = false );
 public:
   Genbook( const long long offset, const long long isize,
            Domain & dom, const char * const mapname,
-           const int cluster, const int hardbs )
-    : Mapbook( offset, isize, dom, mapname, cluster, hardbs, false ),
+           const int cluster, const int hardbs, const bool compare = false )
+    : Mapbook( offset, isize, dom, mapname, cluster, hardbs, false, 0, 0,
+               compare ),
       a_rate( 0 ), c_rate( 0 ), first_size( 0 ), last_size( 0 ),
       last_ipos( 0 ), t0( 0 ), t1( 0 ), oldlen( 0 )
       {}
 
-  int do_generate( const int odes );
+  int do_generate( const int odes, const int ides = -1 );
   };
 
 
+// Comparing the block with itself shifted by one byte lets memcmp use
+// its vectorized loop, which is much faster than testing byte by byte.
 inline bool block_is_zero( const uint8_t * const buf, const int size )
   {
-  for( int i = 0; i < size; ++i ) if( buf[i] != 0 ) return false;
-  return true;
+  return size <= 0 ||
+         ( buf[0] == 0 && std::memcmp( buf, buf + 1, size - 1 ) == 0 );
   }
 
 
@@ -170,6 +228,37 @@ int readblock_dvdread( dvd_reader_t *dvd, uint32_t dvd_blocks, uint8_t * const b
 #endif
 int writeblock( const int fd, const uint8_t * const buf, const int size,
                 const long long pos );
+
+// Input file read through a window mapped in memory. The data are used
+// in place, without copying them to iobuf. A page that can't be read
+// gives a short read with errno set, like readblock. Later uses of the
+// data must be made through 'guard', because a page may fail again.
+class Mapped_input
+  {
+  enum { window_size = 64 << 20 };
+  const int fd_;
+  const long long isize_;
+  uint8_t * window;
+  long long wpos;			// position of window in input file
+  long wsize;
+  long long last_pos;			// to follow the direction of the pass
+  bool forward;
+
+  Mapped_input( const Mapped_input & );		// declared as private
+  void operator=( const Mapped_input & );	// declared as private
+
+  bool map_window( const long long pos, const int size );
+
+public:
+  explicit Mapped_input( const int fd );
+  ~Mapped_input();
+
+  static bool can_map( const int fd );
+  const uint8_t * read( const long long pos, const int size,
+                        int & copied_size );
+  static const uint8_t * guard( void (*fn)( void * ), void * const arg );
+  };
+
 bool interrupted();
 void set_signals();
 int signaled_exit();
@@ -25,6 +25,7 @@
 #include <cstring>
 #include <string>
 #include <vector>
+#include <stdint.h>
 #include <unistd.h>
 
 #include "block.h"
@@ -68,6 +69,31 @@ const char * my_fgets( FILE * const f, int & linenum )
   }
 
 
+// Parses the status line "current_pos current_status [current_pass
+// [state]]", where 'state' is the rest of the line. Mapfiles written by
+// versions not saving the pass resume from pass 1.
+//
+bool parse_status_line( const char * const line, long long & pos, char & ch,
+                        int & pass, std::string & state )
+  {
+  int len = 0;
+  if( std::sscanf( line, "%lli %c%n", &pos, &ch, &len ) != 2 || pos < 0 )
+    return false;
+  pass = 1; state.clear();
+  const char * p = line + len;
+  if( std::sscanf( p, "%d%n", &pass, &len ) == 1 )
+    {
+    if( pass < 1 ) return false;
+    p += len;
+    while( std::isspace( (unsigned char)*p ) ) ++p;
+    state = p;
+    while( state.size() && std::isspace( (unsigned char)state.end()[-1] ) )
+      state.erase( state.size() - 1 );
+    }
+  return true;
+  }
+
+
 void show_mapfile_error( const char * const mapname, const int linenum )
   {
   char buf[80];
@@ -75,39 +101,332 @@ void show_mapfile_error( const char * const mapname, const int linenum )
   show_error( buf );
   }
 
+
+// Reports an error in a mapfile being read from 'f'. Exits with status 2
+// unless 'corruptp' is given, in which case closes 'f' and returns false.
+//
+bool corrupt_mapfile( const char * const mapname, const int linenum,
+                      FILE * const f, bool * const corruptp )
+  {
+  show_mapfile_error( mapname, linenum );
+  if( !corruptp ) std::exit( 2 );
+  if( f ) std::fclose( f );
+  *corruptp = true;
+  return false;
+  }
+
+
+uint32_t crc32( const char * const buf, const int size )
+  {
+  static uint32_t table[256];
+  static bool table_ready = false;
+  if( !table_ready )
+    {
+    for( unsigned n = 0; n < 256; ++n )
+      {
+      uint32_t c = n;
+      for( int k = 0; k < 8; ++k )
+        { if( c & 1 ) c = 0xEDB88320U ^ ( c >> 1 ); else c >>= 1; }
+      table[n] = c;
+      }
+    table_ready = true;
+    }
+  uint32_t crc = 0xFFFFFFFFU;
+  for( int i = 0; i < size; ++i )
+    crc = table[(crc ^ (uint8_t)buf[i]) & 0xFF] ^ ( crc >> 8 );
+  return crc ^ 0xFFFFFFFFU;
+  }
+
+
+// The summary is the last line of the mapfile. It is a comment, so it
+// is ignored by read_mapfile. 'offset' is the position of the summary
+// line in the mapfile, so that any change in the size of the mapfile
+// invalidates the summary. The current status and pass must match those
+// of the status line.
+//
+const char * const summary_format =
+  "# Summary: extent 0x%08llX 0x%08llX areas %ld"
+  " ? 0x%08llX %ld * 0x%08llX %ld / 0x%08llX %ld - 0x%08llX %ld"
+  " + 0x%08llX %ld status %c pass %d offset 0x%08llX";
+const char * const summary_scan_format =
+  "# Summary: extent %lli %lli areas %li"
+  " ? %lli %li * %lli %li / %lli %li - %lli %li"
+  " + %lli %li status %c pass %d offset %lli%n crc %lx";
+enum { max_summary_len = 511 };
+
+
+bool write_summary( FILE * const f, const Map_summary & s,
+                    const char status, const int pass )
+  {
+  const long long offset = ftello( f );
+  if( offset < 0 ) return true;		// f is not seekable; no summary
+  char buf[max_summary_len+1];
+  const int len = snprintf( buf, sizeof buf, summary_format,
+    s.extent.pos(), s.extent.size(), s.areas, s.sizes[0], s.status_areas[0],
+    s.sizes[1], s.status_areas[1], s.sizes[2], s.status_areas[2],
+    s.sizes[3], s.status_areas[3], s.sizes[4], s.status_areas[4],
+    status, pass, offset );
+  if( len <= 0 || len + 16 >= (int)sizeof buf ) return false;
+  snprintf( buf + len, sizeof buf - len, " crc 0x%08lX\n",
+            (unsigned long)crc32( buf, len ) );
+  return ( std::fputs( buf, f ) >= 0 );
+  }
+
+
+bool parse_summary( const char * const line, const long long offset,
+                    const char status, const int pass, Map_summary & s )
+  {
+  long long pos, size, recorded_offset;
+  unsigned long crc;
+  int len = 0, recorded_pass;
+  char recorded_status;
+  const int n = std::sscanf( line, summary_scan_format, &pos, &size,
+    &s.areas, &s.sizes[0], &s.status_areas[0], &s.sizes[1], &s.status_areas[1],
+    &s.sizes[2], &s.status_areas[2], &s.sizes[3], &s.status_areas[3],
+    &s.sizes[4], &s.status_areas[4], &recorded_status, &recorded_pass,
+    &recorded_offset, &len, &crc );
+  if( n != 17 || len <= 0 || recorded_offset != offset ||
+      recorded_status != status || recorded_pass != pass ||
+      crc32( line, len ) != crc || pos < 0 || size < 0 ||
+      size > LLONG_MAX - pos ) return false;
+  long long total_size = 0;
+  long total_areas = 0;
+  for( int i = 0; i < Map_summary::statuses; ++i )
+    {
+    if( s.sizes[i] < 0 || s.status_areas[i] < 0 ) return false;
+    total_size += s.sizes[i]; total_areas += s.status_areas[i];
+    }
+  if( total_size != size || total_areas != s.areas ) return false;
+  s.extent.assign( pos, size );
+  return true;
+  }
+
+
+class Block_writer	// joins the runs of packed areas to adjacent blocks
+  {
+  FILE * const f;
+  Map_summary & summary;
+  Sblock last;				// block pending to be written
+  bool pending, last_packed;
+
+public:
+  Block_writer( FILE * const file, Map_summary & s )
+    : f( file ), summary( s ), last( 0, 0, Sblock::non_tried ),
+      pending( false ), last_packed( false ) {}
+
+  void put( const Sblock & sb, const bool sb_packed )
+    {
+    if( pending && ( sb_packed || last_packed ) && sb.status() == last.status() )
+      last.size( sb.end() - last.pos() );
+    else { flush(); last = sb; pending = true; }
+    last_packed = sb_packed;
+    }
+
+  void flush()
+    {
+    if( !pending ) return;
+    std::fprintf( f, "0x%08llX  0x%08llX  %c\n",
+                  last.pos(), last.size(), last.status() );
+    summary.add( last );
+    pending = false;
+    }
+  };
+
 } // end namespace
 
 
+// Returns the index in packed_areas of the area beginning at pos.
+//
+long Mapfile::area_index( const long long pos ) const
+  {
+  unsigned long l = 0, r = packed_areas.size();
+  while( l < r )
+    {
+    const long m = ( l + r ) / 2;
+    if( packed_areas[m].pos() < pos ) l = m + 1; else r = m;
+    }
+  if( l >= packed_areas.size() || packed_areas[l].pos() != pos )
+    internal_error( "packed area not found." );
+  return l;
+  }
+
+
+// Returns the status at pos of sblock i, which may be packed.
+//
+Sblock::Status Mapfile::status_at( const long i, const long long pos ) const
+  {
+  const Sblock & sb = sblock_vector[i];
+  if( !packed( sb ) ) return sb.status();
+  const Packed_area & pa = packed_areas[area_index( sb.pos() )];
+  return pa.status( pa.sector( pos ) );
+  }
+
+
+// Replaces the packed sblock i with the runs of its area.
+// Returns the number of sblocks now occupying the place of sblock i.
+//
+long Mapfile::unpack_sblock( const long i ) const
+  {
+  const long j = area_index( sblock_vector[i].pos() );
+  const Packed_area & pa = packed_areas[j];
+  std::vector< Sblock > runs;
+  for( long k = 0; k < pa.sectors(); )
+    {
+    const Sblock sb = pa.run( k );
+    runs.push_back( sb );
+    k = pa.sector( sb.end() );
+    }
+  sblock_vector.modify( i ) = runs[0];
+  sblock_vector.insert( i + 1, &runs[0] + 1, &runs[0] + runs.size() );
+  packed_areas.erase( packed_areas.begin() + j );
+  const long n = runs.size();
+  if( index_ > i ) index_ += n - 1;
+  return n;
+  }
+
+
+void Mapfile::unpack_all() const
+  {
+  for( long i = sblocks() - 1; i >= 0 && packed_areas.size(); --i )
+    if( packed( sblock_vector[i] ) ) unpack_sblock( i );
+  }
+
+
+// Erases sblock i and all the sblocks following it.
+//
+void Mapfile::erase_sblocks( const long i )
+  {
+  if( i >= sblocks() ) return;
+  const long long pos = sblock_vector[i].pos();
+  unsigned long j = packed_areas.size();
+  while( j > 0 && packed_areas[j-1].pos() >= pos ) --j;
+  packed_areas.erase( packed_areas.begin() + j, packed_areas.end() );
+  sblock_vector.erase( i, sblocks() );
+  }
+
+
+// Returns the sblock, or the run of equal status of a packed area,
+// containing pos. Returns a block of size 0 if pos is not in the map.
+//
+Sblock Mapfile::sblock_at( const long long pos ) const
+  {
+  if( sblock_vector.empty() || locate( pos ) < 0 )
+    return Sblock( pos, 0, Sblock::non_tried );
+  const Sblock & sb = sblock_vector[index_];
+  if( !packed( sb ) ) return sb;
+  const Packed_area & pa = packed_areas[area_index( sb.pos() )];
+  return pa.run( pa.sector( pos ) );
+  }
+
+
+// Replaces each sequence of at least 'min_runs' consecutive short blocks
+// aligned to hardbs and contained in a block of the domain by a packed
+// area, which is unpacked again when its runs become long.
+// Blocks shorter than 'max_run_sectors' use 8 times less memory packed.
+// Returns the number of sblocks removed.
+//
+long Mapfile::pack_sblocks( const Domain & domain, const int hardbs )
+  {
+  enum { min_runs = 64, max_run_sectors = 16, max_area_sectors = 32768 };
+  if( hardbs <= 0 ) return 0;
+  const long long max_run_size = (long long)max_run_sectors * hardbs;
+  const long size = sblocks();
+  std::vector< Packed_area > new_areas;
+  long r = 0, w = 0, next_area = 0;
+  long new_index = 0, j = 0;			// j = index of domain block
+
+  while( r < size )
+    {
+    long e = r;				// end of sequence
+    while( j < domain.blocks() && domain.block( j ) < sblock_vector[r] ) ++j;
+    if( j < domain.blocks() )
+      {
+      const Block & db = domain.block( j );
+      long sectors = 0;
+      for( ; e < size; ++e )
+        {
+        const Sblock & sb = sblock_vector[e];
+        if( packed( sb ) || sb.size() <= 0 || sb.size() > max_run_size ||
+            sb.pos() % hardbs != 0 || sb.size() % hardbs != 0 ||
+            !db.includes( sb ) ||
+            sectors + sb.size() / hardbs > max_area_sectors ) break;
+        sectors += sb.size() / hardbs;
+        }
+      }
+    if( e - r >= min_runs )
+      {
+      Packed_area pa( sblock_vector[r].pos(), hardbs );
+      for( long i = r; i < e; ++i ) pa.append( sblock_vector[i] );
+      if( index_ >= r && index_ < e ) new_index = w;
+      sblock_vector.modify( w++ ) =
+        Sblock( pa.pos(), pa.end() - pa.pos(), packed_status );
+      new_areas.push_back( pa );
+      r = e;
+      }
+    else
+      {
+      if( e == r ) ++e;				// copy at least one sblock
+      for( ; r < e; ++r )
+        {
+        if( packed( sblock_vector[r] ) )
+          new_areas.push_back( packed_areas[next_area++] );
+        if( index_ == r ) new_index = w;
+        const Sblock sb = sblock_vector[r];
+        sblock_vector.modify( w++ ) = sb;
+        }
+      }
+    }
+  sblock_vector.erase( w, size );
+  packed_areas.swap( new_areas );
+  index_ = new_index;
+  return size - w;
+  }
+
+
+long long Mapfile::memory_size() const
+  {
+  long long size = sizeof *this - sizeof sblock_vector +
+                   sblock_vector.memory_size() +
+                   ( packed_areas.capacity() - packed_areas.size() ) *
+                   sizeof( Packed_area );
+  for( unsigned long i = 0; i < packed_areas.size(); ++i )
+    size += packed_areas[i].memory_size();
+  return size;
+  }
+
+
 void Mapfile::compact_sblock_vector()
   {
-  std::vector< Sblock > new_vector;
-  unsigned long l = 0;
-  while( l < sblock_vector.size() )
+  const long size = sblocks();
+  long l = 0, w = 0;
+  while( l < size )
     {
     Sblock run = sblock_vector[l];
-    unsigned long r = l + 1;
-    while( r < sblock_vector.size() &&
-           sblock_vector[r].status() == run.status() ) ++r;
+    long r = l + 1;
+    if( !packed( run ) )		// packed sblocks are not joined
+      while( r < size && sblock_vector[r].status() == run.status() ) ++r;
     if( r > l + 1 ) run.size( sblock_vector[r-1].end() - run.pos() );
-    new_vector.push_back( run );
+    sblock_vector.modify( w++ ) = run;
     l = r;
     }
-  sblock_vector.swap( new_vector );
+  sblock_vector.erase( w, size );
   }
 
 
 void Mapfile::extend_sblock_vector( const long long isize )
   {
+  if( !sblock_vector.empty() && packed( sblock_vector.back() ) )
+    unpack_sblock( sblocks() - 1 );
   if( sblock_vector.empty() )
     {
     const Sblock sb( 0, ( isize > 0 ) ? isize : -1, Sblock::non_tried );
     sblock_vector.push_back( sb );
     return;
     }
-  Sblock & front = sblock_vector.front();
+  const Sblock front = sblock_vector.front();
   if( front.pos() > 0 )
-    sblock_vector.insert( sblock_vector.begin(), Sblock( 0, front.pos(), Sblock::non_tried ) );
-  Sblock & back = sblock_vector.back();
+    sblock_vector.insert( 0, Sblock( 0, front.pos(), Sblock::non_tried ) );
+  const Sblock back = sblock_vector.back();
   const long long end = back.end();
   if( isize > 0 )
     {
@@ -123,7 +442,8 @@ void Mapfile::extend_sblock_vector( const long long isize )
     if( end > isize )
       {
       if( back.status() != Sblock::finished )
-        { back.size( isize - back.pos() ); return; }
+        { sblock_vector.modify( sblocks() - 1 ).size( isize - back.pos() );
+          return; }
       show_error( "Rescued data in mapfile goes past end of input file.\n"
                   "          Use '-C' if you are reading from a partial copy.",
                   0, true );
@@ -145,25 +465,38 @@ void Mapfile::extend_sblock_vector( const long long isize )
 //
 bool Mapfile::truncate_vector( const long long end, const bool force )
   {
-  unsigned long i = sblock_vector.size();
+  long i = sblocks();
   while( i > 0 && sblock_vector[i-1].pos() >= end ) --i;
+  if( i > 0 && packed( sblock_vector[i-1] ) &&
+      sblock_vector[i-1].includes( end ) )
+    {
+    unpack_sblock( i - 1 );
+    i = sblocks();
+    while( i > 0 && sblock_vector[i-1].pos() >= end ) --i;
+    }
   if( !force )
-    for( unsigned long j = i; j < sblock_vector.size(); ++j )
-      if( sblock_vector[j].status() == Sblock::finished ) return false;
+    for( long j = i; j < sblocks(); ++j )
+      {
+      const Sblock & sb = sblock_vector[j];
+      if( sb.status() == Sblock::finished ||
+          ( packed( sb ) && packed_areas[area_index( sb.pos() )].
+                            has_status( Sblock::finished ) ) ) return false;
+      }
   if( i == 0 )
     {
     sblock_vector.clear();
+    packed_areas.clear();
     sblock_vector.push_back( Sblock( 0, 0, Sblock::non_tried ) );
     }
   else
     {
-    Sblock & sb = sblock_vector[i-1];
+    const Sblock & sb = sblock_vector[i-1];
     if( sb.includes( end ) )
       {
       if( !force && sb.status() == Sblock::finished ) return false;
-      sb.size( end - sb.pos() );
+      sblock_vector.modify( i - 1 ).size( end - sb.pos() );
       }
-    sblock_vector.erase( sblock_vector.begin() + i, sblock_vector.end() );
+    erase_sblocks( i );
     }
   return true;
   }
@@ -171,8 +504,13 @@ bool Mapfile::truncate_vector( const long long end, const bool force )
 
 // Returns true if mapfile exists and is readable.
 // Fills the gaps if 'default_sblock_status' is a valid status character.
+// If 'summaryp' is not null, stores in it the totals of the map read.
+// A corrupt mapfile makes the program exit with status 2, unless
+// 'corruptp' is not null, in which case sets *corruptp and returns false.
 //
-bool Mapfile::read_mapfile( const int default_sblock_status, const bool ro )
+bool Mapfile::read_mapfile( const int default_sblock_status, const bool ro,
+                            Map_summary * const summaryp,
+                            bool * const corruptp )
   {
   FILE * f = 0;
   errno = 0;
@@ -185,23 +523,25 @@ bool Mapfile::read_mapfile( const int default_sblock_status, const bool ro )
   int linenum = 0;
   const bool loose = Sblock::isstatus( default_sblock_status );
   sblock_vector.clear();
+  packed_areas.clear();
+  if( summaryp ) *summaryp = Map_summary();
 
   const char * line = my_fgets( f, linenum );
   if( line )						// status line
     {
     char ch;
-    int n = std::sscanf( line, "%lli %c\n", &current_pos_, &ch );
-    if( n == 2 && current_pos_ >= 0 && isstatus( ch ) )
+    if( parse_status_line( line, current_pos_, ch, current_pass_,
+                           current_state_ ) && isstatus( ch ) )
       current_status_ = Status( ch );
     else
-      { show_mapfile_error( filename_, linenum ); std::exit( 2 ); }
+      return corrupt_mapfile( filename_, linenum, f, corruptp );
 
     while( true )
       {
       line = my_fgets( f, linenum );
       if( !line ) break;
       long long pos, size;
-      n = std::sscanf( line, "%lli %lli %c\n", &pos, &size, &ch );
+      const int n = std::sscanf( line, "%lli %lli %c\n", &pos, &size, &ch );
       if( n == 3 && pos >= 0 && Sblock::isstatus( ch ) &&
           ( size > 0 || ( size == 0 && pos == 0 ) ) )
         {
@@ -214,22 +554,68 @@ bool Mapfile::read_mapfile( const int default_sblock_status, const bool ro )
           if( loose && sb.pos() > end )
             { const Sblock sb2( end, sb.pos() - end,
                                 Sblock::Status( default_sblock_status ) );
-              sblock_vector.push_back( sb2 ); }
+              sblock_vector.push_back( sb2 );
+              if( summaryp ) summaryp->add( sb2 ); }
           else if( end > 0 )
-            { show_mapfile_error( filename_, linenum ); std::exit( 2 ); }
+            return corrupt_mapfile( filename_, linenum, f, corruptp );
           }
         sblock_vector.push_back( sb );
+        if( summaryp ) summaryp->add( sb );
         }
       else
-        { show_mapfile_error( filename_, linenum ); std::exit( 2 ); }
+        return corrupt_mapfile( filename_, linenum, f, corruptp );
       }
     }
-  if( std::ferror( f ) || !std::feof( f ) || std::fclose( f ) != 0 )
-    { show_mapfile_error( filename_, linenum ); std::exit( 2 ); }
+  if( std::ferror( f ) || !std::feof( f ) )
+    return corrupt_mapfile( filename_, linenum, f, corruptp );
+  if( std::fclose( f ) != 0 )
+    return corrupt_mapfile( filename_, linenum, 0, corruptp );
   return true;
   }
 
 
+// Reads the status line and the summary written at the end of the
+// mapfile by write_mapfile, without reading the blocks.
+// Returns false if the mapfile is not a regular file, or if the summary
+// is missing or does not match the mapfile.
+//
+bool Mapfile::read_summary( Map_summary & summary )
+  {
+  if( !filename_ || std::strcmp( filename_, "-" ) == 0 ) return false;
+  FILE * const f = std::fopen( filename_, "r" );
+  if( !f ) return false;
+  bool done = false;
+  int linenum = 0;
+  const char * const line = my_fgets( f, linenum );
+  long long pos;
+  char ch;
+  int pass;
+  std::string state;
+  if( line && parse_status_line( line, pos, ch, pass, state ) &&
+      isstatus( ch ) && fseeko( f, 0, SEEK_END ) == 0 )
+    {
+    char buf[max_summary_len+1];
+    const long long fsize = ftello( f );
+    const long long tail_pos = std::max( 0LL, fsize - max_summary_len );
+    if( fsize > 0 && fseeko( f, tail_pos, SEEK_SET ) == 0 )
+      {
+      const int len = std::fread( buf, 1, fsize - tail_pos, f );
+      if( len == fsize - tail_pos && buf[len-1] == '\n' )
+        {
+        int i = len - 1;
+        buf[i] = 0;				// remove trailing newline
+        while( i > 0 && buf[i-1] != '\n' ) --i;
+        if( parse_summary( buf + i, tail_pos + i, ch, pass, summary ) )
+          { current_pos_ = pos; current_status_ = Status( ch );
+            current_pass_ = pass; current_state_ = state; done = true; }
+        }
+      }
+    }
+  std::fclose( f );
+  return done;
+  }
+
+
 int Mapfile::write_mapfile( FILE * f, const bool timestamp,
                             const bool mf_sync ) const
   {
@@ -240,15 +626,27 @@ int Mapfile::write_mapfile( FILE * f, const bool timestamp,
   write_file_header( f, "Mapfile" );
   if( timestamp ) write_timestamp( f );
   if( current_msg.size() ) std::fprintf( f, "# %s\n", current_msg.c_str() );
-  std::fprintf( f, "# current_pos  current_status\n"
-                   "0x%08llX     %c\n"
+  std::fprintf( f, "# current_pos  current_status  current_pass\n"
+                   "0x%08llX     %c               %d%s%s\n"
                    "#      pos        size  status\n",
-                current_pos_, current_status_ );
-  for( unsigned long i = 0; i < sblock_vector.size(); ++i )
+                current_pos_, current_status_, current_pass_,
+                current_state_.size() ? "  " : "", current_state_.c_str() );
+  Map_summary summary;
+  Block_writer writer( f, summary );
+  for( long i = 0; i < sblocks(); ++i )
     {
     const Sblock & sb = sblock_vector[i];
-    std::fprintf( f, "0x%08llX  0x%08llX  %c\n", sb.pos(), sb.size(), sb.status() );
+    if( !packed( sb ) ) { writer.put( sb, false ); continue; }
+    const Packed_area & pa = packed_areas[area_index( sb.pos() )];
+    for( long k = 0; k < pa.sectors(); )
+      {
+      const Sblock run = pa.run( k );
+      writer.put( run, true );
+      k = pa.sector( run.end() );
+      }
     }
+  writer.flush();
+  write_summary( f, summary, current_status_, current_pass_ );
   if( mf_sync ) fsync( fileno( f ) );
   return ( f_given || std::fclose( f ) == 0 );
   }
@@ -256,60 +654,83 @@ int Mapfile::write_mapfile( FILE * f, const bool timestamp,
 
 bool Mapfile::blank() const
   {
-  for( unsigned long i = 0; i < sblock_vector.size(); ++i )
-    if( sblock_vector[i].status() != Sblock::non_tried )
-      return false;
+  for( long i = 0; i < sblocks(); ++i )
+    {
+    const Sblock & sb = sblock_vector[i];
+    if( packed( sb ) )
+      {
+      const Packed_area & pa = packed_areas[area_index( sb.pos() )];
+      for( int j = 1; j < Map_summary::statuses; ++j )
+        if( pa.has_status( Sblock::index_status( j ) ) ) return false;
+      }
+    else if( sb.status() != Sblock::non_tried ) return false;
+    }
   return true;
   }
 
 
 void Mapfile::split_by_domain_borders( const Domain & domain )
   {
+  unpack_all();
   if( domain.blocks() == 1 )
     {
     const Block & db = domain.block( 0 );
-    unsigned long i = 0;
-    while( i < sblock_vector.size() && sblock_vector[i] < db ) ++i;
-    if( i < sblock_vector.size() ) try_split_sblock_by( db.pos(), i );
-    i = sblock_vector.size();
+    long i = 0;
+    while( i < sblocks() && sblock_vector[i] < db ) ++i;
+    if( i < sblocks() ) try_split_sblock_by( db.pos(), i );
+    i = sblocks();
     while( i > 0 && db < sblock_vector[i-1] ) --i;
     if( i > 0 ) try_split_sblock_by( db.end(), i - 1 );
+    return;
     }
-  else
+  // Split in place from the end. The first pass counts the new sblocks,
+  // the second moves the sblocks to their final positions.
+  const long size = sblocks();
+  long new_size = size;
+  for( int pass = 0; pass < 2; ++pass )
     {
-    std::vector< Sblock > new_vector;
-    long j = 0;
-    for( unsigned long i = 0; i < sblock_vector.size(); )
+    long j = domain.blocks() - 1, w = new_size;
+    for( long i = size - 1; i >= 0; --i )
       {
-      Sblock & sb = sblock_vector[i];
-      while( j < domain.blocks() && domain.block( j ) < sb ) ++j;
-      if( j >= domain.blocks() )		// end of domain tail copy
-        { new_vector.insert( new_vector.end(),
-                             sblock_vector.begin() + i, sblock_vector.end() );
-          break; }
-      const Block & db = domain.block( j );
-      if( sb.strictly_includes( db.pos() ) )
-        new_vector.push_back( sb.split( db.pos() ) );
-      if( sb.strictly_includes( db.end() ) )
-        new_vector.push_back( sb.split( db.end() ) );
-      if( sb.pos() < db.end() ) { new_vector.push_back( sb ); ++i; }
+      Sblock sb = sblock_vector[i];
+      while( true )
+        {
+        while( j >= 0 && domain.block( j ).pos() >= sb.end() ) --j;
+        if( j < 0 ) break;
+        const Block & db = domain.block( j );
+        long long pos;
+        if( sb.strictly_includes( db.end() ) ) pos = db.end();
+        else if( sb.strictly_includes( db.pos() ) ) pos = db.pos();
+        else break;
+        const Sblock left = sb.split( pos );
+        if( pass ) sblock_vector.modify( w - 1 ) = sb;
+        --w; sb = left;
+        }
+      if( pass ) sblock_vector.modify( w - 1 ) = sb;
+      --w;
+      }
+    if( pass == 0 )
+      {
+      if( w == 0 ) return;			// nothing to split
+      new_size -= w;
+      const Sblock sb = sblock_vector.back();
+      while( sblocks() < new_size ) sblock_vector.push_back( sb );
       }
-    sblock_vector.swap( new_vector );
     }
   }
 
 
 void Mapfile::split_by_mapfile_borders( const Mapfile & mapfile )
   {
+  unpack_all();
   std::vector< Sblock > new_vector;
   long j = 0;
-  for( unsigned long i = 0; i < sblock_vector.size(); )
+  for( long i = 0; i < sblocks(); )
     {
-    Sblock & sb = sblock_vector[i];
+    Sblock & sb = sblock_vector.modify( i );
     while( j < mapfile.sblocks() && mapfile.sblock( j ) < sb ) ++j;
     if( j >= mapfile.sblocks() )		// end of mapfile tail copy
-      { new_vector.insert( new_vector.end(),
-                           sblock_vector.begin() + i, sblock_vector.end() );
+      { for( ; i < sblocks(); ++i ) new_vector.push_back( sblock_vector[i] );
         break; }
     const Sblock & db = mapfile.sblock( j );
     if( sb.strictly_includes( db.pos() ) )
@@ -318,11 +739,16 @@ void Mapfile::split_by_mapfile_borders( const Mapfile & mapfile )
       new_vector.push_back( sb.split( db.end() ) );
     if( sb.pos() < db.end() ) { new_vector.push_back( sb ); ++i; }
     }
-  sblock_vector.swap( new_vector );
+  sblock_vector.clear();
+  for( unsigned long i = 0; i < new_vector.size(); ++i )
+    sblock_vector.push_back( new_vector[i] );
   }
 
 
-long Mapfile::find_index( const long long pos ) const
+// Returns the index of the sblock containing pos, which may be packed,
+// or -1 if pos is not in the map.
+//
+long Mapfile::locate( const long long pos ) const
   {
   if( index_ < 0 || index_ >= sblocks() ) index_ = sblocks() / 2;
   while( index_ + 1 < sblocks() && pos >= sblock_vector[index_+1].pos() )
@@ -334,6 +760,79 @@ long Mapfile::find_index( const long long pos ) const
   }
 
 
+long Mapfile::find_index( const long long pos ) const
+  {
+  if( locate( pos ) >= 0 && packed( sblock_vector[index_] ) )
+    { unpack_sblock( index_ ); locate( pos ); }
+  return index_;
+  }
+
+
+// Packing splits runs at the borders of packed areas, so that a run of
+// the unpacked map may span several sblocks. Extends 'run', found in
+// sblock i, over the following sblocks that continue it with status st,
+// until it ends after 'end'.
+//
+void Mapfile::extend_run( Block & run, long i, const Sblock::Status st,
+                          const Domain & domain, const long long end ) const
+  {
+  while( run.end() <= end && run.end() == sblock_vector[i].end() &&
+         ++i < sblocks() )
+    {
+    const Sblock & sb = sblock_vector[i];
+    const Sblock next = packed( sb ) ?
+      packed_areas[area_index( sb.pos() )].run( 0 ) : sb;
+    if( next.status() != st || !domain.includes( sb ) ) break;
+    run.join( next );
+    }
+  }
+
+
+// Extends 'run', found in sblock i, over the preceding sblocks that
+// continue it with status st, until it begins before 'pos'.
+//
+void Mapfile::rextend_run( Block & run, long i, const Sblock::Status st,
+                           const Domain & domain, const long long pos ) const
+  {
+  while( run.pos() >= pos && run.pos() == sblock_vector[i].pos() &&
+         --i >= 0 )
+    {
+    const Sblock & sb = sblock_vector[i];
+    Sblock prev = sb;
+    if( packed( sb ) )
+      {
+      const Packed_area & pa = packed_areas[area_index( sb.pos() )];
+      prev = pa.run( pa.sectors() - 1 );
+      }
+    if( prev.status() != st || !domain.includes( sb ) ) break;
+    run.join( prev );
+    }
+  }
+
+
+// Joins to sblock index_ the following sblocks overlapping b, unpacking
+// them, if all of them have the same status as sblock index_.
+// Returns false if they don't.
+//
+bool Mapfile::join_sblocks( const Block & b, const Domain & domain )
+  {
+  const Sblock::Status st = sblock_vector[index_].status();
+  long j = index_;
+  while( sblock_vector[j].end() < b.end() )
+    {
+    if( ++j >= sblocks() ) return false;
+    if( packed( sblock_vector[j] ) ) unpack_sblock( j );
+    if( sblock_vector[j].status() != st ||
+        !domain.includes( sblock_vector[j] ) ) return false;
+    }
+  Sblock sb = sblock_vector[index_];
+  for( long k = index_ + 1; k <= j; ++k ) sb.join( sblock_vector[k] );
+  sblock_vector.modify( index_ ) = sb;
+  sblock_vector.erase( index_ + 1, j + 1 );
+  return true;
+  }
+
+
 // Find chunk from b.pos of size <= b.size and status st.
 // If not found, put b.size to 0.
 //
@@ -343,18 +842,27 @@ void Mapfile::find_chunk( Block & b, const Sblock::Status st,
   if( b.size() <= 0 ) return;
   if( b.pos() < sblock_vector.front().pos() )
     b.pos( sblock_vector.front().pos() );
-  if( find_index( b.pos() ) < 0 ) { b.size( 0 ); return; }
+  if( locate( b.pos() ) < 0 ) { b.size( 0 ); return; }
+  Block run( 0, 0 );
   long i;
   for( i = index_; i < sblocks(); ++i )
-    if( sblock_vector[i].status() == st && domain.includes( sblock_vector[i] ) )
-      { index_ = i; break; }
+    {
+    const Sblock & sb = sblock_vector[i];
+    if( packed( sb ) )
+      {
+      const Packed_area & pa = packed_areas[area_index( sb.pos() )];
+      if( pa.has_status( st ) && domain.includes( sb ) &&
+          pa.find_run( ( i == index_ ) ? pa.sector( b.pos() ) : 0, st, run ) )
+        { index_ = i; break; }
+      }
+    else if( sb.status() == st && domain.includes( sb ) )
+      { run = sb; index_ = i; break; }
+    }
   if( i >= sblocks() ) { b.size( 0 ); return; }
-  if( b.pos() < sblock_vector[index_].pos() )
-    b.pos( sblock_vector[index_].pos() );
-  if( !sblock_vector[index_].includes( b ) )
-    b.crop( sblock_vector[index_] );
-  if( b.end() != sblock_vector[index_].end() )
-    b.align_end( alignment );
+  if( b.pos() < run.pos() ) b.pos( run.pos() );
+  extend_run( run, index_, st, domain, b.end() );
+  if( !run.includes( b ) ) b.crop( run );
+  if( b.end() != run.end() ) b.align_end( alignment );
   }
 
 
@@ -367,18 +875,28 @@ void Mapfile::rfind_chunk( Block & b, const Sblock::Status st,
   if( b.size() <= 0 ) return;
   if( sblock_vector.back().end() < b.end() )
     b.end( sblock_vector.back().end() );
-  if( find_index( b.end() - 1 ) < 0 ) { b.size( 0 ); return; }
+  if( locate( b.end() - 1 ) < 0 ) { b.size( 0 ); return; }
+  Block run( 0, 0 );
   long i;
   for( i = index_; i >= 0; --i )
-    if( sblock_vector[i].status() == st && domain.includes( sblock_vector[i] ) )
-      { index_ = i; break; }
+    {
+    const Sblock & sb = sblock_vector[i];
+    if( packed( sb ) )
+      {
+      const Packed_area & pa = packed_areas[area_index( sb.pos() )];
+      if( pa.has_status( st ) && domain.includes( sb ) &&
+          pa.rfind_run( ( i == index_ ) ? pa.sector( b.end() - 1 ) :
+                        pa.sectors() - 1, st, run ) )
+        { index_ = i; break; }
+      }
+    else if( sb.status() == st && domain.includes( sb ) )
+      { run = sb; index_ = i; break; }
+    }
   if( i < 0 ) { b.size( 0 ); return; }
-  if( b.end() > sblock_vector[index_].end() )
-    b.end( sblock_vector[index_].end() );
-  if( !sblock_vector[index_].includes( b ) )
-    b.crop( sblock_vector[index_] );
-  if( b.pos() != sblock_vector[index_].pos() )
-    b.align_pos( alignment );
+  if( b.end() > run.end() ) b.end( run.end() );
+  rextend_run( run, index_, st, domain, b.pos() );
+  if( !run.includes( b ) ) b.crop( run );
+  if( b.pos() != run.pos() ) b.align_pos( alignment );
   }
 
 
@@ -397,10 +915,47 @@ int Mapfile::change_chunk_status( const Block & b, const Sblock::Status st,
                                   Sblock::Status * const old_stp )
   {
   if( b.size() <= 0 ) return 0;
-  if( !domain.includes( b ) || find_index( b.pos() ) < 0 ||
+  if( !domain.includes( b ) || locate( b.pos() ) < 0 ||
       !domain.includes( sblock_vector[index_] ) )
     internal_error( "can't change status of chunk not in rescue domain." );
-  if( !sblock_vector[index_].includes( b ) )
+  if( packed( sblock_vector[index_] ) )
+    {
+    Packed_area & pa = packed_areas[area_index( sblock_vector[index_].pos() )];
+    const int hardbs = pa.hardbs();
+    const long first = pa.sector( b.pos() );
+    const long last = pa.sector( b.end() - 1 ) + 1;
+    const Sblock::Status old_st = pa.status( first );
+    bool fits = ( b.pos() % hardbs == 0 && b.end() % hardbs == 0 &&
+                  b.end() <= pa.end() );
+    for( long i = first + 1; fits && i < last; ++i )
+      if( pa.status( i ) != old_st ) fits = false;
+    if( !fits )			// b is not an aligned part of a single run
+      { unpack_sblock( index_ ); locate( b.pos() ); }
+    else
+      {
+      if( old_stp ) *old_stp = old_st;
+      if( st == old_st ) return 0;
+      const bool old_st_good = Sblock::is_good_status( old_st );
+      const bool new_st_good = Sblock::is_good_status( st );
+      const bool bl_st_good = ( first > 0 ) ?
+        Sblock::is_good_status( pa.status( first - 1 ) ) :
+        ( index_ <= 0 ||
+          Sblock::is_good_status( status_at( index_ - 1, pa.pos() - 1 ) ) ||
+          !domain.includes( sblock_vector[index_-1] ) );
+      const bool br_st_good = ( last < pa.sectors() ) ?
+        Sblock::is_good_status( pa.status( last ) ) :
+        ( index_ + 1 >= sblocks() ||
+          Sblock::is_good_status( status_at( index_ + 1, pa.end() ) ) ||
+          !domain.includes( sblock_vector[index_+1] ) );
+      pa.change_status( first, last, st );
+      if( pa.runs() * 64 < pa.sectors() ) unpack_sblock( index_ );
+      int retval = 0;
+      if( new_st_good != old_st_good && bl_st_good == br_st_good )
+        { if( old_st_good == bl_st_good ) retval = +1; else retval = -1; }
+      return retval;
+      }
+    }
+  if( !sblock_vector[index_].includes( b ) && !join_sblocks( b, domain ) )
     internal_error( "can't change status of chunk spread over more than 1 block." );
   const Sblock::Status old_st = sblock_vector[index_].status();
   if( old_stp ) *old_stp = old_st;
@@ -408,11 +963,11 @@ int Mapfile::change_chunk_status( const Block & b, const Sblock::Status st,
   const bool old_st_good = Sblock::is_good_status( old_st );
   const bool new_st_good = Sblock::is_good_status( st );
   bool bl_st_good = ( index_ <= 0 ||
-                      Sblock::is_good_status( sblock_vector[index_-1].status() ) ||
-                      !domain.includes( sblock_vector[index_-1] ) );
+    Sblock::is_good_status( status_at( index_ - 1, sblock_vector[index_].pos() - 1 ) ) ||
+    !domain.includes( sblock_vector[index_-1] ) );
   bool br_st_good = ( index_ + 1 >= sblocks() ||
-                      Sblock::is_good_status( sblock_vector[index_+1].status() ) ||
-                      !domain.includes( sblock_vector[index_+1] ) );
+    Sblock::is_good_status( status_at( index_ + 1, sblock_vector[index_].end() ) ) ||
+    !domain.includes( sblock_vector[index_+1] ) );
 
   if( sblock_vector[index_].pos() < b.pos() )
     {
@@ -420,10 +975,11 @@ int Mapfile::change_chunk_status( const Block & b, const Sblock::Status st,
         index_ + 1 < sblocks() && sblock_vector[index_+1].status() == st &&
         domain.includes( sblock_vector[index_+1] ) )
       {
-      sblock_vector[index_].shift( sblock_vector[index_+1], b.pos() );
+      sblock_vector.modify( index_ ).shift( sblock_vector.modify( index_ + 1 ),
+                                            b.pos() );
       return 0;
       }
-    insert_sblock( index_, sblock_vector[index_].split( b.pos() ) );
+    insert_sblock( index_, sblock_vector.modify( index_ ).split( b.pos() ) );
     ++index_;
     bl_st_good = old_st_good;
     }
@@ -431,15 +987,16 @@ int Mapfile::change_chunk_status( const Block & b, const Sblock::Status st,
     {
     if( index_ > 0 && sblock_vector[index_-1].status() == st &&
         domain.includes( sblock_vector[index_-1] ) )
-      sblock_vector[index_-1].shift( sblock_vector[index_], b.end() );
+      sblock_vector.modify( index_ - 1 ).shift( sblock_vector.modify( index_ ),
+                                                b.end() );
     else
       insert_sblock( index_,
-                     Sblock( sblock_vector[index_].split( b.end() ), st ) );
+                     Sblock( sblock_vector.modify( index_ ).split( b.end() ), st ) );
     br_st_good = old_st_good;
     }
   else
     {
-    sblock_vector[index_].status( st );
+    sblock_vector.modify( index_ ).status( st );
     const bool bl_join = ( index_ > 0 &&
                            sblock_vector[index_-1].status() == st &&
                            domain.includes( sblock_vector[index_-1] ) );
@@ -448,11 +1005,13 @@ int Mapfile::change_chunk_status( const Block & b, const Sblock::Status st,
                            domain.includes( sblock_vector[index_+1] ) );
     if( bl_join || br_join )
       {
-      if( br_join ) sblock_vector[index_].join( sblock_vector[index_+1] );
+      if( br_join )
+        { const Sblock sb = sblock_vector[index_+1];
+          sblock_vector.modify( index_ ).join( sb ); }
       if( bl_join )
-        { --index_; sblock_vector[index_].join( sblock_vector[index_+1] ); }
-      sblock_vector.erase( sblock_vector.begin() + ( index_ + 1 ),
-                           sblock_vector.begin() + ( index_ + 1 + bl_join + br_join ) );
+        { --index_; const Sblock sb = sblock_vector[index_+1];
+          sblock_vector.modify( index_ ).join( sb ); }
+      sblock_vector.erase( index_ + 1, index_ + 1 + bl_join + br_join );
       }
     }
   int retval = 0;
@@ -22,8 +22,10 @@
 #include <cerrno>
 #include <climits>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <map>
 #include <string>
 #include <vector>
 #include <stdint.h>
@@ -39,6 +41,10 @@ extern "C" {
 #include "block.h"
 #include "loggers.h"
 #include "mapbook.h"
+#include "non_posix.h"
+#include "simulator.h"
+#include "control.h"
+#include "strategy.h"
 #include "rescuebook.h"
 
 
@@ -56,14 +62,25 @@ int round_up( int size, const int hardbs )
   return size;
   }
 
+
+bool is_error_status( const Sblock::Status st )
+  { return ( st == Sblock::non_trimmed || st == Sblock::non_scraped ||
+             st == Sblock::bad_sector ); }
+
+// In automatic direct mode, reads closer than this to an error area, and
+// the reads following a failed or slow read, are done with direct access.
+const long long direct_proximity = 1 << 20;
+const int trouble_reads = 16;
+const double slow_read_time = 1.0;		// seconds
+
 } // end namespace
 
 
-void Rescuebook::change_chunk_status( const Block & b, const Sblock::Status st )
+bool Rescuebook::change_chunk_status( const Block & b, const Sblock::Status st )
   {
   Sblock::Status old_st = st;
   errors += Mapfile::change_chunk_status( b, st, domain(), &old_st );
-  if( st == old_st ) return;
+  if( st == old_st ) return true;
   switch( old_st )
     {
     case Sblock::non_tried:     non_tried_size -= b.size(); break;
@@ -80,6 +97,49 @@ void Rescuebook::change_chunk_status( const Block & b, const Sblock::Status st )
     case Sblock::bad_sector:   bad_sector_size += b.size(); break;
     case Sblock::finished:       finished_size += b.size(); break;
     }
+  return ( !mark_bad || !is_error_status( st ) || mark_area( b, st ) );
+  }
+
+
+// Reads the fill data for bad areas from mark_file, repeating it as
+// needed to fill the buffer.
+//
+bool Rescuebook::read_mark_buffer()
+  {
+  FILE * const f = std::fopen( mark_file, "rb" );
+  if( !f ) return false;
+  const int rd = std::fread( iobuf2(), 1, softbs(), f );
+  std::fclose( f );
+  if( rd <= 0 ) return false;
+  for( int i = rd; i < softbs(); i *= 2 )
+    {
+    const int size = std::min( i, softbs() - i );
+    std::memcpy( iobuf2() + i, iobuf2(), size );
+    }
+  return true;
+  }
+
+
+// Writes the fill data, or the location data, into the area 'b' of the
+// output, which has just become 'st'. The data is overwritten by the
+// normal writes if the area is read successfully later.
+// Returns false if a write fails. Then the rescue stops before the next
+// read, also if the caller can't return the error.
+//
+bool Rescuebook::mark_area( const Block & b, const Sblock::Status st )
+  {
+  for( long long pos = b.pos(); pos < b.end(); )
+    {
+    const int size = std::min( (long long)softbs(), b.end() - pos );
+    if( !mark_file )
+      write_location_data( iobuf2(), Sblock( Block( pos, size ), st ),
+                           hardbs() );
+    if( writeblock( odes_, iobuf2(), size, pos + offset() ) != size ||
+        ( synchronous_ && fsync( odes_ ) < 0 && errno != EINVAL ) )
+      { final_msg( "Write error", errno ); e_code |= 8; return false; }
+    pos += size;
+    }
+  return true;
   }
 
 
@@ -92,8 +152,10 @@ bool Rescuebook::extend_outfile_size()
     if( size < 0 ) return false;
     if( min_size > size )
       {
-      const uint8_t zero = 0;
-      if( writeblock( odes_, &zero, 1, min_size - 1 ) != 1 ) return false;
+      const uint8_t zero = 0;		// unaligned write fails if odirect
+      if( writeblock( odes_, &zero, 1, min_size - 1 ) != 1 &&
+          ( errno != EINVAL || ftruncate( odes_, min_size ) != 0 ) )
+        return false;
       fsync( odes_ );
       }
     }
@@ -101,17 +163,124 @@ bool Rescuebook::extend_outfile_size()
   }
 
 
-// Return values: 2 bad infile, 1 I/O error, 0 OK.
+// Writes to odes_ the data in 'buf', skipping the runs of zero sectors
+// that are at least min_hole bytes long or that are at the beginning or
+// at the end of 'buf'. If anything is skipped, sparse_size is updated so
+// that outfile is extended at the end of the rescue.
+// Returns false if a write fails.
+//
+bool Rescuebook::write_sparse( const uint8_t * const buf, const int size,
+                               const long long pos )
+  {
+  const int min_hole = std::max( hardbs(), 4096 );
+  int data = 0;				// start of data not yet written
+  bool skipped = false;
+  if( block_is_zero( buf, size ) ) { data = size; skipped = true; }
+  for( int i = data; i < size; )
+    {
+    int n = std::min( hardbs(), size - i );
+    if( !block_is_zero( buf + i, n ) ) { i += n; continue; }
+    int j = i + n;				// end of zero run
+    while( j < size &&
+           block_is_zero( buf + j, n = std::min( hardbs(), size - j ) ) )
+      j += n;
+    if( i == 0 || j >= size || j - i >= min_hole )
+      {
+      if( i > data &&
+          writeblock( odes_, buf + data, i - data, pos + data ) != i - data )
+        return false;
+      data = j; skipped = true;
+      }
+    i = j;
+    }
+  if( data < size &&
+      writeblock( odes_, buf + data, size - data, pos + data ) != size - data )
+    return false;
+  if( skipped && pos + size > sparse_size ) sparse_size = pos + size;
+  return true;
+  }
+
+
+// Writes to outfile the 'size' bytes read from infile at 'ipos', and
+// keeps the preview and the signature of the input up to date.
+// Returns false if a write fails.
+//
+bool Rescuebook::store_block( const uint8_t * const buf,
+                              const long long ipos, const int size )
+  {
+  if( buf != iobuf() && preview_lines > 0 )	// for show_status
+    std::memcpy( iobuf(), buf, std::min( size, 16 * preview_lines ) );
+  iobuf_ipos = ipos;
+  const long long pos = ipos + offset();
+  const bool dense = ( sparse_size < 0 || ( mark_bad &&
+                       is_error_status( sblock_at( ipos ).status() ) ) );
+  if( ( dense ? writeblock( odes_, buf, size, pos ) != size :
+                !write_sparse( buf, size, pos ) ) ||
+      ( synchronous_ && fsync( odes_ ) < 0 && errno != EINVAL ) )
+    return false;
+  if( ( verify_on_error || reattach_pattern ) &&	// signature of input
+      size >= hardbs() && ipos % hardbs() == 0 )
+    { voe_ipos = ipos; std::memcpy( voe_buf, buf, hardbs() ); }
+  return true;
+  }
+
+
+// Calls store_block with the arguments in 'arg', for Mapped_input::guard.
+//
+void Rescuebook::store_guarded( void * const arg )
+  {
+  Store_args & a = *(Store_args *)arg;
+  a.ok = a.rb->store_block( a.buf, a.ipos, a.size );
+  }
+
+
+// Returns true if 'b' touches an area with errors, or is closer than
+// direct_proximity to one. Walks the map by position so that packed
+// areas are not unpacked.
+//
+bool Rescuebook::near_errors( const Block & b ) const
+  {
+  long long pos = std::max( extent().pos(), b.pos() - direct_proximity );
+  const long long end = b.end() + direct_proximity;
+  while( pos < end )
+    {
+    const Sblock sb = sblock_at( pos );
+    if( sb.size() <= 0 ) break;			// beyond the end of the map
+    if( is_error_status( sb.status() ) ) return true;
+    pos = sb.end();
+    }
+  return false;
+  }
+
+
+// Decides whether 'b' is read with direct access. In automatic mode,
+// clean zones are read through the buffered descriptor to benefit from
+// readahead, and damaged or slow zones through the direct one.
+//
+bool Rescuebook::use_direct( const Block & b ) const
+  {
+  if( o_direct_in ) return true;
+  if( ides_direct < 0 ) return false;
+  return ( troubled_reads > 0 || near_errors( b ) );
+  }
+
+
+// Return values: 3 input disappeared, 2 bad infile, 1 I/O error, 0 OK.
 // If OK && copied_size + error_size < b.size(), it means EOF has been reached.
 //
 int Rescuebook::copy_block( const Block & b, int & copied_size, int & error_size )
   {
   if( b.size() <= 0 ) internal_error( "bad size copying a Block." );
+  const double t0 = precise_time();
+  const uint8_t * buf = iobuf();	// data read, in iobuf or mapped
+  bool direct = false;
   if( !test_domain || test_domain->includes( b ) )
     {
+    direct = use_direct( b );
+    const int fd = ( direct && ides_direct >= 0 ) ? ides_direct : ides_;
     // Due to block-at-a-time libdvdread access, use the odirect path
     // for dvds
-    if( o_direct_in || dvd_ )
+    if( direct || dvd_ )
       {
       const int pre = b.pos() % hardbs();
       const int disp = b.end() % hardbs();
@@ -123,46 +292,78 @@ int Rescuebook::copy_block( const Block & b, int & copied_size, int & error_size
       if (dvd_) {
         copied_size = readblock_dvdread( idvd_, idvd_nblocks, iobuf(), size, b.pos() - pre );
       } else {
-        copied_size = readblock( ides_, iobuf(), size, b.pos() - pre );
+        copied_size = readblock( fd, iobuf(), size, b.pos() - pre );
       }
 #else
-      copied_size = readblock( ides_, iobuf(), size, b.pos() - pre );
+      copied_size = readblock( fd, iobuf(), size, b.pos() - pre );
 #endif
       copied_size -= std::min( pre, copied_size );
       if( copied_size > b.size() ) copied_size = b.size();
       if( pre > 0 && copied_size > 0 )
         std::memmove( iobuf(), iobuf() + pre, copied_size );
       }
+    else if( mapped_input )
+      buf = mapped_input->read( b.pos(), b.size(), copied_size );
     else {
       copied_size = readblock( ides_, iobuf(), b.size(), b.pos() );
     }
+    if( input_model )
+      {
+      int error = 0;
+      const int size = input_model->read( b, error );
+      if( size < b.size() && copied_size >= size )
+        { copied_size = size; errno = error; }
+      }
     error_size = errno ? b.size() - copied_size : 0;
     if( errno == EINVAL )
       { final_msg( "Unaligned read error. Is sector size correct?" ); return 1; }
     }
-  else { copied_size = 0; error_size = b.size(); }
+  else { copied_size = 0; error_size = b.size(); errno = EIO; }
+  struct stat istat;
+  if( error_size > 0 && reattach_pattern &&
+      ( errno == ENODEV || errno == ENXIO || stat( iname_, &istat ) != 0 ) )
+    return 3;
+  const double elapsed = precise_time() - t0;
 
   if( copied_size > 0 )
     {
-    iobuf_ipos = b.pos();
-    const long long pos = b.pos() + offset();
-    if( sparse_size >= 0 && block_is_zero( iobuf(), copied_size ) )
-      {
-      const long long end = pos + copied_size;
-      if( end > sparse_size ) sparse_size = end;
-      }
-    else if( writeblock( odes_, iobuf(), copied_size, pos ) != copied_size ||
-             ( synchronous_ && fsync( odes_ ) < 0 && errno != EINVAL ) )
-      { final_msg( "Write error", errno ); return 1; }
+    const int read_errno = errno;
+    bool ok;
+    if( buf == iobuf() ) ok = store_block( buf, b.pos(), copied_size );
+    else			// mapped pages may fail again when used
+      while( true )
+        {
+        Store_args args = { this, buf, b.pos(), copied_size, false };
+        const uint8_t * const fault =
+          Mapped_input::guard( store_guarded, &args );
+        ok = args.ok;
+        if( !fault && ( ok || errno != EFAULT ) ) break;
+        // the rest of the block from the page that failed is a read error
+        int good = ( fault > buf && fault < buf + copied_size ) ?
+                   fault - buf : 0;
+        good -= good % hardbs();
+        copied_size = good; error_size = b.size() - good;
+        if( copied_size <= 0 ) { ok = true; break; }
+        }
+    if( !ok ) { final_msg( "Write error", errno ); return 1; }
+    errno = ( error_size > 0 ) ? ( read_errno ? read_errno : EIO ) : 0;
+    }
+  if( copied_size <= 0 ) iobuf_ipos = -1;
+  trace_logger.print_line( b.pos(), b.size(), copied_size,
+                           ( error_size > 0 ) ? errno : 0, elapsed );
+  if( ides_direct >= 0 )
+    {
+    if( direct ) direct_size += copied_size;
+    else buffered_size += copied_size;
+    if( error_size > 0 || elapsed >= slow_read_time )
+      troubled_reads = trouble_reads;
+    else if( troubled_reads > 0 ) --troubled_reads;
     }
-  else iobuf_ipos = -1;
 
   read_logger.print_line( b.pos(), b.size(), copied_size, error_size );
 
   if( verify_on_error )
     {
-    if( copied_size >= hardbs() && b.pos() % hardbs() == 0 )
-      { voe_ipos = b.pos(); std::memcpy( voe_buf, iobuf(), hardbs() ); }
     if( error_size > 0 )
       {
       if( voe_ipos >= 0 ) {
@@ -171,10 +372,12 @@ int Rescuebook::copy_block( const Block & b, int & copied_size, int & error_size
         if (dvd_) {
           size = readblock_dvdread( idvd_, idvd_nblocks, iobuf_aux(), hardbs(), voe_ipos );
         } else {
-          size = readblock( ides_, iobuf_aux(), hardbs(), voe_ipos );
+          size = readblock( ( ides_direct >= 0 ) ? ides_direct : ides_,
+                            iobuf_aux(), hardbs(), voe_ipos );
         }
 #else
-        int size = readblock( ides_, iobuf_aux(), hardbs(), voe_ipos );
+        int size = readblock( ( ides_direct >= 0 ) ? ides_direct : ides_,
+                              iobuf_aux(), hardbs(), voe_ipos );
 #endif
         if( size != hardbs() )
           { final_msg( "Input file no longer returns data", errno ); e_code |= 8; }
@@ -197,9 +400,12 @@ void Rescuebook::initialize_sizes()
   bad_sector_size = finished_size = 0;
   errors = 0;
 
-  for( long i = 0; i < sblocks(); ++i )
+  const long long end = extent().end();
+  for( long long pos = extent().pos(); pos < end; )
     {
-    const Sblock & sb = sblock( i );
+    const Sblock sb = sblock_at( pos );		// does not unpack sblocks
+    if( sb.size() <= 0 ) break;
+    pos = sb.end();
     if( !domain().includes( sb ) )
       { if( domain() < sb ) break; else { good = true; continue; } }
     switch( sb.status() )
@@ -215,7 +421,7 @@ void Rescuebook::initialize_sizes()
   }
 
 
-// Return values: 1 I/O error, 0 OK, -1 interrupted.
+// Return values: 1 I/O error, 0 OK, -1 interrupted, -2 mapfile error.
 //
 int Rescuebook::copy_and_update( const Block & b, int & copied_size,
                                  int & error_size, const char * const msg,
@@ -228,8 +434,8 @@ int Rescuebook::copy_and_update( const Block & b, int & copied_size,
     else if( pause > 0 )
       {
       show_status( -1, "Paused", true );
-      sleep( pause );
-      const long t2 = std::time( 0 );
+      wait_seconds( pause );
+      const long t2 = current_time();
       if( t1 < t2 ) t1 = t2;			// clock may have jumped back
       ts = std::min( ts + pause, t2 );		// avoid spurious timeout
       }
@@ -240,7 +446,14 @@ int Rescuebook::copy_and_update( const Block & b, int & copied_size,
   show_status( b.pos(), msg );
   if( errors_or_timeout() ) return 1;
   if( interrupted() ) return -1;
-  int retval = copy_block( b, copied_size, error_size );
+  int retval;
+  while( ( retval = copy_block( b, copied_size, error_size ) ) == 3 )
+    {
+    copied_size = error_size = 0;
+    retval = wait_reattach();		// read b again from the new input
+    if( retval ) return retval;
+    show_status( b.pos(), msg, true );
+    }
   if( retval == 0 )
     {
     if( copied_size + error_size < b.size() )			// EOF
@@ -258,7 +471,8 @@ int Rescuebook::copy_and_update( const Block & b, int & copied_size,
       error_rate += error_size;
       const Sblock::Status st2 =
         ( error_size > hardbs() ) ? st : Sblock::bad_sector;
-      change_chunk_status( Block( b.pos() + copied_size, error_size ), st2 );
+      if( !change_chunk_status( Block( b.pos() + copied_size, error_size ), st2 ) )
+        return 1;			// can't mark the bad area
       struct stat istat;
       if( stat( iname_, &istat ) != 0 )
         { final_msg( "Input file disappeared", errno ); retval = 1; }
@@ -269,331 +483,125 @@ int Rescuebook::copy_and_update( const Block & b, int & copied_size,
 
 
 // Return values: 1 I/O error, 0 OK, -1 interrupted, -2 mapfile error.
-// Read the non-tried part of the domain, skipping over the damaged areas.
+// Read the blocks chosen by the strategy until it has no more blocks to
+// read, updating the map, the rates and the mapfile after each read.
 //
-int Rescuebook::copy_non_tried()
+int Rescuebook::run_strategy()
   {
-  char msgbuf[80] = "Copying non-tried blocks... Pass ";
-  const int msglen = std::strlen( msgbuf );
-  bool forward = !reverse;
-
-  for( int pass = 1; pass <= 3; ++pass )
+  Rescue_strategy::Read r;
+  bool first = true;
+  Status phase = copying;
+  long control_t = 0;				// last time control was served
+  int pass;
+  std::string state;
+
+  while( true )
     {
-    if( cpass_bitset & ( 1 << ( pass - 1 ) ) )
+    if( control && control_t != t1 ) { control_t = t1; serve_control(); }
+    const bool more = strategy->next_read( *this, r );
+    strategy->get_state( pass, state ); current_pass( pass, state );
+    if( !more ) break;
+    if( first || r.phase != phase )		// new phase
       {
-      first_post = true;
-      snprintf( msgbuf + msglen, ( sizeof msgbuf ) - msglen, "%d %s",
-                pass, forward ? "(forwards)" : "(backwards)" );
-      int retval = forward ? fcopy_non_tried( msgbuf, pass ) :
-                             rcopy_non_tried( msgbuf, pass );
-      if( retval != -3 ) return retval;
-      reduce_min_read_rate();
+      if( errors_or_timeout() ) break;
+      first = false; phase = r.phase;
       }
-    if( !unidirectional ) forward = !forward;
-    }
-  return 0;
-  }
-
-
-// Return values: 1 I/O error, 0 OK, -1 interrupted, -2 mapfile error.
-// Read forwards the non-tried part of the domain, skipping over the
-// damaged areas.
-//
-int Rescuebook::fcopy_non_tried( const char * const msg, const int pass )
-  {
-  long long pos = 0;
-  int skip_size = skipbs;		// size to skip on error if skipbs > 0
-  bool block_found = false;
-
-  if( pass == 1 && current_status() == copying &&
-      domain().includes( current_pos() ) )
-    {
-    Block b( current_pos(), 1 );
-    find_chunk( b, Sblock::non_tried, domain(), hardbs() );
-    if( b.size() > 0 ) pos = b.pos();		// resume
-    }
-
-  while( pos >= 0 )
-    {
-    Block b( pos, softbs() );
-    find_chunk( b, Sblock::non_tried, domain(), softbs() );
-    if( b.size() <= 0 ) break;
-    if( pos != b.pos() ) skip_size = skipbs;	// reset size on block change
-    pos = b.end();
-    block_found = true;
+    if( r.new_pass ) first_post = true;
     int copied_size = 0, error_size = 0;
-    const int retval = copy_and_update( b, copied_size, error_size, msg,
-                                        copying, true, Sblock::non_trimmed );
-    if( retval ) {
-      printf("got %d from copy_and_update()\n", retval);
-      return retval;
-    }
-    update_rates();
-    if( error_size > 0 && exit_on_error ) { e_code |= 2; return 1; }
-    if( ( error_size > 0 || slow_read() ) && pos >= 0 )
-      {
-      if( reopen_on_error && !reopen_infile() ) return 1;
-      if( skipbs > 0 && pass <= 2 )		// don't skip if skipbs == 0
-        {
-        b.assign( pos, skip_size );
-        find_chunk( b, Sblock::non_tried, domain(), hardbs() );
-        if( pos == b.pos() && b.size() > 0 ) pos = b.end();	// skip
-        if( skip_size <= max_skipbs / 2 ) skip_size *= 2;
-        else skip_size = max_skipbs;
-        }
-      }
-    else if( copied_size > 0 ) skip_size = skipbs;		// reset
-    if( !update_mapfile( odes_ ) ) return -2;
-    }
-  if( !block_found ) return 0;
-  return -3;
-  }
-
-
-// Return values: 1 I/O error, 0 OK, -1 interrupted, -2 mapfile error.
-// Read backwards the non-tried part of the domain, skipping over the
-// damaged areas.
-//
-int Rescuebook::rcopy_non_tried( const char * const msg, const int pass )
-  {
-  long long end = LLONG_MAX;
-  int skip_size = skipbs;		// size to skip on error if skipbs > 0
-  bool block_found = false;
-
-  if( pass == 1 && current_status() == copying &&
-      domain().includes( current_pos() - 1 ) )
-    {
-    Block b( current_pos() - 1, 1 );
-    rfind_chunk( b, Sblock::non_tried, domain(), hardbs() );
-    if( b.size() > 0 ) end = b.end();		// resume
-    }
-
-  while( end > 0 )
-    {
-    Block b( end - softbs(), softbs() );
-    rfind_chunk( b, Sblock::non_tried, domain(), softbs() );
-    if( b.size() <= 0 ) break;
-    if( end != b.end() ) skip_size = skipbs;	// reset size on block change
-    end = b.pos();
-    block_found = true;
-    int copied_size = 0, error_size = 0;
-    const int retval = copy_and_update( b, copied_size, error_size, msg,
-                                        copying, false, Sblock::non_trimmed );
+    const int retval = copy_and_update( r.block, copied_size, error_size,
+                       r.msg, r.phase, r.forward, r.error_status );
     if( retval ) return retval;
     update_rates();
+    const bool reopen = strategy->read_done( *this, r, copied_size, error_size );
     if( error_size > 0 && exit_on_error ) { e_code |= 2; return 1; }
-    if( ( error_size > 0 || slow_read() ) && end > 0 )
-      {
-      if( reopen_on_error && !reopen_infile() ) return 1;
-      if( skipbs > 0 && pass <= 2 )		// don't skip if skipbs == 0
-        {
-        b.assign( end - skip_size, skip_size );
-        rfind_chunk( b, Sblock::non_tried, domain(), hardbs() );
-        if( end == b.end() && b.size() > 0 ) end = b.pos();	// skip
-        if( skip_size <= max_skipbs / 2 ) skip_size *= 2;
-        else skip_size = max_skipbs;
-        }
-      }
-    else if( copied_size > 0 ) skip_size = skipbs;		// reset
+    if( reopen && reopen_on_error && !reopen_infile() ) return 1;
+    strategy->get_state( pass, state ); current_pass( pass, state );
     if( !update_mapfile( odes_ ) ) return -2;
     }
-  if( !block_found ) return 0;
-  return -3;
-  }
-
-
-// Return values: 1 I/O error, 0 OK, -1 interrupted, -2 mapfile error.
-// Trim both edges of each damaged area sequentially.
-//
-int Rescuebook::trim_errors()
-  {
-  const char * const msg = reverse ? "Trimming failed blocks... (backwards)" :
-                                     "Trimming failed blocks... (forwards)";
-  first_post = true;
-
-  for( long i = 0; i < sblocks(); )
-    {
-    const Sblock sb = sblock( reverse ? sblocks() - i - 1 : i );
-    if( !domain().includes( sb ) )
-      { if( ( !reverse && domain() < sb ) || ( reverse && domain() > sb ) )
-          break;
-        ++i; continue; }
-    if( sb.status() != Sblock::non_trimmed ) { ++i; continue; }
-    long long pos = sb.pos();
-    long long end = sb.end();
-    bool error_found = false;
-    while( pos < end && !error_found )
-      {
-      Block b( pos, std::min( (long long)hardbs(), end - pos ) );
-      if( b.end() != end ) b.align_end( hardbs() );
-      pos = b.end();
-      int copied_size = 0, error_size = 0;
-      const int retval = copy_and_update( b, copied_size, error_size, msg,
-                                          trimming, true );
-      if( retval ) return retval;
-      update_rates();
-      if( error_size > 0 )
-        { error_found = true; if( exit_on_error ) { e_code |= 2; return 1; } }
-      if( !update_mapfile( odes_ ) ) return -2;
-      }
-    error_found = false;
-    while( end > pos && !error_found )
-      {
-      const int size = std::min( (long long)hardbs(), end - pos );
-      Block b( end - size, size );
-      if( b.pos() != pos ) b.align_pos( hardbs() );
-      end = b.pos();
-      int copied_size = 0, error_size = 0;
-      const int retval = copy_and_update( b, copied_size, error_size, msg,
-                                          trimming, false );
-      if( retval ) return retval;
-      if( error_size > 0 && end > pos )
-        {
-        const long index = find_index( end - 1 );
-        if( index >= 0 && domain().includes( sblock( index ) ) &&
-            sblock( index ).status() == Sblock::non_trimmed )
-          change_chunk_status( sblock( index ), Sblock::non_scraped );
-        }
-      update_rates();
-      if( error_size > 0 )
-        { error_found = true; if( exit_on_error ) { e_code |= 2; return 1; } }
-      if( !update_mapfile( odes_ ) ) return -2;
-      }
-    }
-  return 0;
-  }
-
-
-// Return values: 1 I/O error, 0 OK, -1 interrupted, -2 mapfile error.
-// Scrape the damaged areas sequentially.
-//
-int Rescuebook::scrape_errors()
-  {
-  const char * const msg = reverse ? "Scraping failed blocks... (backwards)" :
-                                     "Scraping failed blocks... (forwards)";
-  first_post = true;
-
-  for( long i = 0; i < sblocks(); )
-    {
-    const Sblock sb = sblock( reverse ? sblocks() - i - 1 : i );
-    if( !domain().includes( sb ) )
-      { if( ( !reverse && domain() < sb ) || ( reverse && domain() > sb ) )
-          break;
-        ++i; continue; }
-    if( sb.status() != Sblock::non_scraped ) { ++i; continue; }
-    long long pos = sb.pos();
-    const long long end = sb.end();
-    while( pos < end )
-      {
-      Block b( pos, std::min( (long long)hardbs(), end - pos ) );
-      if( b.end() != end ) b.align_end( hardbs() );
-      pos = b.end();
-      int copied_size = 0, error_size = 0;
-      const int retval = copy_and_update( b, copied_size, error_size, msg,
-                                          scraping, true );
-      if( retval ) return retval;
-      update_rates();
-      if( error_size > 0 && exit_on_error ) { e_code |= 2; return 1; }
-      if( !update_mapfile( odes_ ) ) return -2;
-      }
-    }
   return 0;
   }
 
 
-// Return values: 1 I/O error, 0 OK, -1 interrupted, -2 mapfile error.
-// Try to read the damaged areas, one sector at a time.
+// Executes one command received through the control socket and returns
+// the reply.
 //
-int Rescuebook::copy_errors()
+std::string Rescuebook::control_reply( const std::string & line )
   {
-  char msgbuf[80] = "Retrying bad sectors... Retry ";
-  const int msglen = std::strlen( msgbuf );
-  bool forward = !reverse;
-
-  for( int retry = 1; max_retries < 0 || retry <= max_retries; ++retry )
+  char cmd[32], name[32], value[64];
+  const int n = std::sscanf( line.c_str(), "%31s %31s %63s", cmd, name, value );
+  if( n <= 0 ) return "error: empty command\n";
+  if( std::strcmp( cmd, "status" ) == 0 && n == 1 )
     {
-    first_post = true;
-    snprintf( msgbuf + msglen, ( sizeof msgbuf ) - msglen, "%d %s",
-              retry, forward ? "(forwards)" : "(backwards)" );
-    int retval = forward ? fcopy_errors( msgbuf, retry ) :
-                           rcopy_errors( msgbuf, retry );
-    if( retval != -3 ) return retval;
-    if( !unidirectional ) forward = !forward;
-    if( retry >= INT_MAX ) break;
+    char buf[1024];
+    snprintf( buf, sizeof buf,
+              "status: %s\ncurrent-pos: %lld\nrescued: %lld\n"
+              "non-tried: %lld\nnon-trimmed: %lld\nnon-scraped: %lld\n"
+              "bad-sector: %lld\nerrors: %ld\ncurrent-rate: %lld\n"
+              "average-rate: %lld\nrun-time: %ld\nmax-read-rate: %lld\n"
+              "min-read-rate: %lld\nskip-size: %d,%d\npause: %ld\n"
+              "timeout: %ld\nmax-errors: %ld\ndirect-read: %lld\n"
+              "buffered-read: %lld\n",
+              status_name( current_status() ), current_pos(), finished_size,
+              non_tried_size, non_trimmed_size, non_scraped_size,
+              bad_sector_size, errors, c_rate, a_rate, t1 - t0,
+              max_read_rate, min_read_rate, skipbs, max_skipbs, pause,
+              timeout, max_errors, direct_size, buffered_size );
+    return buf;
     }
-  return 0;
-  }
-
-
-// Return values: 1 I/O error, 0 OK, -1 interrupted, -2 mapfile error.
-// Try to read forwards the damaged areas, one sector at a time.
-//
-int Rescuebook::fcopy_errors( const char * const msg, const int retry )
-  {
-  long long pos = 0;
-  bool block_found = false;
-
-  if( retry == 1 && current_status() == retrying &&
-      domain().includes( current_pos() ) )
+  if( std::strcmp( cmd, "checkpoint" ) == 0 && n == 1 )
+    return update_mapfile( odes_, true ) ? "ok\n" :
+                                           "error: can't write mapfile\n";
+  if( std::strcmp( cmd, "skip" ) == 0 && n <= 2 )
     {
-    Block b( current_pos(), 1 );
-    find_chunk( b, Sblock::bad_sector, domain(), hardbs() );
-    if( b.size() > 0 ) pos = b.pos();		// resume
+    const bool phase = ( n == 2 && std::strcmp( name, "phase" ) == 0 );
+    if( n == 2 && !phase && std::strcmp( name, "pass" ) != 0 )
+      return "error: skip what?\n";
+    strategy->skip( *this, phase );
+    return "ok\n";
     }
-
-  while( pos >= 0 )
+  if( std::strcmp( cmd, "set" ) != 0 || n != 3 )
+    return "error: unknown command\n";
+  long long num = 0, max = max_skipbs;
+  long interval = 0;
+  bool ok;
+  if( std::strcmp( name, "max-read-rate" ) == 0 )
+    { ok = !parse_num( value, hardbs(), 0, LLONG_MAX, num );
+      if( ok ) max_read_rate = num; }
+  else if( std::strcmp( name, "min-read-rate" ) == 0 )
+    { ok = !parse_num( value, hardbs(), 0, LLONG_MAX, num );
+      if( ok ) min_read_rate = num; }
+  else if( std::strcmp( name, "max-errors" ) == 0 )
+    { ok = !parse_num( value, 0, -1, LONG_MAX, num );
+      if( ok ) max_errors = num; }
+  else if( std::strcmp( name, "pause" ) == 0 )
+    { ok = !parse_interval( value, interval ); if( ok ) pause = interval; }
+  else if( std::strcmp( name, "timeout" ) == 0 )
+    { ok = !parse_interval( value, interval ); if( ok ) timeout = interval; }
+  else if( std::strcmp( name, "skip-size" ) == 0 )
     {
-    Block b( pos, hardbs() );
-    find_chunk( b, Sblock::bad_sector, domain(), hardbs() );
-    if( b.size() <= 0 ) break;			// no more blocks
-    pos = b.end();
-    block_found = true;
-    int copied_size = 0, error_size = 0;
-    const int retval = copy_and_update( b, copied_size, error_size, msg,
-                                        retrying, true );
-    if( retval ) return retval;
-    update_rates();
-    if( error_size > 0 && exit_on_error ) { e_code |= 2; return 1; }
-    if( !update_mapfile( odes_ ) ) return -2;
+    const char * const comma = std::strchr( value, ',' );
+    ok = ( !parse_num( value, hardbs(), 0, Rb_options::max_max_skipbs,
+                       num, true ) &&
+           ( !comma || !parse_num( comma + 1, hardbs(), num,
+                                   Rb_options::max_max_skipbs, max ) ) &&
+           ( num == 0 || num >= Rb_options::default_skipbs ) && max >= num );
+    if( ok )
+      { skipbs = round_up( num, hardbs() );
+        max_skipbs = round_up( max, hardbs() ); }
     }
-  if( !block_found ) return 0;
-  return -3;
+  else return "error: unknown option\n";
+  return ok ? "ok\n" : "error: bad value\n";
   }
 
 
-// Return values: 1 I/O error, 0 OK, -1 interrupted, -2 mapfile error.
-// Try to read backwards the damaged areas, one sector at a time.
+// Serves the clients waiting on the control socket, if any.
 //
-int Rescuebook::rcopy_errors( const char * const msg, const int retry )
+void Rescuebook::serve_control()
   {
-  long long end = LLONG_MAX;
-  bool block_found = false;
-
-  if( retry == 1 && current_status() == retrying &&
-      domain().includes( current_pos() - 1 ) )
-    {
-    Block b( current_pos() - 1, 1 );
-    rfind_chunk( b, Sblock::bad_sector, domain(), hardbs() );
-    if( b.size() > 0 ) end = b.end();		// resume
-    }
-
-  while( end > 0 )
-    {
-    Block b( end - hardbs(), hardbs() );
-    rfind_chunk( b, Sblock::bad_sector, domain(), hardbs() );
-    if( b.size() <= 0 ) break;			// no more blocks
-    end = b.pos();
-    block_found = true;
-    int copied_size = 0, error_size = 0;
-    const int retval = copy_and_update( b, copied_size, error_size, msg,
-                                        retrying, false );
-    if( retval ) return retval;
-    update_rates();
-    if( error_size > 0 && exit_on_error ) { e_code |= 2; return 1; }
-    if( !update_mapfile( odes_ ) ) return -2;
-    }
-  if( !block_found ) return 0;
-  return -3;
+  std::string line;
+  int cfd;
+  while( ( cfd = control->accept_command( line ) ) >= 0 )
+    control->reply( cfd, control_reply( line ) );
   }
 
 
@@ -607,14 +615,15 @@ void Rescuebook::update_rates( const bool force )
     if( verbosity >= 0 )
       {
       std::fputs( "\n\n\n\n\n", stdout );
+      if( ides_direct >= 0 ) std::fputc( '\n', stdout );
       if( preview_lines > 0 )
         for( int i = -2; i < preview_lines; ++i ) std::fputc( '\n', stdout );
       }
     }
 
-  long t2 = std::time( 0 );
+  long t2 = current_time();
   if( max_read_rate > 0 && finished_size - last_size > max_read_rate && t2 == t1 )
-    { sleep( 1 ); t2 = std::time( 0 ); }
+    { wait_seconds( 1 ); t2 = current_time(); }
   if( t2 < t1 )					// clock jumped back
     {
     const long delta = std::min( t0, t1 - t2 );
@@ -655,6 +664,7 @@ void Rescuebook::show_status( const long long ipos, const char * const msg,
     if( verbosity >= 0 )
       {
       std::printf( "\r%s%s%s%s%s", up, up, up, up, up );
+      if( ides_direct >= 0 ) std::fputs( up, stdout );
       if( preview_lines > 0 )
         {
         for( int i = -2; i < preview_lines; ++i ) std::fputs( up, stdout );
@@ -702,6 +712,11 @@ void Rescuebook::show_status( const long long ipos, const char * const msg,
       std::printf( "percent rescued: %s      time since last successful read: %11s\n",
                    format_percentage( finished_size, domain().in_size(), 3, 2 ),
                    format_time( t1 - ts ) );
+      if( ides_direct >= 0 )
+        std::printf( "   direct: %9sB,    buffered: %9sB,  direct share: %8s\n",
+                     format_num( direct_size ), format_num( buffered_size ),
+                     format_percentage( direct_size,
+                       std::max( 1LL, direct_size + buffered_size ), 3, 2 ) );
       if( msg && msg[0] && !errors_or_timeout() )
         {
         const int len = std::strlen( msg ); std::printf( "\r%s", msg );
@@ -721,10 +736,13 @@ void Rescuebook::show_status( const long long ipos, const char * const msg,
 
 Rescuebook::Rescuebook( const long long offset, const long long isize,
                         Domain & dom, const Domain * const test_dom,
-                        const Rb_options & rb_opts, const char * const iname,
-                        const char * const mapname, const int cluster,
-                        const int hardbs, const bool synchronous )
-  : Mapbook( offset, isize, dom, mapname, cluster, hardbs, rb_opts.complete_only ),
+                        Input_model * const model, const Rb_options & rb_opts,
+                        const char * const iname, const char * const mapname,
+                        const int cluster, const int hardbs,
+                        const bool synchronous )
+  : Mapbook( offset, isize, dom, mapname, cluster, hardbs,
+             rb_opts.complete_only, rb_opts.page_file, rb_opts.page_cache_size,
+             rb_opts.mark_bad ),
     Rb_options( rb_opts ),
     error_rate( 0 ),
     sparse_size( sparse ? 0 : -1 ),
@@ -734,15 +752,33 @@ Rescuebook::Rescuebook( const long long offset, const long long isize,
     bad_sector_size( 0 ),
     finished_size( 0 ),
     test_domain( test_dom ),
+    input_model( model ),
     iname_( iname ),
+    input_size( 0 ),
     e_code( 0 ),
+    ides_direct( -1 ),
+    direct_size( 0 ),
+    buffered_size( 0 ),
+    troubled_reads( 0 ),
+    mapped_input( 0 ),
+    strategy( new_rescue_strategy( strategy_name ) ),
+    control( 0 ),
     synchronous_( synchronous ),
-    voe_ipos( -1 ), voe_buf( new uint8_t[hardbs] ),
+    voe_ipos( -1 ), voe_buf( iobuf_voe() ),
     a_rate( 0 ), c_rate( 0 ), first_size( 0 ), last_size( 0 ),
     iobuf_ipos( -1 ), last_ipos( 0 ), t0( 0 ), t1( 0 ), ts( 0 ), oldlen( 0 ),
     rates_updated( false ), sliding_avg( 30 ), first_post( false ),
     first_read( true )
   {
+  if( !strategy )
+    { show_error( "Unknown rescue strategy." ); std::exit( 1 ); }
+  if( mark_bad )
+    {
+    if( !mark_file ) std::memset( iobuf2(), 0, softbs() );
+    else if( !read_mark_buffer() )
+      { show_error( "Can't read fill data for bad areas", errno );
+        std::exit( 1 ); }
+    }
   if( preview_lines > softbs() / 16 ) preview_lines = softbs() / 16;
   const long long csize = isize / 100;
   if( isize > 0 && skipbs > 0 && max_skipbs == Rb_options::max_max_skipbs &&
@@ -750,7 +786,30 @@ Rescuebook::Rescuebook( const long long offset, const long long isize,
     max_skipbs = std::max( (long long)skipbs, csize );
   skipbs = round_up( skipbs, hardbs );		// make multiple of hardbs
   max_skipbs = round_up( max_skipbs, hardbs );
-
+  packing( !paged() );			// all passes are position based
+
+  // If the rescue domain includes the whole mapfile, the totals counted
+  // while reading the mapfile make the scans below unnecessary when
+  // they would not change anything.
+  const Map_summary & s = mapfile_summary();
+  const bool use_summary = mapfile_exists() && s.areas == sblocks() &&
+    s.extent == extent() && domain().blocks() == 1 &&
+    domain().includes( extent() ) &&
+    ( !retrim || s.size( Sblock::non_scraped ) +
+                 s.size( Sblock::bad_sector ) == 0 ) &&
+    ( !try_again || s.size( Sblock::non_scraped ) +
+                    s.size( Sblock::non_trimmed ) == 0 );
+  if( use_summary )
+    {
+    non_tried_size = s.size( Sblock::non_tried );
+    non_trimmed_size = s.size( Sblock::non_trimmed );
+    non_scraped_size = s.size( Sblock::non_scraped );
+    bad_sector_size = s.size( Sblock::bad_sector );
+    finished_size = s.size( Sblock::finished );
+    errors = s.areas_of( Sblock::bad_sector );
+    if( new_errors_only ) max_errors += errors;
+    return;
+    }
   if( retrim )
     for( long index = 0; index < sblocks(); ++index )
       {
@@ -777,25 +836,43 @@ Rescuebook::Rescuebook( const long long offset, const long long isize,
 
 
 #ifdef DDRESCUE_USE_DVDREAD
-int Rescuebook::do_rescue( const int ides, const int odes ) {
-  return do_rescue_internal( false, ides, NULL, odes );
+int Rescuebook::do_rescue( const int ides, const int odes, const int idirect ) {
+  return do_rescue_internal( false, ides, NULL, odes, idirect );
 }
 
 int Rescuebook::do_dvd_rescue( dvd_reader_t *idvd, const int odes ) {
-  return do_rescue_internal( true, -1, idvd, odes );
+  return do_rescue_internal( true, -1, idvd, odes, -1 );
 }
 #endif
 
 // Return values: 1 I/O error, 0 OK.
 //
 #ifdef DDRESCUE_USE_DVDREAD
-int Rescuebook::do_rescue_internal( bool dvd, const int ides, dvd_reader_t *idvd, const int odes )
+int Rescuebook::do_rescue_internal( bool dvd, const int ides, dvd_reader_t *idvd,
+                                    const int odes, const int idirect )
 #else
-int Rescuebook::do_rescue( const int ides, const int odes )
+int Rescuebook::do_rescue( const int ides, const int odes, const int idirect )
 #endif
   {
-  bool copy_pending = false, trim_pending = false, scrape_pending = false;
-  ides_ = ides; odes_ = odes;
+  ides_ = ides; odes_ = odes; ides_direct = idirect;
+  if( mmap_in ) mapped_input = new Mapped_input( ides_ );
+  if( control_name )
+    {
+    control = new Control_socket;
+    if( !control->open( control_name ) )
+      { show_error( "Can't create control socket", errno ); return 1; }
+    }
+  if( reattach_pattern )
+    {
+    const char * const id = device_id( ides_ );
+    if( id ) input_id = id;
+    input_size = lseek( ides_, 0, SEEK_END );
+    Block b( 0, hardbs() );	// signature of input from the data rescued
+    find_chunk( b, Sblock::finished, domain(), hardbs() );
+    if( b.size() == hardbs() && b.pos() % hardbs() == 0 &&
+        readblock( ides_, voe_buf, hardbs(), b.pos() ) == hardbs() )
+      voe_ipos = b.pos();
+    }
 #ifdef DDRESCUE_USE_DVDREAD
   idvd_ = idvd;
   dvd_ = dvd;
@@ -805,9 +882,6 @@ int Rescuebook::do_rescue( const int ides, const int odes )
   }
 #endif
 
-  if( non_tried_size ) copy_pending = trim_pending = scrape_pending = true;
-  if( non_trimmed_size )              trim_pending = scrape_pending = true;
-  if( non_scraped_size )                             scrape_pending = true;
   set_signals();
   if( verbosity >= 0 )
     {
@@ -832,16 +906,8 @@ int Rescuebook::do_rescue( const int ides, const int odes )
       std::fputs( "Current status\n", stdout );
       }
     }
-  int retval = 0;
   update_rates();				// first call
-  if( copy_pending && !errors_or_timeout() )
-    retval = copy_non_tried();
-  if( retval == 0 && trim_pending && !notrim && !errors_or_timeout() )
-    retval = trim_errors();
-  if( retval == 0 && scrape_pending && !noscrape && !errors_or_timeout() )
-    retval = scrape_errors();
-  if( retval == 0 && max_retries != 0 && !errors_or_timeout() )
-    retval = copy_errors();
+  int retval = run_strategy();
   if( !rates_updated ) update_rates( true );	// force update of e_code
   show_status( -1, retval ? 0 : "Finished", true );
 
@@ -879,6 +945,9 @@ int Rescuebook::do_rescue( const int ides, const int odes )
   if( final_msg().size() )
     { if( final_errno() ) show_error( final_msg().c_str(), final_errno() );
       else { std::fputs( final_msg().c_str(), stdout ); std::fputc( '\n', stdout ); } }
+  if( verbosity >= 1 && mapfile_updates() > 0 )
+    std::printf( "Mapfile updates: %ld,  total time: %.3fs,  longest: %.3fs\n",
+                 mapfile_updates(), update_time(), max_update_time() );
   if( close( odes_ ) != 0 )
     { show_error( "Can't close outfile", errno );
       if( retval == 0 ) retval = 1; }
@@ -886,6 +955,8 @@ int Rescuebook::do_rescue( const int ides, const int odes )
     show_error( "warning: Error closing the rates logging file." );
   if( !read_logger.close_file() )
     show_error( "warning: Error closing the reads logging file." );
+  if( !trace_logger.close_file() )
+    show_error( "warning: Error closing the read trace file." );
   if( retval ) return retval;		// errors have priority over signals
   if( signaled ) return signaled_exit();
   return 0;
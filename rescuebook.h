@@ -52,11 +52,18 @@ public:
 struct Rb_options
   {
   enum { default_skipbs = 65536, max_max_skipbs = 1 << 30 };
+  enum { default_page_cache_size = 64 << 20 };
 
   long long max_error_rate;
   long long min_outfile_size;
   long long max_read_rate;
   long long min_read_rate;
+  long long page_cache_size;	// memory used by the map if page_file
+  const char * control_name;	// control socket, or 0
+  const char * mark_file;	// fill data for bad areas, or 0
+  const char * page_file;	// keep the map in this file, or 0
+  const char * reattach_pattern;	// where a lost input may reappear, or 0
+  const char * strategy_name;	// rescue strategy, or 0 for default
   long max_errors;
   long pause;
   long timeout;
@@ -66,8 +73,11 @@ struct Rb_options
   int preview_lines;		// preview lines to show. 0 = disable
   int skipbs;			// initial size to skip on read error
   int max_skipbs;		// maximum size to skip on read error
+  bool auto_direct;		// choose direct or buffered input per read
   bool complete_only;
   bool exit_on_error;
+  bool mark_bad;		// write fill or location data into bad areas
+  bool mmap_in;			// read input through Mapped_input
   bool new_errors_only;
   bool noscrape;
   bool notrim;
@@ -81,10 +91,14 @@ struct Rb_options
 
   Rb_options()
     : max_error_rate( -1 ), min_outfile_size( -1 ), max_read_rate( 0 ),
-      min_read_rate( -1 ), max_errors( -1 ), pause( 0 ), timeout( -1 ),
-      cpass_bitset( 7 ), max_retries( 0 ), o_direct_in( 0 ),
+      min_read_rate( -1 ), page_cache_size( default_page_cache_size ),
+      control_name( 0 ), mark_file( 0 ), page_file( 0 ), reattach_pattern( 0 ), strategy_name( 0 ),
+      max_errors( -1 ), pause( 0 ), timeout( -1 ), cpass_bitset( 7 ),
+      max_retries( 0 ), o_direct_in( 0 ),
       preview_lines( 0 ), skipbs( default_skipbs ), max_skipbs( max_max_skipbs ),
-      complete_only( false ), exit_on_error( false ),
+      auto_direct( false ), complete_only( false ), exit_on_error( false ),
+      mark_bad( false ),
+      mmap_in( false ),
       new_errors_only( false ), noscrape( false ), notrim( false ),
       reopen_on_error( false ), retrim( false ), reverse( false ),
       sparse( false ), try_again( false ), unidirectional( false ),
@@ -96,14 +110,22 @@ struct Rb_options
                min_outfile_size == o.min_outfile_size &&
                max_read_rate == o.max_read_rate &&
                min_read_rate == o.min_read_rate &&
+               page_cache_size == o.page_cache_size &&
+               control_name == o.control_name &&
+               mark_file == o.mark_file &&
+               page_file == o.page_file &&
+               reattach_pattern == o.reattach_pattern &&
+               strategy_name == o.strategy_name &&
                max_errors == o.max_errors && pause == o.pause &&
                timeout == o.timeout && cpass_bitset == o.cpass_bitset &&
                max_retries == o.max_retries &&
                o_direct_in == o.o_direct_in &&
                preview_lines == o.preview_lines &&
                skipbs == o.skipbs && max_skipbs == o.max_skipbs &&
+               auto_direct == o.auto_direct &&
                complete_only == o.complete_only &&
                exit_on_error == o.exit_on_error &&
+               mark_bad == o.mark_bad && mmap_in == o.mmap_in &&
                new_errors_only == o.new_errors_only &&
                noscrape == o.noscrape && notrim == o.notrim &&
                reopen_on_error == o.reopen_on_error &&
@@ -123,12 +145,22 @@ class Rescuebook : public Mapbook, public Rb_options
   long long non_tried_size, non_trimmed_size, non_scraped_size;
   long long bad_sector_size, finished_size;
   const Domain * const test_domain;	// good/bad map for test mode
-  const char * const iname_;
+  Input_model * const input_model;	// simulated input device, or 0
+  const char * iname_;			// changes if input is reattached
+  std::string reattached_name;		// storage for iname_
+  std::string input_id;			// identity of input, for reattach
+  long long input_size;
   int e_code;				// error code for errors_or_timeout
 					// 1 rate, 2 errors, 4 timeout,
 					// 8 other (explained in final_msg)
   long errors;				// error areas found so far
   int ides_, odes_;			// input and output file descriptors
+  int ides_direct;			// O_DIRECT input if auto_direct, or -1
+  long long direct_size, buffered_size;	// bytes read each way
+  int troubled_reads;			// reads to do direct after trouble
+  Mapped_input * mapped_input;		// if mmap_in
+  Rescue_strategy * const strategy;	// decides the blocks to read
+  Control_socket * control;		// if control_name
 #ifdef DDRESCUE_USE_DVDREAD
   bool dvd_;
   dvd_reader_t *idvd_;
@@ -148,48 +180,76 @@ class Rescuebook : public Mapbook, public Rb_options
   bool first_post;			// first read in current pass
   bool first_read;			// first read overall
 
-  void change_chunk_status( const Block & b, const Sblock::Status st );
   bool extend_outfile_size();
+  bool read_mark_buffer();
+  bool mark_area( const Block & b, const Sblock::Status st );
+  bool write_sparse( const uint8_t * const buf, const int size,
+                     const long long pos );
+  struct Store_args		// arguments of store_guarded
+    { Rescuebook * rb; const uint8_t * buf; long long ipos; int size;
+      bool ok; };
+  bool store_block( const uint8_t * const buf, const long long ipos,
+                    const int size );
+  static void store_guarded( void * const arg );
+  bool near_errors( const Block & b ) const;
+  bool use_direct( const Block & b ) const;
   int copy_block( const Block & b, int & copied_size, int & error_size );
   void initialize_sizes();
   bool errors_or_timeout()
     { if( max_errors >= 0 && errors > max_errors ) e_code |= 2;
       return ( e_code != 0 ); }
-  void reduce_min_read_rate()
-    { if( min_read_rate > 0 ) min_read_rate /= 10; }
-  bool slow_read() const
-    { return ( t1 - t0 >= 30 &&		// no slow reads for first 30s
-               ( ( min_read_rate > 0 && c_rate < min_read_rate &&
-                   c_rate < a_rate / 2 ) ||
-                 ( min_read_rate == 0 && c_rate < a_rate / 10 ) ) ); }
   int copy_and_update( const Block & b, int & copied_size,
                        int & error_size, const char * const msg,
                        const Status curr_st, const bool forward,
                        const Sblock::Status st = Sblock::bad_sector );
 #ifdef DDRESCUE_USE_DVDREAD
-  int do_rescue_internal( bool dvd, const int ides, dvd_reader_t *idvd, const int odes );
+  int do_rescue_internal( bool dvd, const int ides, dvd_reader_t *idvd,
+                          const int odes, const int idirect );
 #endif
   bool reopen_infile();
-  int copy_non_tried();
-  int fcopy_non_tried( const char * const msg, const int pass );
-  int rcopy_non_tried( const char * const msg, const int pass );
-  int trim_errors();
-  int scrape_errors();
-  int copy_errors();
-  int fcopy_errors( const char * const msg, const int retry );
-  int rcopy_errors( const char * const msg, const int retry );
+  bool same_input( const int fd );
+  int wait_reattach();
+  int run_strategy();
+  std::string control_reply( const std::string & line );
+  void serve_control();
   void update_rates( const bool force = false );
   void show_status( const long long ipos, const char * const msg = 0,
                     const bool force = false );
 public:
   Rescuebook( const long long offset, const long long isize,
               Domain & dom, const Domain * const test_dom,
-              const Rb_options & rb_opts, const char * const iname,
+              Input_model * const model, const Rb_options & rb_opts, const char * const iname,
               const char * const mapname, const int cluster,
               const int hardbs, const bool synchronous );
-  ~Rescuebook() { delete[] voe_buf; }
+  ~Rescuebook() { delete control; delete strategy; delete mapped_input; }
+
+  // state seen by the Rescue_strategy
+  long long status_size( const Sblock::Status st ) const
+    {
+    switch( st )
+      {
+      case Sblock::non_tried:   return non_tried_size;
+      case Sblock::non_trimmed: return non_trimmed_size;
+      case Sblock::non_scraped: return non_scraped_size;
+      case Sblock::bad_sector:  return bad_sector_size;
+      case Sblock::finished:    return finished_size;
+      }
+    return 0;
+    }
+  long errors_found() const { return errors; }
+  long long average_rate() const { return a_rate; }
+  long long current_rate() const { return c_rate; }
+  long run_time() const { return t1 - t0; }	// seconds since start
+  bool slow_read() const
+    { return ( t1 - t0 >= 30 &&		// no slow reads for first 30s
+               ( ( min_read_rate > 0 && c_rate < min_read_rate &&
+                   c_rate < a_rate / 2 ) ||
+                 ( min_read_rate == 0 && c_rate < a_rate / 10 ) ) ); }
+  void reduce_min_read_rate()
+    { if( min_read_rate > 0 ) min_read_rate /= 10; }
+  bool change_chunk_status( const Block & b, const Sblock::Status st );
 
-  int do_rescue( const int ides, const int odes );
+  int do_rescue( const int ides, const int odes, const int idirect = -1 );
 #ifdef DDRESCUE_USE_DVDREAD
   int do_dvd_rescue( dvd_reader_t *idvd, const int odes );
 #endif
@@ -0,0 +1,372 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2004-2016 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "block.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+
+namespace {
+
+const long long slot_size = Sblock_vector::page_entries * sizeof (Sblock);
+
+
+// Returns the number of bytes really read or written.
+// If (returned value < size), it is always an error.
+//
+long long pread_all( const int fd, void * const buf, const long long size,
+                     const long long pos )
+  {
+  long long sz = 0;
+  while( sz < size )
+    {
+    const long n = pread( fd, (uint8_t *)buf + sz, size - sz, pos + sz );
+    if( n > 0 ) sz += n;
+    else if( n == 0 || errno != EINTR ) break;
+    }
+  return sz;
+  }
+
+
+long long pwrite_all( const int fd, const void * const buf,
+                      const long long size, const long long pos )
+  {
+  long long sz = 0;
+  while( sz < size )
+    {
+    const long n = pwrite( fd, (const uint8_t *)buf + sz, size - sz, pos + sz );
+    if( n > 0 ) sz += n;
+    else if( n < 0 && errno != EINTR ) break;
+    }
+  return sz;
+  }
+
+
+void page_file_error( const char * const msg )
+  {
+  show_error( msg, errno );
+  std::exit( 1 );
+  }
+
+} // end namespace
+
+
+Sblock_vector::~Sblock_vector()
+  {
+  for( unsigned long p = 0; p < pages.size(); ++p ) delete pages[p].data;
+  if( fd >= 0 ) close( fd );
+  }
+
+
+// Keeps in memory at most 'cache_size' bytes of pages (but no less than
+// 'min_cache_pages' pages) and writes the rest to the page file 'name'.
+// The page file is removed at once, so that it disappears on exit.
+// Returns false if the page file can't be created.
+//
+bool Sblock_vector::use_page_file( const char * const name,
+                                   const long long cache_size )
+  {
+  struct stat st;
+  if( fd >= 0 ) return false;
+  if( stat( name, &st ) == 0 && !S_ISREG( st.st_mode ) )
+    { errno = 0; return false; }
+  fd = open( name, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, S_IRUSR | S_IWUSR );
+  if( fd < 0 ) return false;
+  unlink( name );
+  max_resident = std::max( (long long)min_cache_pages, cache_size / slot_size );
+  for( unsigned long p = 0; p < pages.size(); ++p )
+    if( pages[p].data ) resident.push_back( p );
+  return true;
+  }
+
+
+// Returns the index of the page containing sblock i. Updates the index
+// of the first sblock of the pages traversed.
+//
+long Sblock_vector::find_page( const long i ) const
+  {
+  const long last = pages.size() - 1;
+  if( i >= size_ - pages[last].size )		// last page
+    { pages[last].first = size_ - pages[last].size; return last; }
+  if( valid_pages <= 0 ) { pages[0].first = 0; valid_pages = 1; }
+  long p = valid_pages - 1;
+  if( i >= pages[p].first + pages[p].size )
+    {
+    do { pages[p+1].first = pages[p].first + pages[p].size; ++p; }
+    while( i >= pages[p].first + pages[p].size );
+    valid_pages = p + 1;
+    return p;
+    }
+  long l = 0;					// binary search
+  while( l < p )
+    {
+    const long m = ( l + p + 1 ) / 2;
+    if( pages[m].first <= i ) l = m; else p = m - 1;
+    }
+  return l;
+  }
+
+
+// Evicts the least recently used pages until there is room in memory for
+// one more page.
+//
+void Sblock_vector::make_room() const
+  {
+  while( (long)resident.size() >= max_resident )
+    {
+    unsigned long k = 0;
+    for( unsigned long j = 1; j < resident.size(); ++j )
+      if( pages[resident[j]].last_use < pages[resident[k]].last_use ) k = j;
+    evict_page( resident[k] );
+    }
+  }
+
+
+// Reads page p from the page file, evicting the least recently used pages
+// if needed, and advises the kernel to read ahead the next pages in the
+// direction of access.
+//
+void Sblock_vector::load_page( const long p ) const
+  {
+  if( fd < 0 ) internal_error( "page not in memory." );
+  make_room();
+  Page & pg = pages[p];
+  pg.data = new std::vector< Sblock >( pg.size, Sblock( 0, 0, Sblock::non_tried ) );
+  const long long size = pg.size * (long long)sizeof (Sblock);
+  if( size > 0 && pread_all( fd, &(*pg.data)[0], size, pg.file_pos ) != size )
+    page_file_error( "Error reading page file" );
+  pg.dirty = false;
+  resident.push_back( p );
+
+  const int dir = ( p >= last_loaded ) ? 1 : -1;
+  last_loaded = p;
+#if defined POSIX_FADV_WILLNEED
+  for( int k = 1; k <= prefetch_pages; ++k )
+    {
+    const long q = p + k * dir;
+    if( q < 0 || q >= (long)pages.size() ) break;
+    if( !pages[q].data && pages[q].file_pos >= 0 )
+      posix_fadvise( fd, pages[q].file_pos, pages[q].size * sizeof (Sblock),
+                     POSIX_FADV_WILLNEED );
+    }
+#endif
+  }
+
+
+void Sblock_vector::evict_page( const long p ) const
+  {
+  Page & pg = pages[p];
+  if( pg.dirty || pg.file_pos < 0 )
+    {
+    if( pg.file_pos < 0 )
+      {
+      if( free_slots.size() )
+        { pg.file_pos = free_slots.back(); free_slots.pop_back(); }
+      else { pg.file_pos = file_end; file_end += slot_size; }
+      }
+    const long long size = pg.size * (long long)sizeof (Sblock);
+    if( size > 0 && pwrite_all( fd, &(*pg.data)[0], size, pg.file_pos ) != size )
+      page_file_error( "Error writing page file" );
+    pg.dirty = false;
+    }
+  delete pg.data; pg.data = 0;
+  for( unsigned long j = 0; j < resident.size(); ++j )
+    if( resident[j] == p )
+      { resident[j] = resident.back(); resident.pop_back(); break; }
+  if( cur_page == p ) { cur_page = -1; cur_first = cur_size = 0; }
+  }
+
+
+void Sblock_vector::seek( const long i ) const
+  {
+  if( i < 0 || i >= size_ ) internal_error( "sblock index out of range." );
+  const long p = find_page( i );
+  if( !pages[p].data ) load_page( p );
+  pages[p].last_use = ++use_count;
+  cur_page = p; cur_first = pages[p].first; cur_size = pages[p].size;
+  }
+
+
+// Returns the data of page p, to be modified.
+//
+std::vector< Sblock > & Sblock_vector::page_data( const long p )
+  {
+  if( !pages[p].data ) load_page( p );
+  pages[p].last_use = ++use_count;
+  pages[p].dirty = true;
+  return *pages[p].data;
+  }
+
+
+// Inserts a new empty page in memory at index p.
+//
+void Sblock_vector::insert_page( const long p )
+  {
+  if( fd >= 0 )
+    {
+    make_room();
+    for( unsigned long j = 0; j < resident.size(); ++j )
+      if( resident[j] >= p ) ++resident[j];
+    resident.push_back( p );
+    }
+  pages.insert( pages.begin() + p, Page() );
+  pages[p].data = new std::vector< Sblock >;
+  pages[p].last_use = ++use_count;
+  if( last_loaded >= p ) ++last_loaded;
+  invalidate( p );
+  }
+
+
+void Sblock_vector::remove_page( const long p )
+  {
+  delete pages[p].data;
+  if( pages[p].file_pos >= 0 ) free_slots.push_back( pages[p].file_pos );
+  pages.erase( pages.begin() + p );
+  for( unsigned long j = 0; j < resident.size(); )
+    {
+    if( resident[j] == p )
+      { resident[j] = resident.back(); resident.pop_back(); continue; }
+    if( resident[j] > p ) --resident[j];
+    ++j;
+    }
+  if( last_loaded > p ) --last_loaded;
+  invalidate( p );
+  }
+
+
+// Moves the second half of page p to a new page.
+//
+void Sblock_vector::split_page( const long p )
+  {
+  const long half = page_entries / 2;
+  page_data( p );
+  insert_page( p + 1 );
+  std::vector< Sblock > & d = *pages[p].data;
+  std::vector< Sblock > & d2 = *pages[p+1].data;
+  d2.assign( d.begin() + half, d.end() );
+  d.erase( d.begin() + half, d.end() );
+  std::vector< Sblock >( d ).swap( d );		// release unused memory
+  pages[p+1].size = d2.size();
+  pages[p].size = half;
+  }
+
+
+// Joins page p+1 to page p if both together are small.
+//
+void Sblock_vector::merge_pages( const long p )
+  {
+  if( p < 0 || p + 1 >= (long)pages.size() ||
+      pages[p].size + pages[p+1].size > page_entries / 2 ) return;
+  const std::vector< Sblock > & d2 = page_data( p + 1 );
+  std::vector< Sblock > & d = page_data( p );
+  d.insert( d.end(), d2.begin(), d2.end() );
+  pages[p].size = d.size();
+  remove_page( p + 1 );
+  }
+
+
+void Sblock_vector::clear()
+  {
+  for( unsigned long p = 0; p < pages.size(); ++p ) delete pages[p].data;
+  pages.clear();
+  resident.clear();
+  free_slots.clear();
+  file_end = 0;
+  size_ = 0;
+  last_loaded = -1;
+  invalidate( 0 );
+  }
+
+
+void Sblock_vector::insert( const long i, const Sblock * const first,
+                            const Sblock * const last )
+  {
+  const long n = last - first;
+  if( n <= 0 ) return;
+  if( i < 0 || i > size_ ) internal_error( "sblock index out of range." );
+  long p, off;
+  if( pages.empty() ) { insert_page( 0 ); p = 0; off = 0; }
+  else if( i == size_ )
+    {
+    p = pages.size() - 1; off = pages[p].size;
+    if( off >= page_entries ) { insert_page( ++p ); off = 0; }	// append
+    }
+  else { p = find_page( i ); off = i - pages[p].first; }
+  std::vector< Sblock > & d = page_data( p );
+  d.insert( d.begin() + off, first, last );
+  pages[p].size += n;
+  size_ += n;
+  invalidate( p + 1 );
+  while( pages[p].size > page_entries ) split_page( p++ );
+  }
+
+
+void Sblock_vector::erase( const long first, const long end )
+  {
+  if( first < 0 || first > end || end > size_ )
+    internal_error( "sblock index out of range." );
+  long last = end;
+  while( first < last )
+    {
+    const long p = find_page( first );
+    const long off = first - pages[p].first;
+    const long n = std::min( last - first, pages[p].size - off );
+    std::vector< Sblock > & d = page_data( p );
+    d.erase( d.begin() + off, d.begin() + off + n );
+    if( d.capacity() / 4 > d.size() )		// release unused memory
+      std::vector< Sblock >( d ).swap( d );
+    pages[p].size -= n;
+    size_ -= n;
+    last -= n;
+    invalidate( p + 1 );
+    if( pages[p].size <= 0 ) remove_page( p );
+    }
+  if( size_ > 0 )
+    {
+    const long p = find_page( std::min( first, size_ - 1 ) );
+    merge_pages( p );
+    merge_pages( p - 1 );
+    }
+  }
+
+
+long long Sblock_vector::memory_size() const
+  {
+  long long size = sizeof *this + pages.capacity() * sizeof (Page) +
+                   resident.capacity() * sizeof resident[0] +
+                   free_slots.capacity() * sizeof free_slots[0];
+  for( unsigned long p = 0; p < pages.size(); ++p )
+    if( pages[p].data )
+      size += sizeof *pages[p].data +
+              pages[p].data->capacity() * sizeof (Sblock);
+  return size;
+  }
@@ -0,0 +1,370 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2004-2016 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "block.h"
+#include "simulator.h"
+
+
+namespace {
+
+// Reads up to 'max_tries' probabilities from 'p'.
+// Returns the number of probabilities read, or 0 if error.
+//
+int parse_probs( const char * p, double prob[] )
+  {
+  int n = 0;
+  while( true )
+    {
+    while( std::isspace( *p ) ) ++p;
+    if( !*p ) break;
+    if( n >= Simulator::max_tries ) return 0;
+    char * tail;
+    const double d = std::strtod( p, &tail );
+    if( tail == p || d < 0 || d > 1 ) return 0;
+    prob[n++] = d;
+    p = tail;
+    }
+  return n;
+  }
+
+
+bool pos_less( const Block & b1, const Block & b2 )
+  { return b1.pos() < b2.pos(); }
+
+
+// Reads the next line of 'f' discarding comments and blank lines.
+// Returns 0 if at EOF.
+//
+const char * next_line( FILE * const f, char * const line, const int size,
+                        int & linenum )
+  {
+  while( std::fgets( line, size, f ) )
+    {
+    ++linenum;
+    char * const p = std::strchr( line, '#' );
+    if( p ) *p = 0;
+    int i = 0;
+    while( line[i] && std::isspace( (unsigned char)line[i] ) ) ++i;
+    if( line[i] ) return line + i;
+    }
+  return 0;
+  }
+
+
+FILE * open_model( const char * const name, const char * const type )
+  {
+  FILE * const f = std::fopen( name, "r" );
+  if( !f )
+    {
+    char buf[80];
+    snprintf( buf, sizeof buf, "Can't open %s file '%s'", type, name );
+    show_error( buf, errno );
+    std::exit( 1 );
+    }
+  return f;
+  }
+
+
+void model_error( const char * const name, const char * const type,
+                  const int linenum )
+  {
+  char buf[80];
+  snprintf( buf, sizeof buf, "error in %s file %s, line %d.",
+            type, name, linenum );
+  show_error( buf );
+  std::exit( 2 );
+  }
+
+} // end namespace
+
+
+// Parses one line of the model file. Times are in milliseconds, except
+// for the interval and duration of device resets, which are in seconds.
+//
+bool Simulator::parse_line( const char * const line )
+  {
+  char keyword[32], word[32];
+  int len = 0;
+  if( std::sscanf( line, "%31s %n", keyword, &len ) != 1 ) return false;
+  const char * const args = line + len;
+  long long pos, size, n1, n2;
+  double d1, d2;
+
+  if( std::strcmp( keyword, "seed" ) == 0 )
+    {
+    if( std::sscanf( args, "%lli %n", &n1, &len ) != 1 || args[len] )
+      return false;
+    seed = n1; return true;
+    }
+  if( std::strcmp( keyword, "rate" ) == 0 )
+    {
+    if( std::sscanf( args, "%lli %n", &n1, &len ) != 1 || args[len] ||
+        n1 <= 0 ) return false;
+    rate = n1; return true;
+    }
+  if( std::strcmp( keyword, "seek-time" ) == 0 )
+    {
+    if( std::sscanf( args, "%lf %n", &d1, &len ) != 1 || args[len] ||
+        d1 < 0 ) return false;
+    seek_s = d1 / 1000; return true;
+    }
+  if( std::strcmp( keyword, "error-time" ) == 0 )
+    {
+    if( std::sscanf( args, "%lf %n", &d1, &len ) != 1 || args[len] ||
+        d1 < 0 ) return false;
+    error_s = d1 / 1000; return true;
+    }
+  if( std::strcmp( keyword, "reset" ) == 0 )
+    {
+    if( std::sscanf( args, "%lf %lf %n", &d1, &d2, &len ) != 2 ||
+        args[len] || d1 <= 0 || d2 < 0 ) return false;
+    reset_interval = d1; reset_s = d2; next_reset = d1;
+    return true;
+    }
+
+  if( std::sscanf( args, "%lli %lli %n", &pos, &size, &len ) != 2 ||
+      pos < 0 || size == 0 || size < -1 ) return false;
+  const char * const rest = args + len;
+  if( std::strcmp( keyword, "latency" ) == 0 )
+    {
+    Region r( pos, size, Region::latency );
+    if( std::sscanf( rest, "%31s %lf %n", word, &d1, &len ) == 2 &&
+        std::strcmp( word, "exponential" ) == 0 && !rest[len] && d1 >= 0 )
+      { r.exponential = true; r.min_s = r.max_s = d1 / 1000; }
+    else if( std::sscanf( rest, "%31s %lf %lf %n", word, &d1, &d2, &len ) == 3 &&
+             std::strcmp( word, "uniform" ) == 0 && !rest[len] &&
+             d1 >= 0 && d2 >= d1 )
+      { r.min_s = d1 / 1000; r.max_s = d2 / 1000; }
+    else return false;
+    regions.push_back( r );
+    return true;
+    }
+  if( std::strcmp( keyword, "slow" ) == 0 )
+    {
+    Region r( pos, size, Region::slow );
+    if( std::sscanf( rest, "%lli %n", &r.rate, &len ) != 1 || rest[len] ||
+        r.rate <= 0 ) return false;
+    regions.push_back( r );
+    return true;
+    }
+  if( std::strcmp( keyword, "error" ) == 0 )
+    {
+    Region r( pos, size, Region::error );
+    r.probs = parse_probs( rest, r.prob );
+    if( r.probs <= 0 ) return false;
+    regions.push_back( r );
+    return true;
+    }
+  if( std::strcmp( keyword, "stripe" ) == 0 )
+    {
+    Region r( pos, size, Region::stripe );
+    if( std::sscanf( rest, "%lli %lli %n", &n1, &n2, &len ) != 2 ||
+        n1 <= 0 || n2 <= 0 || n2 > n1 ) return false;
+    r.period = n1; r.width = n2;
+    r.probs = parse_probs( rest + len, r.prob );
+    if( r.probs <= 0 ) return false;
+    regions.push_back( r );
+    return true;
+    }
+  return false;
+  }
+
+
+// Returns a pseudo-random number in [0,1) depending only on the seed and
+// on 'a' and 'b', so that the result of a simulation does not depend on
+// the order in which the sectors are read.
+//
+double Simulator::random( const unsigned long long a,
+                          const unsigned long long b ) const
+  {
+  uint64_t z = seed + a * 0x9E3779B97F4A7C15ULL + b * 0xC2B2AE3D27D4EB4FULL;
+  z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+  z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+  z ^= z >> 31;
+  return ( z >> 11 ) * ( 1.0 / 9007199254740992.0 );	// 2^53
+  }
+
+
+// The probability of failure of a sector depends on the number of times
+// it has already failed. Stripes only fail in the first 'width' bytes of
+// each 'period' bytes.
+//
+bool Simulator::sector_fails( const long long sector )
+  {
+  const long long pos = sector * hardbs_;
+  std::map< long long, int >::iterator it = failures.find( sector );
+  const int tries = ( it != failures.end() ) ? it->second : 0;
+  for( unsigned i = 0; i < regions.size(); ++i )
+    {
+    const Region & r = regions[i];
+    if( ( r.type != Region::error && r.type != Region::stripe ) ||
+        !r.includes( pos ) ||
+        ( r.type == Region::stripe && ( pos - r.pos() ) % r.period >= r.width ) )
+      continue;
+    const double p = r.prob[std::min( tries, r.probs - 1 )];
+    if( p > 0 && random( sector, tries * 64 + i ) < p )
+      {
+      if( it != failures.end() ) ++it->second; else failures[sector] = 1;
+      return true;
+      }
+    }
+  return false;
+  }
+
+
+Simulator::Simulator( const char * const name, const int hardbs )
+  : filename_( name ), seed( 1 ), reads( 0 ), rate( 100000000 ),
+    last_end( -1 ), seek_s( 0.01 ), error_s( 1 ), reset_interval( 0 ),
+    reset_s( 0 ), busy_s( 0 ), next_reset( 0 ), hardbs_( hardbs )
+  {
+  FILE * const f = open_model( filename_, "model" );
+  char buf[256];
+  const char * line;
+  int linenum = 0;
+  while( ( line = next_line( f, buf, sizeof buf, linenum ) ) )
+    if( !parse_line( line ) ) model_error( filename_, "model", linenum );
+  std::fclose( f );
+  }
+
+
+// Simulates the read of block 'b', advancing the virtual clock by the
+// time the device would take to read it.
+//
+int Simulator::read( const Block & b, int & error )
+  {
+  double t = ( b.pos() != last_end ) ? seek_s : 0;
+  long long r = rate;
+  int size = b.size();
+  ++reads;
+  for( unsigned i = 0; i < regions.size(); ++i )
+    {
+    const Region & rg = regions[i];
+    if( !rg.includes( b.pos() ) ) continue;
+    if( rg.type == Region::slow ) r = rg.rate;
+    else if( rg.type == Region::latency )
+      {
+      const double x = random( reads, ( 1ULL << 63 ) + i );
+      if( rg.exponential ) t += -rg.min_s * std::log( 1 - x );
+      else t += rg.min_s + ( rg.max_s - rg.min_s ) * x;
+      }
+    }
+  if( reset_interval > 0 && busy_s >= next_reset )	// device reset
+    { size = 0; t += reset_s; next_reset = busy_s + reset_s + reset_interval; }
+  else
+    for( long long sector = b.pos() / hardbs_; sector * hardbs_ < b.end();
+         ++sector )
+      if( sector_fails( sector ) )
+        { size = std::max( 0LL, sector * hardbs_ - b.pos() ); break; }
+  t += (double)size / r;
+  if( size < b.size() ) { t += error_s; last_end = -1; }
+  else last_end = b.end();
+  busy_s += t;
+  advance_clock( t );
+  error = EIO;
+  return size;
+  }
+
+
+Replayer::Replayer( const char * const name )
+  : filename_( name ), good_s( 0 ), error_s( 0 )
+  {
+  FILE * const f = open_model( filename_, "trace" );
+  std::vector< Block > blocks;
+  long long good_bytes = 0, errors = 0;
+  double good_time = 0, error_time = 0;
+  char buf[256];
+  const char * line;
+  int linenum = 0;
+  while( ( line = next_line( f, buf, sizeof buf, linenum ) ) )
+    {
+    long long pos, size;
+    int copied_size, error, len = 0;
+    double latency;
+    if( std::sscanf( line, "%lli %lli %d %d %lf %n", &pos, &size,
+                     &copied_size, &error, &latency, &len ) != 5 ||
+        line[len] || pos < 0 || size <= 0 || size > INT_MAX ||
+        copied_size < 0 || copied_size > size || error < 0 || latency < 0 )
+      model_error( filename_, "trace", linenum );
+    requests[std::make_pair( pos, (int)size )].outcomes.push_back(
+      Outcome( copied_size, error, latency ) );
+    if( copied_size > 0 ) blocks.push_back( Block( pos, copied_size ) );
+    if( copied_size == size ) { good_bytes += size; good_time += latency; }
+    else if( error ) { ++errors; error_time += latency; }
+    }
+  std::fclose( f );
+
+  std::sort( blocks.begin(), blocks.end(), pos_less );
+  for( unsigned i = 0; i < blocks.size(); ++i )
+    {
+    if( good_blocks.size() && blocks[i].pos() <= good_blocks.back().end() )
+      { Block & gb = good_blocks.back();
+        if( blocks[i].end() > gb.end() ) gb.size( blocks[i].end() - gb.pos() ); }
+    else good_blocks.push_back( blocks[i] );
+    }
+  if( good_bytes > 0 ) good_s = good_time / good_bytes;
+  if( errors > 0 ) error_s = error_time / errors;
+  }
+
+
+// Returns the size of the beginning of 'b' read successfully in the trace.
+//
+int Replayer::good_size( const Block & b ) const
+  {
+  long l = 0, r = good_blocks.size();		// binary search
+  while( l < r )
+    {
+    const long m = ( l + r ) / 2;
+    if( good_blocks[m].pos() <= b.pos() ) l = m + 1; else r = m;
+    }
+  if( l <= 0 || !good_blocks[l-1].includes( b.pos() ) ) return 0;
+  return std::min( good_blocks[l-1].end(), b.end() ) - b.pos();
+  }
+
+
+int Replayer::read( const Block & b, int & error )
+  {
+  const Request_map::iterator it =
+    requests.find( std::make_pair( b.pos(), (int)b.size() ) );
+  if( it != requests.end() )
+    {
+    Request & r = it->second;
+    const Outcome & o = r.outcomes[r.next];
+    if( r.next + 1 < r.outcomes.size() ) ++r.next;
+    advance_clock( o.latency );
+    error = o.error;
+    return o.copied_size;
+    }
+  const int size = good_size( b );
+  advance_clock( size * good_s + ( ( size < b.size() ) ? error_s : 0 ) );
+  error = EIO;
+  return size;
+  }
@@ -0,0 +1,117 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2004-2016 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Simulated input device. The data are read from the input file, but the
+// time taken by each read and the sectors that fail are decided by the
+// model. Time is counted by the virtual clock of main_common.cc.
+//
+class Input_model
+  {
+public:
+  virtual ~Input_model() {}
+
+  // Returns the number of bytes of 'b' read before the first error, and
+  // sets 'error' to the errno of the failed read, or to 0 if EOF.
+  virtual int read( const Block & b, int & error ) = 0;
+  };
+
+
+// Device described by a model file of latencies and error probabilities.
+//
+class Simulator : public Input_model
+  {
+public:
+  enum { max_tries = 8 };
+
+private:
+  struct Region : public Block
+    {
+    enum Type { latency, slow, error, stripe };
+    Type type;
+    bool exponential;			// latency distribution
+    double min_s, max_s;		// latency, or mean latency if exponential
+    long long rate;			// transfer rate of slow zone
+    long long period, width;		// error stripes
+    int probs;				// number of values in prob
+    double prob[max_tries];		// error probability for each try
+
+    Region( const long long p, const long long s, const Type t )
+      : Block( p, s ), type( t ), exponential( false ), min_s( 0 ),
+        max_s( 0 ), rate( 0 ), period( 0 ), width( 0 ), probs( 0 ) {}
+    };
+
+  std::vector< Region > regions;
+  std::map< long long, int > failures;	// failed reads of each sector
+  const char * const filename_;
+  unsigned long long seed;
+  unsigned long long reads;		// reads done so far
+  long long rate;			// transfer rate of good reads
+  long long last_end;			// end of last read, for seeks
+  double seek_s;			// time to reach a new position
+  double error_s;			// time to report a read error
+  double reset_interval, reset_s;	// device resets
+  double busy_s;			// time spent reading so far
+  double next_reset;			// busy time of next reset
+  const int hardbs_;
+
+  bool parse_line( const char * const line );
+  double random( const unsigned long long a, const unsigned long long b ) const;
+  bool sector_fails( const long long sector );
+
+public:
+  Simulator( const char * const name, const int hardbs );
+
+  int read( const Block & b, int & error );
+  };
+
+
+// Device replaying the outcomes recorded in a trace file by --log-trace.
+// Requests found in the trace get the recorded outcomes in the same order
+// (repeating the last one when exhausted). Other requests are served
+// from the areas read successfully in the trace; any other sector fails.
+//
+class Replayer : public Input_model
+  {
+  struct Outcome
+    {
+    int copied_size;
+    int error;
+    double latency;
+    Outcome( const int c, const int e, const double l )
+      : copied_size( c ), error( e ), latency( l ) {}
+    };
+
+  struct Request
+    {
+    std::vector< Outcome > outcomes;
+    unsigned next;
+    Request() : next( 0 ) {}
+    };
+
+  typedef std::map< std::pair< long long, int >, Request > Request_map;
+  Request_map requests;
+  std::vector< Block > good_blocks;	// sorted and non-contiguous
+  const char * const filename_;
+  double good_s, error_s;		// time per good byte, per error
+
+  int good_size( const Block & b ) const;
+
+public:
+  explicit Replayer( const char * const name );
+
+  int read( const Block & b, int & error );
+  };
@@ -0,0 +1,428 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2004-2016 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "block.h"
+#include "mapbook.h"
+#include "simulator.h"
+#include "control.h"
+#include "strategy.h"
+#include "rescuebook.h"
+
+
+namespace {
+
+// The algorithm described in the manual. Copies the non-tried blocks in
+// up to three passes, skipping over the damaged areas, then trims both
+// edges of each damaged area, scrapes the rest sector by sector, and
+// finally retries the bad sectors.
+//
+class Default_strategy : public Rescue_strategy
+  {
+  enum Phase { start, copy, trim, scrape, retry, done };
+
+  Phase phase;
+  int pass;			// copying pass or retry number
+  int skip_size;		// size to skip on error if skipbs > 0
+  long long pos, end;		// what remains to read of pass or area
+  long long area_pos, area_end;	// part of domain not yet trimmed/scraped
+  bool copy_pending, trim_pending, scrape_pending;
+  bool forward;			// direction of current pass
+  bool block_found;		// in current pass
+  bool pass_started;		// no block read yet in current pass
+  bool in_area;			// trimming/scraping the area [pos,end)
+  bool trailing;		// trimming the trailing edge of area
+  bool error_found;		// in current edge of area
+  char msgbuf[80];
+
+  void begin_pass( Rescuebook & rb, const char * const msg,
+                   const bool resume );
+  bool resume_pass( Rescuebook & rb );
+  bool next_pass( Rescuebook & rb );
+  void next_phase( Rescuebook & rb );
+  bool next_area( Rescuebook & rb, const Sblock::Status st );
+  bool next_pass_block( Rescuebook & rb, Read & r );
+  bool next_area_block( Rescuebook & rb, Read & r );
+
+public:
+  Default_strategy()
+    : phase( start ), pass( 0 ), skip_size( 0 ), pos( 0 ), end( 0 ),
+      area_pos( 0 ), area_end( 0 ), copy_pending( false ),
+      trim_pending( false ), scrape_pending( false ), forward( true ),
+      block_found( false ), pass_started( false ), in_area( false ),
+      trailing( false ), error_found( false )
+    { msgbuf[0] = 0; }
+
+  bool next_read( Rescuebook & rb, Read & r );
+  bool read_done( Rescuebook & rb, const Read & r,
+                  const int copied_size, const int error_size );
+  void skip( Rescuebook & rb, const bool whole_phase );
+  void get_state( int & current_pass, std::string & state ) const;
+  };
+
+const char * const copy_msg = "Copying non-tried blocks... Pass";
+const char * const retry_msg = "Retrying bad sectors... Retry";
+
+
+// Starts a copying or retry pass, resuming from current_pos if 'resume'
+// or if the rescue was interrupted during the first pass.
+//
+void Default_strategy::begin_pass( Rescuebook & rb, const char * const msg,
+                                   const bool resume )
+  {
+  const bool copying = ( phase == copy );
+  const Sblock::Status st = copying ? Sblock::non_tried : Sblock::bad_sector;
+  const Mapfile::Status curr_st = copying ? Mapfile::copying : Mapfile::retrying;
+
+  snprintf( msgbuf, sizeof msgbuf, "%s %d %s", msg, pass,
+            forward ? "(forwards)" : "(backwards)" );
+  pos = 0; end = LLONG_MAX;
+  skip_size = rb.skipbs;
+  block_found = false;
+  pass_started = true;
+  if( ( pass != 1 && !resume ) || rb.current_status() != curr_st ) return;
+  if( forward && rb.domain().includes( rb.current_pos() ) )
+    {
+    Block b( rb.current_pos(), 1 );
+    rb.find_chunk( b, st, rb.domain(), rb.hardbs() );
+    if( b.size() > 0 ) pos = b.pos();		// resume
+    }
+  else if( !forward && rb.domain().includes( rb.current_pos() - 1 ) )
+    {
+    Block b( rb.current_pos() - 1, 1 );
+    rb.rfind_chunk( b, st, rb.domain(), rb.hardbs() );
+    if( b.size() > 0 ) end = b.end();		// resume
+    }
+  }
+
+
+// Continues the pass interrupted in a previous run with the direction,
+// skip size and next position saved in the mapfile, if they are valid
+// for the current options. Returns false if there is no pass to continue.
+//
+bool Default_strategy::resume_pass( Rescuebook & rb )
+  {
+  const bool copying = ( phase == copy );
+  if( rb.current_status() !=
+      ( copying ? Mapfile::copying : Mapfile::retrying ) ) return false;
+  const int p = rb.current_pass();
+  char dir[16];
+  int skip = 0;
+  long long next = -1;
+  const int n = std::sscanf( rb.current_state().c_str(), "default %15s %d %lld",
+                             dir, &skip, &next );
+  if( n < 2 ) return false;
+  const bool fwd = ( std::strcmp( dir, "forwards" ) == 0 );
+  if( ( !fwd && std::strcmp( dir, "backwards" ) != 0 ) ||
+      ( copying && ( p > 3 || !( rb.cpass_bitset & ( 1 << ( p - 1 ) ) ) ) ) ||
+      ( !copying && rb.max_retries >= 0 && p > rb.max_retries ) )
+    return false;
+  if( copying )		// reduce rate as if the previous passes had run
+    for( int i = 1; i < p; ++i )
+      if( rb.cpass_bitset & ( 1 << ( i - 1 ) ) ) rb.reduce_min_read_rate();
+  pass = p; forward = fwd;
+  begin_pass( rb, copying ? copy_msg : retry_msg, true );
+  if( skip >= rb.skipbs && skip <= rb.max_skipbs ) skip_size = skip;
+  // Continue after the area skipped, if any, unless the block at
+  // current_pos was not read because the rescue was interrupted first.
+  if( n == 3 && next >= 0 )
+    { if( forward )
+        { if( pos != rb.current_pos() && next > pos ) pos = next; }
+      else if( end != rb.current_pos() && next < end ) end = next; }
+  return true;
+  }
+
+
+// Starts the next enabled copying pass or the next retry pass.
+// Returns false if there are no more passes in the current phase.
+//
+bool Default_strategy::next_pass( Rescuebook & rb )
+  {
+  if( phase == copy )
+    {
+    while( ++pass <= 3 )
+      {
+      if( pass > 1 && !rb.unidirectional ) forward = !forward;
+      if( rb.cpass_bitset & ( 1 << ( pass - 1 ) ) )
+        { begin_pass( rb, copy_msg, false ); return true; }
+      }
+    return false;
+    }
+  if( pass > 0 )
+    {
+    if( !rb.unidirectional ) forward = !forward;
+    if( pass >= INT_MAX ) return false;
+    }
+  if( rb.max_retries >= 0 && pass >= rb.max_retries ) return false;
+  ++pass;
+  begin_pass( rb, retry_msg, false );
+  return true;
+  }
+
+
+// Starts the next phase with something to do, or sets phase to done.
+//
+void Default_strategy::next_phase( Rescuebook & rb )
+  {
+  while( phase != done )
+    {
+    phase = Phase( phase + 1 );
+    pass = 0; forward = !rb.reverse;
+    if( phase == copy && copy_pending &&
+        ( resume_pass( rb ) || next_pass( rb ) ) ) return;
+    if( ( phase == trim && trim_pending && !rb.notrim ) ||
+        ( phase == scrape && scrape_pending && !rb.noscrape ) )
+      {
+      const char * const msg = ( phase == trim ) ?
+        "Trimming failed blocks..." : "Scraping failed blocks...";
+      snprintf( msgbuf, sizeof msgbuf, "%s %s", msg,
+                rb.reverse ? "(backwards)" : "(forwards)" );
+      area_pos = rb.domain().pos(); area_end = rb.domain().end();
+      in_area = false;
+      pass_started = true;
+      return;
+      }
+    if( phase == retry && ( resume_pass( rb ) || next_pass( rb ) ) ) return;
+    }
+  }
+
+
+// Finds the next area of status 'st' to trim or scrape, in the direction
+// given by the reverse option. Returns false if there are no more areas.
+//
+bool Default_strategy::next_area( Rescuebook & rb, const Sblock::Status st )
+  {
+  Block sb( 0, 0 );
+  if( !rb.reverse )
+    { sb.assign( area_pos, area_end - area_pos );
+      rb.find_chunk( sb, st, rb.domain(), 1 ); }
+  else
+    { sb.assign( 0, area_end );
+      rb.rfind_chunk( sb, st, rb.domain(), 1 ); }
+  if( sb.size() <= 0 ) return false;
+  if( !rb.reverse ) area_pos = sb.end(); else area_end = sb.pos();
+  pos = sb.pos(); end = sb.end();
+  in_area = true; trailing = false; error_found = false;
+  return true;
+  }
+
+
+// Copying reads softbs-sized blocks of non-tried data. Retrying reads
+// the bad sectors one at a time. Returns false at the end of the pass.
+//
+bool Default_strategy::next_pass_block( Rescuebook & rb, Read & r )
+  {
+  const bool copying = ( phase == copy );
+  const Sblock::Status st = copying ? Sblock::non_tried : Sblock::bad_sector;
+  const int size = copying ? rb.softbs() : rb.hardbs();
+  Block & b = r.block;
+
+  if( forward )
+    {
+    if( pos < 0 ) return false;
+    b.assign( pos, size );
+    rb.find_chunk( b, st, rb.domain(), size );
+    if( b.size() <= 0 ) return false;
+    if( pos != b.pos() ) skip_size = rb.skipbs;	// reset size on block change
+    pos = b.end();
+    }
+  else
+    {
+    if( end <= 0 ) return false;
+    b.assign( end - size, size );
+    rb.rfind_chunk( b, st, rb.domain(), size );
+    if( b.size() <= 0 ) return false;
+    if( end != b.end() ) skip_size = rb.skipbs;	// reset size on block change
+    end = b.pos();
+    }
+  block_found = true;
+  r.phase = copying ? Mapfile::copying : Mapfile::retrying;
+  r.error_status = copying ? Sblock::non_trimmed : Sblock::bad_sector;
+  r.forward = forward;
+  return true;
+  }
+
+
+// Trimming reads the leading edge of each non-trimmed area forwards until
+// an error is found, then the trailing edge backwards. Scraping reads
+// each non-scraped area forwards. Returns false at the end of the phase.
+//
+bool Default_strategy::next_area_block( Rescuebook & rb, Read & r )
+  {
+  const bool trimming = ( phase == trim );
+  const int hardbs = rb.hardbs();
+  Block & b = r.block;
+
+  r.phase = trimming ? Mapfile::trimming : Mapfile::scraping;
+  r.error_status = Sblock::bad_sector;
+  while( true )
+    {
+    if( !in_area && !next_area( rb, trimming ? Sblock::non_trimmed :
+                                               Sblock::non_scraped ) )
+      return false;
+    if( !trailing )
+      {
+      if( pos < end && ( !trimming || !error_found ) )
+        {
+        b.assign( pos, std::min( (long long)hardbs, end - pos ) );
+        if( b.end() != end ) b.align_end( hardbs );
+        pos = b.end();
+        r.forward = true;
+        return true;
+        }
+      trailing = true; error_found = false;
+      }
+    if( trimming && end > pos && !error_found )
+      {
+      const int size = std::min( (long long)hardbs, end - pos );
+      b.assign( end - size, size );
+      if( b.pos() != pos ) b.align_pos( hardbs );
+      end = b.pos();
+      r.forward = false;
+      return true;
+      }
+    in_area = false;
+    }
+  }
+
+
+bool Default_strategy::next_read( Rescuebook & rb, Read & r )
+  {
+  if( phase == start )
+    {
+    if( rb.status_size( Sblock::non_tried ) )
+      copy_pending = trim_pending = scrape_pending = true;
+    if( rb.status_size( Sblock::non_trimmed ) )
+      trim_pending = scrape_pending = true;
+    if( rb.status_size( Sblock::non_scraped ) )
+      scrape_pending = true;
+    next_phase( rb );
+    }
+  while( phase != done )
+    {
+    const bool pass_phase = ( phase == copy || phase == retry );
+    if( pass_phase ? next_pass_block( rb, r ) : next_area_block( rb, r ) )
+      {
+      r.msg = msgbuf;
+      r.new_pass = pass_started; pass_started = false;
+      return true;
+      }
+    if( pass_phase && block_found )	// a pass without blocks ends phase
+      {
+      if( phase == copy ) rb.reduce_min_read_rate();
+      if( next_pass( rb ) ) continue;
+      }
+    next_phase( rb );
+    }
+  return false;
+  }
+
+
+// Doubles the size skipped after each error or slow read during the
+// first two copying passes, and trims the trailing edge of an area only
+// until the first error, leaving the rest of the area non-scraped.
+//
+bool Default_strategy::read_done( Rescuebook & rb, const Read &,
+                                  const int copied_size, const int error_size )
+  {
+  if( phase == copy )
+    {
+    if( ( error_size > 0 || rb.slow_read() ) && ( forward ? pos >= 0 : end > 0 ) )
+      {
+      if( rb.skipbs > 0 && pass <= 2 )		// don't skip if skipbs == 0
+        {
+        Block b( 0, 0 );
+        if( forward )
+          {
+          b.assign( pos, skip_size );
+          rb.find_chunk( b, Sblock::non_tried, rb.domain(), rb.hardbs() );
+          if( pos == b.pos() && b.size() > 0 ) pos = b.end();	// skip
+          }
+        else
+          {
+          b.assign( end - skip_size, skip_size );
+          rb.rfind_chunk( b, Sblock::non_tried, rb.domain(), rb.hardbs() );
+          if( end == b.end() && b.size() > 0 ) end = b.pos();	// skip
+          }
+        if( skip_size <= rb.max_skipbs / 2 ) skip_size *= 2;
+        else skip_size = rb.max_skipbs;
+        }
+      return true;
+      }
+    if( copied_size > 0 ) skip_size = rb.skipbs;		// reset
+    return false;
+    }
+  if( phase == trim && error_size > 0 )
+    {
+    if( trailing && end > pos )
+      {
+      const long index = rb.find_index( end - 1 );
+      if( index >= 0 && rb.domain().includes( rb.sblock( index ) ) &&
+          rb.sblock( index ).status() == Sblock::non_trimmed )
+        rb.change_chunk_status( rb.sblock( index ), Sblock::non_scraped );
+      }
+    error_found = true;
+    }
+  return false;
+  }
+
+
+// A pass of trimming or scraping is one area.
+//
+void Default_strategy::skip( Rescuebook & rb, const bool whole_phase )
+  {
+  if( phase == start || phase == done ) return;
+  if( whole_phase ) next_phase( rb );
+  else if( phase == copy || phase == retry )
+    { pos = -1; end = 0; block_found = true; }	// continue with next pass
+  else in_area = false;
+  }
+
+
+// Trimming and scraping need no state; the areas already trimmed or
+// scraped have changed status in the map.
+//
+void Default_strategy::get_state( int & current_pass, std::string & state ) const
+  {
+  if( phase != copy && phase != retry )
+    { current_pass = 1; state.clear(); return; }
+  char buf[80];
+  snprintf( buf, sizeof buf, "default %s %d %lld",
+            forward ? "forwards" : "backwards", skip_size,
+            forward ? pos : end );
+  current_pass = pass; state = buf;
+  }
+
+} // end namespace
+
+
+Rescue_strategy * new_rescue_strategy( const char * const name )
+  {
+  if( !name || std::strcmp( name, "default" ) == 0 )
+    return new Default_strategy;
+  return 0;
+  }
@@ -0,0 +1,68 @@
+/*  GNU ddrescue - Data recovery tool
+    Copyright (C) 2004-2016 Antonio Diaz Diaz.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+class Rescuebook;
+
+// Decides which blocks are read during a rescue, and in which order.
+// Rescuebook asks the strategy for the next block to read, reads it,
+// updates the map and the rates, and reports the result back. The
+// strategy may inspect the map, the options, the rates and the time
+// through the Rescuebook, and may reclassify the areas of the map.
+//
+class Rescue_strategy
+  {
+public:
+  struct Read				// next block to read
+    {
+    Block block;
+    const char * msg;			// shown on status line and logged
+    Mapfile::Status phase;		// current status written to mapfile
+    Sblock::Status error_status;	// for errors larger than hardbs
+    bool forward;			// sets current_pos to block.pos()
+    bool new_pass;			// print msg, pause if pause > 0
+
+    Read()
+      : block( 0, 0 ), msg( "" ), phase( Mapfile::copying ),
+        error_status( Sblock::bad_sector ), forward( true ),
+        new_pass( false ) {}
+    };
+
+  virtual ~Rescue_strategy() {}
+
+  // Sets 'r' to the next block to read. Returns false if there are no
+  // more blocks to read.
+  virtual bool next_read( Rescuebook & rb, Read & r ) = 0;
+
+  // Called after 'r' has been read and the map updated. Returns true if
+  // the input file should be reopened (if reopen_on_error).
+  virtual bool read_done( Rescuebook & rb, const Read & r,
+                          const int copied_size, const int error_size ) = 0;
+
+  // Abandons the rest of the current pass, or of the current phase if
+  // 'phase' is true. Called between reads.
+  virtual void skip( Rescuebook & rb, const bool phase ) = 0;
+
+  // Sets 'pass' and 'state' (one line of text) to what the strategy needs
+  // to resume the rescue exactly at the current point. They are saved in
+  // the mapfile with current_pos, and can be read back through the
+  // Rescuebook when the rescue is resumed.
+  virtual void get_state( int & pass, std::string & state ) const = 0;
+  };
+
+
+// Returns a new strategy of the given name, or 0 if the name is unknown.
+Rescue_strategy * new_rescue_strategy( const char * const name );
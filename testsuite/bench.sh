@@ -0,0 +1,117 @@
+#! /bin/sh
+# throughput benchmark for GNU ddrescue - Data recovery tool
+# Copyright (C) 2009-2016 Antonio Diaz Diaz.
+#
+# This script is free software: you have unlimited permission
+# to copy, distribute and modify it.
+#
+# Usage: bench.sh [<size_in_MiB> [<configs>]]
+#
+# Runs ddrescue on a dense image, on a sparse image and on the dense
+# image with injected read errors (test mode), with each configuration
+# of options listed in 'configs' below (or given as second argument,
+# one 'name|options' per line). Prints a report with the speed, the CPU
+# time, the number of system calls (if strace is available) and the time
+# the rescue was stalled writing the mapfile. The report is also written
+# to 'bench/report', so that the reports of two versions can be compared
+# with diff. Files are created in directory 'bench' of the current
+# directory, which must have room for three images of the given size.
+
+LC_ALL=C
+export LC_ALL
+objdir=`pwd`
+DDRESCUE="${objdir}"/ddrescue
+framework_failure() { echo "failure in benchmark framework" ; exit 1 ; }
+
+if [ ! -f "${DDRESCUE}" ] || [ ! -x "${DDRESCUE}" ] ; then
+	echo "${DDRESCUE}: cannot execute"
+	exit 1
+fi
+
+size=${1:-256}
+configs=${2:-'default|
+c16|-c16
+c1024|-c1024
+idirect|-d
+odirect|-D
+sparse|-S
+synchronous|-y
+nomapfile|
+logging|--log-rates=rates --log-reads=reads --log-trace=trace
+preview|-P
+quiet|-q'}
+if command -v strace > /dev/null 2>&1 ; then strace=yes ; else strace=no ; fi
+
+if [ -d bench ] ; then rm -rf bench ; fi
+mkdir bench || framework_failure
+cd "${objdir}"/bench
+
+printf "creating images of %s MiB..." "${size}"
+dd if=/dev/urandom of=dense bs=1048576 count=${size} 2> /dev/null ||
+	framework_failure
+dd if=/dev/zero of=sparse bs=1048576 count=0 seek=${size} 2> /dev/null ||
+	framework_failure
+# test mode mapfile with a bad area of 64 KiB every 8 MiB
+awk -v size=${size} 'BEGIN {
+	print "0 +"
+	for( pos = 0; pos < size * 1048576; pos += 8388608 )
+		{ print pos, 8323072, "+"; print pos + 8323072, 65536, "-" } }' \
+	> errmap || framework_failure
+printf "done\n"
+
+# Returns the CPU time (user and system) used so far by the children of
+# the shell, reading the output of 'times' from file $1.
+cpu_time() {
+	awk 'NR == 2 { split( $1, u, "m" ) ; split( $2, s, "m" )
+		printf "%.3f %.3f\n", u[1] * 60 + u[2], s[1] * 60 + s[2] }' $1
+}
+
+now() { date +%s.%N | sed -e 's/\.N$//' -e 's/\.%N$//' ; }
+
+report() { printf "%s\n" "$*" | tee -a report ; }
+
+report "# ddrescue throughput benchmark. Images of ${size} MiB."
+report "# Stall: time spent writing the mapfile (count, total s, longest s)."
+report "$(printf "%-7s %-12s %9s %8s %8s %9s %6s %8s %8s" input config \
+	MB/s user_s sys_s syscalls writes stall stall_max)"
+
+for input in dense sparse errors ; do
+	printf "%s\n" "${configs}" | while IFS='|' read name opts ; do
+		[ -z "${name}" ] && continue
+		infile=${input} ; hopt=
+		[ ${input} = errors ] && { infile=dense ; hopt="-H errmap" ; }
+		mapfile=mapfile ; [ ${name} = nomapfile ] && mapfile=
+		vopt=-v ; [ ${name} = quiet ] && vopt=
+		rm -f out mapfile rates reads trace
+		times > times1
+		t0=`now`
+		"${DDRESCUE}" ${vopt} ${hopt} ${opts} ${infile} out ${mapfile} \
+			> stdout 2> stderr
+		status=$?
+		t1=`now`
+		times > times2
+		if [ ${status} != 0 ] ; then
+			report "$(printf "%-7s %-12s  failed: %s" ${input} ${name} \
+				"`head -n 1 stderr`")"
+			continue
+		fi
+		cpu=`cpu_time times1` ; cpu2=`cpu_time times2`
+		syscalls=-
+		if [ ${strace} = yes ] ; then
+			rm -f out mapfile rates reads trace
+			strace -f -c -o strace.out "${DDRESCUE}" -q ${hopt} ${opts} \
+				${infile} out ${mapfile} > /dev/null 2>&1
+			syscalls=`awk '$NF == "total" { print $4 }' strace.out`
+		fi
+		stall=`sed -n 's/^Mapfile updates: \([0-9]*\),  total time: \([0-9.]*\)s,  longest: \([0-9.]*\)s$/\1 \2 \3/p' stdout`
+		[ -z "${stall}" ] && stall="- - -"
+		report "$(echo ${t0} ${t1} ${cpu} ${cpu2} | awk -v size=${size} \
+			-v input=${input} -v name=${name} -v sc=${syscalls} -v st="${stall}" '{
+			split( st, s, " " ) ; t = $2 - $1 ; if( t <= 0 ) t = 0.001
+			printf "%-7s %-12s %9.1f %8.3f %8.3f %9s %6s %8s %8s\n",
+				input, name, size * 1.048576 / t, $5 - $3, $6 - $4, sc,
+				s[1], s[2], s[3] }')"
+	done
+done
+rm -f dense sparse out
+exit 0
@@ -11,6 +11,7 @@ objdir=`pwd`
 testdir=`cd "$1" ; pwd`
 DDRESCUE="${objdir}"/ddrescue
 DDRESCUELOG="${objdir}"/ddrescuelog
+MAPBENCH="${objdir}"/mapbench
 framework_failure() { echo "failure in testing framework" ; exit 1 ; }
 
 if [ ! -f "${DDRESCUE}" ] || [ ! -x "${DDRESCUE}" ] ; then
@@ -61,6 +62,12 @@ if [ $? = 1 ] ; then printf . ; else printf - ; fail=1 ; fi
 if [ $? = 1 ] ; then printf . ; else printf - ; fail=1 ; fi
 "${DDRESCUE}" -q -F- -G ${in} out mapfile
 if [ $? = 1 ] ; then printf . ; else printf - ; fail=1 ; fi
+"${DDRESCUE}" -q -G --file-domain=${in} ${in} out
+if [ $? = 1 ] ; then printf . ; else printf - ; fail=1 ; fi
+"${DDRESCUE}" -q --file-domain=${in} ${in} out mapfile
+if [ $? = 1 ] ; then printf . ; else printf - ; fail=1 ; fi
+"${DDRESCUE}" -q --file-domain=${in} ${in} out
+if [ $? = 1 ] ; then printf . ; else printf - ; fail=1 ; fi
 "${DDRESCUE}" -q -H ${map2i} ${in} out mapfile
 if [ $? = 2 ] ; then printf . ; else printf - ; fail=1 ; fi
 "${DDRESCUE}" -q -K ${in} out
@@ -125,6 +132,131 @@ rm -f out
 cmp ${in} out || fail=1
 printf .
 
+rm -f out
+"${DDRESCUE}" -q -c1 --page-file=pages -H ${map3} ${in3} out || fail=1
+"${DDRESCUE}" -q -c2 --page-file=pages -H ${map4} ${in4} out || fail=1
+"${DDRESCUE}" -q -M --page-file=pages --page-cache=1 -H ${map5} ${in5} out ||
+	fail=1
+cmp ${in} out || fail=1
+[ -e pages ] && fail=1
+printf .
+
+rm -f out
+"${DDRESCUE}" -q -c1 --mmap ${in} out || fail=1
+cmp ${in} out || fail=1
+rm -f out
+"${DDRESCUE}" -q -c3 -R -S --mmap ${in} out || fail=1
+cmp ${in} out || fail=1
+printf .
+
+rm -f out
+"${DDRESCUE}" -q -S ${in1} out || fail=1
+cmp ${in1} out || fail=1
+rm -f out
+"${DDRESCUE}" -q -c5 -R -S ${in3} out || fail=1
+cmp ${in3} out || fail=1
+printf .
+# the zero sectors inside a block, and at its end, must be left as holes
+dd if=/dev/zero of=zeros bs=1024 count=60 2> /dev/null || framework_failure
+rm -f holes
+dd if=/dev/zero of=holes bs=1 count=1 seek=65535 2> /dev/null || framework_failure
+if [ `du -k holes | cut -f1` -lt 64 ] ; then	# file system has holes
+	{ head -c 2048 ${in} ; cat zeros ; head -c 2048 ${in2} ; } > in64
+	{ head -c 2048 ${in} ; cat zeros zeros ; } | head -c 65536 > in64z
+	for i in in64 in64z ; do
+		rm -f out
+		"${DDRESCUE}" -q -S $i out || fail=1
+		cmp $i out || fail=1
+		[ `du -k out | cut -f1` -lt 64 ] || fail=1
+	done
+fi
+printf .
+"${DDRESCUE}" -q -d --mmap ${in} out
+if [ $? = 1 ] ; then printf . ; else printf - ; fail=1 ; fi
+"${DDRESCUE}" -q -d --auto-direct ${in} out
+if [ $? = 1 ] ; then printf . ; else printf - ; fail=1 ; fi
+# clean areas are read buffered, and the areas near errors direct
+i=0 ; while [ $i -lt 40 ] ; do cat ${in} ; i=`expr $i + 1` ; done > in40
+pos=2097152
+{ printf "0 +\n0 %d +\n" ${pos}
+  i=0 ; while [ $i -lt 100 ] ; do
+    printf "%d 512 -\n%d 512 +\n" ${pos} `expr ${pos} + 512`
+    pos=`expr ${pos} + 1024` ; i=`expr $i + 1` ; done
+  printf "%d 0x10000000 +\n" ${pos} ; } > errmap
+rm -f out mapfile
+"${DDRESCUE}" --auto-direct -H errmap in40 out mapfile > log 2>&1
+if [ $? = 0 ] ; then
+	tr '\r' '\n' < log | grep 'direct:' | tail -n 1 > status
+	grep -q 'direct: *0 B' status && fail=1
+	grep -q 'buffered: *0 B' status && fail=1
+	"${DDRESCUE}" --auto-direct -r1 in40 out mapfile > log 2>&1 || fail=1
+	tr '\r' '\n' < log | grep 'direct:' | tail -n 1 > status
+	grep -q 'direct: *0 B' status && fail=1
+	grep -q 'buffered: *0 B' status || fail=1
+	cmp in40 out || fail=1
+	printf .
+elif grep -q 'direct access' log ; then printf .	# no O_DIRECT here
+else printf - ; fail=1
+fi
+
+printf "error 0 -1 1 0  # fail once\nstripe 0 -1 4096 512 1 1 0\n" > model
+rm -f out
+"${DDRESCUE}" -q -r2 --simulate=model ${in} out || fail=1
+cmp ${in} out || fail=1
+printf .
+printf "rate 0\n" > model
+"${DDRESCUE}" -q --simulate=model ${in} out
+if [ $? = 2 ] ; then printf . ; else printf - ; fail=1 ; fi
+
+rm -f out
+"${DDRESCUE}" -q -r1 --strategy=default -H ${map1} ${in} out || fail=1
+cmp ${in1} out || fail=1
+printf .
+"${DDRESCUE}" -q --strategy=none ${in} out
+if [ $? = 1 ] ; then printf . ; else printf - ; fail=1 ; fi
+printf "0x8000 ? 2  default backwards 65536\n0 %s ?\n" `wc -c < "${in}"` > mapfile
+rm -f out
+"${DDRESCUE}" -q -n ${in} out mapfile || fail=1
+cmp ${in} out || fail=1
+grep -q '^0x[0-9A-F]* *+ *1$' mapfile || fail=1
+printf .
+# pass 2 backwards was interrupted after skipping 0x4000-0x8000; it must
+# go on at 0x4000, and the area skipped must be read by pass 3.
+printf "0x10000 ? 2  default backwards 32768 16384\n0 0x8000 ?\n0x8000 0x8000 *\n0x10000 0x1C48 +\n" > mapfile
+cat ${in} > out || framework_failure
+"${DDRESCUE}" -q -n -N --log-reads=log ${in} out mapfile || fail=1
+cmp ${in} out || fail=1
+grep '^# [0-9]*s  Copying\|^0x' log | sed -e 's/^# [0-9]*s  //' | tr '\t' ' ' > reads
+printf "Copying non-tried blocks... Pass 2 (backwards)\n0x00000000 16384 16384 0\nCopying non-tried blocks... Pass 3 (forwards)\n0x00004000 16384 16384 0\n" > copy
+cmp copy reads || fail=1
+printf .
+
+rm -f out mapfile
+"${DDRESCUE}" -q -H ${map1} ${in} out mapfile || fail=1
+"${DDRESCUE}" -q -F'*/-' ${in2} out mapfile || fail=1
+rm -f out2 mapfile
+"${DDRESCUE}" -q -H ${map1} --mark-bad=${in2} ${in} out2 mapfile || fail=1
+cmp out out2 || fail=1
+printf .
+if [ -c /dev/full ] ; then	# writing the marks fails; stop at the first
+	rm -f mapfile
+	printf "0x00000000 +\n0x00000000 0x00011C48 -\n" > allbad || framework_failure
+	"${DDRESCUE}" -q -f --mark-bad -H allbad ${in} /dev/full mapfile
+	if [ $? = 1 ] ; then printf . ; else printf - ; fail=1 ; fi
+	grep -q '^0x00000000  *?  *1 ' mapfile || fail=1
+fi
+
+rm -f out
+"${DDRESCUE}" -q -r1 --log-trace=trace -H ${map1} ${in} out || fail=1
+rm -f out
+"${DDRESCUE}" -q -r1 --replay=trace ${in} out || fail=1
+cmp ${in1} out || fail=1
+printf .
+rm -f out
+"${DDRESCUE}" -q -c1 -r1 --replay=trace ${in} out || fail=1
+cmp ${in1} out || fail=1
+printf .
+
 rm -f out
 "${DDRESCUE}" -q -X -m - ${in} out < ${map1} || fail=1
 cmp ${in1} out || fail=1
@@ -201,6 +333,115 @@ cat ${in2} > out || framework_failure
 cmp ${in} out || fail=1
 printf .
 
+rm -f mapfile
+cat ${in} > copy || framework_failure
+"${DDRESCUE}" -q --diff-mode ${in} copy mapfile || fail=1
+"${DDRESCUELOG}" -D mapfile || fail=1
+rm -f mapfile
+cat ${in1} > out || framework_failure
+"${DDRESCUE}" -q -b1 --diff-mode ${in1} ${in2} mapfile || fail=1
+"${DDRESCUELOG}" -a '*/,?+' mapfile > copy || fail=1
+"${DDRESCUE}" -q -m copy ${in2} out || fail=1
+cmp ${in} out || fail=1
+printf .
+
+# --reattach: the input is removed before the first read, and files of
+# the same size appear. Without a known good sector nor a device identity,
+# no file is accepted; with a sector rescued before, the right one is.
+cat ${in} > rin || framework_failure
+printf "0x00000000 +\n0x00000000 0x00011C48 -\n" > allbad || framework_failure
+rm -f out mapfile rdev1 rdev2
+( sleep 1 ; rm -f rin ; cat ${in2} > rdev1 ; echo y ) |
+	"${DDRESCUE}" -q --ask --reattach='rdev*' -H allbad rin out mapfile > /dev/null &
+pid=$!
+sleep 4 ; kill -INT ${pid}
+wait ${pid} && fail=1
+printf .
+rm -f rin out mapfile rdev1 log
+cat ${in} > rin || framework_failure
+"${DDRESCUE}" -q -H ${map1} rin out mapfile || fail=1
+( sleep 1 ; rm -f rin ; cat ${in2} > rdev1 ; cat ${in} > rdev2 ; echo y ) |
+	"${DDRESCUE}" -q -r1 --ask --reattach='rdev*' --log-reads=log -H ${map1} \
+	rin out mapfile > /dev/null || fail=1
+grep -q "reattached as rdev2" log || fail=1
+printf .
+rm -f rdev1 rdev2
+
+# --control: a client that sends nothing must not hold up the others
+if perl -MIO::Socket::UNIX -e 1 2> /dev/null ; then
+	control() {
+		perl -MIO::Socket::UNIX -e '$s = IO::Socket::UNIX->new( Peer => $ARGV[0] )
+			or exit 1; print $s "$ARGV[1]\n"; print while <$s>;' ctl "$1"
+	}
+	rm -f out mapfile ctl
+	"${DDRESCUE}" -q -c1 -Z1Ki --control=ctl ${in} out mapfile &
+	pid=$!
+	i=0
+	while [ ! -S ctl ] && [ $i -lt 10 ] ; do sleep 1 ; i=$((i+1)) ; done
+	perl -MIO::Socket::UNIX -e 'IO::Socket::UNIX->new( Peer => "ctl" ) and sleep 8' &
+	idle=$!
+	control status > reply
+	grep -q "^status: copying$" reply || fail=1
+	grep -q "^max-read-rate: 1024$" reply || fail=1
+	[ "`control frob`" = "error: unknown command" ] || fail=1
+	[ "`control 'set max-read-rate 1Ks'`" = "error: bad value" ] || fail=1
+	[ "`control 'set max-errors -2'`" = "error: bad value" ] || fail=1
+	[ "`control 'set max-read-rate 0'`" = ok ] || fail=1
+	wait ${pid} || fail=1
+	cmp ${in} out || fail=1
+	kill ${idle} 2> /dev/null
+	printf .
+fi
+
+# random finds and changes on packed and unpacked maps must give the same results
+"${MAPBENCH}" -m0 -n0 -r30000 || fail=1
+printf .
+
+if [ -n "${CSS_STANDIN}" ] ; then	# built with the CSS stand-in
+	DVDGEN="${objdir}"/dvdgen
+	"${DVDGEN}" -s4Mi -x1Mi dvd || fail=1
+	"${DVDGEN}" -s4Mi -x1Mi -k -b4 -i -e errmap dvdk || fail=1
+	cmp -s dvd dvdk && fail=1
+	printf .
+	rm -f out mapfile
+	"${DDRESCUE}" -q --dvd dvdk out mapfile || fail=1
+	cmp dvd out || fail=1
+	printf .
+	rm -f out mapfile
+	"${DDRESCUE}" -q --dvd -H errmap dvdk out mapfile || fail=1
+	cmp -s dvd out && fail=1
+	"${DDRESCUE}" -q -r1 --dvd dvdk out mapfile || fail=1
+	cmp dvd out || fail=1
+	printf .
+	rm -f out mapfile
+	"${DDRESCUE}" -q --dvd dvd out || fail=1
+	cmp dvd out || fail=1
+	printf .
+fi
+
+# the fragmented files of the images are mapped with their metadata
+rm -f mapfile
+printf "Documents/Deep/c.bin\n# comment\nupper.txt\n" > list
+"${DDRESCUE}" -q --file-domain=list "${testdir}"/fat12.img mapfile || fail=1
+"${DDRESCUELOG}" -q -P "${testdir}"/domain_fat12 mapfile || fail=1
+printf .
+rm -f mapfile
+printf "docs/big.txt\n" | "${DDRESCUE}" -q --file-domain=- \
+  "${testdir}"/ext2.img mapfile || fail=1
+"${DDRESCUELOG}" -q -P "${testdir}"/domain_ext2 mapfile || fail=1
+printf .
+rm -f mapfile
+printf "users/alice/thesis.tex\nUsers/Fragmented Big\nUsers/alice/vm disk.img\n" > list
+"${DDRESCUE}" -q --file-domain=list "${testdir}"/ntfs.img mapfile || fail=1
+"${DDRESCUELOG}" -q -P "${testdir}"/domain_ntfs mapfile || fail=1
+printf .
+# paths not found make ddrescue fail, but the mapfile is written
+printf "docs/big.txt\ndocs/none.txt\n" > list
+"${DDRESCUE}" -q -f --file-domain=list "${testdir}"/ext2.img mapfile
+if [ $? = 1 ] ; then printf . ; else printf - ; fail=1 ; fi
+"${DDRESCUELOG}" -q -P "${testdir}"/domain_ext2 mapfile || fail=1
+printf .
+
 printf "\ntesting ddrescuelog-%s..." "$2"
 
 "${DDRESCUELOG}" -q mapfile
@@ -225,6 +466,25 @@ r=$?
 "${DDRESCUELOG}" -d mapfile2
 if [ $? = 0 ] && [ $r = 1 ] ; then printf . ; else printf - ; fail=1 ; fi
 
+"${DDRESCUELOG}" -a '?,+' - < ${map2} > mapfile
+"${DDRESCUELOG}" -t mapfile > out || fail=1
+"${DDRESCUELOG}" -t - < mapfile > copy || fail=1
+cmp out copy || fail=1
+printf .
+rm -f out mapfile
+"${DDRESCUE}" -q ${in} out mapfile || fail=1
+sed -e 's/  +$/  -/' mapfile > copy || framework_failure
+mv -f copy mapfile || framework_failure
+"${DDRESCUELOG}" -q -d mapfile
+if [ $? = 1 ] && [ -f mapfile ] ; then printf . ; else printf - ; fail=1 ; fi
+"${DDRESCUELOG}" -q --fleet-status ${map1} ${map2i} > out
+if [ $? = 2 ] ; then printf . ; else printf - ; fail=1 ; fi
+[ `grep -c finished out` = 1 ] || fail=1	# corrupt map2i doesn't stop map1
+"${DDRESCUELOG}" --fleet-status=json --jobs=2 ${map1} ${map2} ${map3} > out ||
+	fail=1
+[ `grep -c '"ok": true' out` = 3 ] || fail=1
+printf .
+
 "${DDRESCUELOG}" -b2048 -l+ - < ${map1} > out || fail=1
 "${DDRESCUELOG}" -b2048 -c - < out > mapfile || fail=1
 "${DDRESCUELOG}" -b2048 -l+ mapfile > copy || fail=1